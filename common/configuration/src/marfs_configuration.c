@@ -325,33 +325,50 @@ MarFS_Namespace_Ptr find_namespace_by_mnt_path( const char *mnt_path ) {
  ****************************************************************************/
 MarFS_Repo_Ptr find_repo_by_range (MarFS_Namespace_Ptr	namespacePtr,
                                    size_t                file_size  ) {   
-  int i;
+  int lo, hi, mid;
+  MarFS_Repo_Range_Ptr range;
+
+  if ( namespacePtr == NULL ) {
+    return NULL;
+  }
 
-  if ( namespacePtr != NULL ) {
-    for ( i = 0; i < namespacePtr->repo_range_list_count; i++ ) {
 #ifdef _DEBUG_MARFS_CONFIGURATION
-  LOG( LOG_INFO, "File size sought is %d.\n", file_size );
+  LOG( LOG_INFO, "File size sought is %lu.\n", file_size );
   LOG( LOG_INFO, "Namespace is \"%s\"\n", namespacePtr->name );
-  LOG( LOG_INFO, "Namespace's repo_range_list[%d]->min_size is %d.\n",
-       i, namespacePtr->repo_range_list[i]->min_size );
-  LOG( LOG_INFO, "Namespace's repo_range_list[%d]->max_size is %d.\n",
-       i, namespacePtr->repo_range_list[i]->max_size );
 #endif
 
-      if ((( file_size >= namespacePtr->repo_range_list[i]->min_size ) &&
+/*
+ * The range list was sorted by min_size, and checked for overlaps and
+ * gaps, by index_repo_ranges() when the configuration was loaded.  Find
+ * the last range whose min_size is <= file_size, then make sure the file
+ * isn't past the end of that range.
+ */
 
-          (( file_size <= namespacePtr->repo_range_list[i]->max_size ) ||
-           ( namespacePtr->repo_range_list[i]->max_size == -1 )))) {
+  range = NULL;
+  lo = 0;
+  hi = namespacePtr->repo_range_list_count - 1;
+  while ( lo <= hi ) {
+    mid = lo + (( hi - lo ) / 2 );
+    if ( (size_t) namespacePtr->repo_range_list[mid]->min_size <= file_size ) {
+      range = namespacePtr->repo_range_list[mid];
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  if (( range != NULL ) &&
+      (( range->max_size == -1 ) ||
+       ( file_size <= (size_t) range->max_size ))) {
 
 #ifdef _DEBUG_MARFS_CONFIGURATION
-         LOG( LOG_INFO, "Repo pointer for this range is '%s'\n",
-              namespacePtr->repo_range_list[i]->repo_ptr->name );
+    LOG( LOG_INFO, "Repo pointer for this range (min: %d, max: %d) is '%s'\n",
+         range->min_size, range->max_size, range->repo_ptr->name );
 #endif
 
-        return namespacePtr->repo_range_list[i]->repo_ptr;
-      }
-    }
+    return range->repo_ptr;
   }
+
 #ifdef _DEBUG_MARFS_CONFIGURATION
   LOG( LOG_INFO, "Repo pointer for this range not found. Returning NULL.\n" );
 #endif
@@ -659,6 +676,102 @@ int decode_correcttype( char code, MarFS_CorrectType *enumeration ) {
 /****************************************************************************/
 
 
+/*****************************************************************************
+ *
+ * Sort a namespace's repo_range_list by min_size, so that
+ * find_repo_by_range() can use a binary search, and make sure the ranges
+ * describe one contiguous, non-overlapping set of file-sizes.  Ranges are
+ * inclusive at both ends, so each range must begin exactly one byte past
+ * the end of the previous one.  Only the last range may have an unbounded
+ * max_size (-1).
+ *
+ * Overlapping or gapped ranges would make the repo chosen for a given
+ * file-size depend on the order of ranges in the config file (or fail
+ * entirely), so we reject them here.  Sizes below the first range, or
+ * above a bounded last range, just have no repo; we warn about those.
+ *
+ * Returns 0 for success, -1 for failure.
+ *
+ ****************************************************************************/
+
+static int compare_repo_range_min( const void *a, const void *b ) {
+  const MarFS_Repo_Range_Ptr rangeA = *(const MarFS_Repo_Range_Ptr *) a;
+  const MarFS_Repo_Range_Ptr rangeB = *(const MarFS_Repo_Range_Ptr *) b;
+
+  if ( rangeA->min_size < rangeB->min_size ) {
+    return -1;
+  } else if ( rangeA->min_size > rangeB->min_size ) {
+    return 1;
+  }
+  return 0;
+}
+
+static int index_repo_ranges( MarFS_Namespace_Ptr namespacePtr ) {
+  MarFS_Repo_Range_List list = namespacePtr->repo_range_list;
+  int                   count = namespacePtr->repo_range_list_count;
+  int                   k;
+
+  if ( count == 0 ) {
+    LOG( LOG_WARNING, "Namespace \"%s\" has no repo ranges.\n",
+         namespacePtr->name );
+    return 0;
+  }
+
+  for ( k = 0; k < count; k++ ) {
+    if ( list[k]->min_size < 0 ) {
+      LOG( LOG_ERR, "Invalid min_size %d for a range in namespace \"%s\".\n",
+           list[k]->min_size, namespacePtr->name );
+      return -1;
+    }
+    if (( list[k]->max_size != -1 ) &&
+        ( list[k]->max_size < list[k]->min_size )) {
+      LOG( LOG_ERR, "Invalid range (min: %d, max: %d) in namespace \"%s\".\n",
+           list[k]->min_size, list[k]->max_size, namespacePtr->name );
+      return -1;
+    }
+  }
+
+  qsort( list, count, sizeof( MarFS_Repo_Range_Ptr ), compare_repo_range_min );
+
+  for ( k = 1; k < count; k++ ) {
+    if ( list[k-1]->max_size == -1 ) {
+      LOG( LOG_ERR, "Range (min: %d, max: -1) in namespace \"%s\" is unbounded, "
+           "but is followed by range (min: %d, max: %d).\n",
+           list[k-1]->min_size, namespacePtr->name,
+           list[k]->min_size, list[k]->max_size );
+      return -1;
+    }
+    if ( list[k]->min_size <= list[k-1]->max_size ) {
+      LOG( LOG_ERR, "Range (min: %d, max: %d) overlaps range (min: %d, max: %d) "
+           "in namespace \"%s\".\n",
+           list[k-1]->min_size, list[k-1]->max_size,
+           list[k]->min_size, list[k]->max_size,
+           namespacePtr->name );
+      return -1;
+    }
+    if ( list[k]->min_size != list[k-1]->max_size + 1 ) {
+      LOG( LOG_ERR, "Gap between range (min: %d, max: %d) and range (min: %d, max: %d) "
+           "in namespace \"%s\".\n",
+           list[k-1]->min_size, list[k-1]->max_size,
+           list[k]->min_size, list[k]->max_size,
+           namespacePtr->name );
+      return -1;
+    }
+  }
+
+  if ( list[0]->min_size != 0 ) {
+    LOG( LOG_WARNING, "Namespace \"%s\" has no repo for files smaller than %d.\n",
+         namespacePtr->name, list[0]->min_size );
+  }
+  if ( list[count-1]->max_size != -1 ) {
+    LOG( LOG_WARNING, "Namespace \"%s\" has no repo for files larger than %d.\n",
+         namespacePtr->name, list[count-1]->max_size );
+  }
+
+  return 0;
+}
+
+
 /*****************************************************************************
  *
  * This function returns the configuration after reading the configuration
@@ -1157,6 +1270,12 @@ static MarFS_Config_Ptr read_configuration_internal() {
     marfs_namespace_list[j]->repo_range_list = marfs_repo_range_list;
     marfs_namespace_list[j]->repo_range_list_count = repoRangeCount;
 
+    if ( index_repo_ranges( marfs_namespace_list[j] )) {
+      LOG( LOG_ERR, "Invalid repo ranges for namespace \"%s\".\n",
+           marfs_namespace_list[j]->name );
+      return NULL;
+    }
+
     marfs_namespace_list[j]->trash_md_path = strdup( namespaceList[j]->trash_md_path );
     marfs_namespace_list[j]->trash_md_path_len = strlen( namespaceList[j]->trash_md_path );
 
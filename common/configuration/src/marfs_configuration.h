@@ -86,7 +86,13 @@ typedef enum {
    ACCESSMETHOD_S3_EMC,                // should include installed release version
 } MarFS_AccessMethod;
 
-#define ACCESSMETHOD_IS_S3(ACCESSMETHOD)  ((ACCESSMETHOD) & (ACCESSMETHOD_S3 | ACCESSMETHOD_S3_SCALITY | ACCESSMETHOD_S3_EMC | ACCESSMETHOD_SPROXYD))
+// NOTE: These aren't bit-flags, so OR-ing them into a mask would match
+//     every non-DIRECT method (including SEMI_DIRECT).
+#define ACCESSMETHOD_IS_S3(ACCESSMETHOD)           \
+   (   ((ACCESSMETHOD) == ACCESSMETHOD_S3)         \
+    || ((ACCESSMETHOD) == ACCESSMETHOD_S3_SCALITY) \
+    || ((ACCESSMETHOD) == ACCESSMETHOD_S3_EMC)     \
+    || ((ACCESSMETHOD) == ACCESSMETHOD_SPROXYD))
 
 extern int         lookup_accessmethod( const char* str, MarFS_AccessMethod *enumeration );
 extern const char* accessmethod_string( MarFS_AccessMethod method );
@@ -312,7 +318,7 @@ typedef struct marfs_namespace {
   char                 *md_path;
   size_t                md_path_len;
   MarFS_Repo_Ptr        iwrite_repo;
-  MarFS_Repo_Range_List repo_range_list;
+  MarFS_Repo_Range_List repo_range_list;       // sorted by min_size
   int                   repo_range_list_count;
   char                 *trash_md_path;
   size_t                trash_md_path_len;
@@ -375,7 +381,9 @@ extern MarFS_Namespace_Ptr find_namespace_by_mnt_path( const char *mnt_path );
  * the pointer to that repo record.
  *
  * Given a file-size, find the corresponding repo that is the namespace's
- * repository for files of this size.
+ * repository for files of this size.  The namespace's repo_range_list is
+ * sorted by min_size (and checked for overlaps and gaps) when the
+ * configuration is read, so this is a binary search.
  */
 
 extern MarFS_Repo_Ptr find_repo_by_range (
@@ -1,8 +1,56 @@
+// _GNU_SOURCE defines pthread_atfork() prototypes, strcasecmp(), etc, under -std=c99
+#define _GNU_SOURCE
+
 #include "logging.h"
 
 #include <stdlib.h>             // malloc()
 #include <string.h>
+#include <strings.h>            // strcasecmp()
 #include <assert.h>
+#include <time.h>               // clock_gettime()
+#include <errno.h>
+#include <pthread.h>
+
+
+// ---------------------------------------------------------------------------
+// run-time level filtering  [see LOG_ENABLED() in logging.h]
+// ---------------------------------------------------------------------------
+
+int log_level = LOG_LEVEL_MAX;
+
+int log_set_level(int level) {
+   int prev = log_level;
+   if (level < LOG_EMERG)
+      level = LOG_EMERG;
+   else if (level > LOG_DEBUG)
+      level = LOG_DEBUG;
+   log_level = level;
+   return prev;
+}
+
+// MARFS_LOG_LEVEL may be a syslog priority number (0-7), or one of the
+// names: emerg, alert, crit, err, warning, notice, info, debug
+void log_init_level() {
+   static const char* names[] = { "emerg", "alert", "crit", "err",
+                                  "warning", "notice", "info", "debug" };
+   const char* env = getenv("MARFS_LOG_LEVEL");
+   int         i;
+
+   if (! env || ! *env)
+      return;
+
+   if ((*env >= '0') && (*env <= '9')) {
+      log_set_level(atoi(env));
+      return;
+   }
+   for (i=LOG_EMERG; i<=LOG_DEBUG; ++i) {
+      if (! strcasecmp(env, names[i])) {
+         log_set_level(i);
+         return;
+      }
+   }
+}
+
 
 // only defined/used when not USE_SYSLOG
 //
@@ -42,3 +90,355 @@ ssize_t printf_log(size_t prio, const char* format, ...) {
    fflush(stderr);
    return written;
 }
+
+
+
+#if (defined USE_ASYNC_LOG) && ((defined USE_SYSLOG) || (defined USE_STDOUT))
+// ---------------------------------------------------------------------------
+// Asynchronous logging
+//
+// Each thread that logs claims a LogRing from a fixed table.  The ring is
+// single-producer (the owning thread) and single-consumer (the drainer
+// thread), so the only synchronization is a memory-barrier around updates
+// to <head> and <tail>.  When the owning thread exits, its ring goes back
+// into the table, for the next new thread.  (The drainer still finishes
+// whatever is left in it.)
+//
+// When the rings are empty, the drainer sleeps on <drain_cond>.  Producers
+// only take <drain_lock> to wake it, when it has marked itself idle.  An
+// error-level message that finds its ring full waits on <room_cond>, for a
+// bounded time, before it is dropped.
+//
+// NOTE: We use the __sync builtins, rather than C11 atomics, so this still
+//     builds with gcc 4.4.
+//
+// NOTE: fuse daemonizes with fork(), which leaves the child without a
+//     drainer thread.  The atfork handler marks the drainer as stopped,
+//     and the next LOG() in the child starts a new one.
+// ---------------------------------------------------------------------------
+
+#ifndef LOG_ASYNC_MSG_MAX
+#  define LOG_ASYNC_MSG_MAX     512    /* longer messages are truncated */
+#endif
+#ifndef LOG_ASYNC_RING_SLOTS
+#  define LOG_ASYNC_RING_SLOTS  1024   /* messages per thread */
+#endif
+#ifndef LOG_ASYNC_MAX_RINGS
+#  define LOG_ASYNC_MAX_RINGS   512    /* concurrent logging threads */
+#endif
+#define LOG_ASYNC_IDLE_SEC      1         /* idle drainer re-checks, anyhow */
+#define LOG_ASYNC_ERR_WAIT_MSEC 100       /* max wait for room, for LOG_ERR */
+#define LOG_CACHE_LINE          64
+
+typedef struct {
+   int     prio;
+   int     len;
+   char    msg[LOG_ASYNC_MSG_MAX];
+} LogRecord;
+
+typedef struct {
+   volatile size_t  head;       // next record to fill (owner only)
+   char             pad1[LOG_CACHE_LINE - sizeof(size_t)];
+   volatile size_t  tail;       // next record to drain (drainer only)
+   char             pad2[LOG_CACHE_LINE - sizeof(size_t)];
+   volatile int     in_use;     // claimed by a live thread
+   volatile size_t  dropped;    // messages lost to a full ring (owner only)
+   size_t           dropped_reported; // (drainer only)
+   LogRecord        rec[LOG_ASYNC_RING_SLOTS];
+} LogRing;
+
+
+static LogRing* volatile  log_rings[LOG_ASYNC_MAX_RINGS];
+static volatile size_t    log_lost;    // threads that couldn't get a ring
+
+static __thread LogRing*  my_ring = NULL;
+static pthread_key_t      ring_key;
+static pthread_once_t     ring_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_t          drainer;
+static volatile int       drainer_running = 0;
+static volatile int       drainer_stop    = 0;
+static volatile int       drainer_idle    = 0;  // waiting on drain_cond
+static volatile int       room_waiters    = 0;  // waiting on room_cond
+
+static pthread_mutex_t    drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     drain_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t     room_cond  = PTHREAD_COND_INITIALIZER;
+
+
+
+static void release_ring(void* arg) {
+   LogRing* ring = (LogRing*)arg;
+   __sync_synchronize();
+   ring->in_use = 0;
+}
+
+static void drainer_forked() {
+   drainer_running = 0;
+   drainer_stop    = 0;
+   drainer_idle    = 0;
+   room_waiters    = 0;
+
+   // another parent thread may have held the lock across the fork
+   pthread_mutex_init(&drain_lock, NULL);
+   pthread_cond_init(&drain_cond, NULL);
+   pthread_cond_init(&room_cond, NULL);
+
+   // Rings belonging to threads in the parent are now ownerless
+   int i;
+   for (i=0; i<LOG_ASYNC_MAX_RINGS; ++i) {
+      LogRing* ring = log_rings[i];
+      if (ring && (ring != my_ring))
+         ring->in_use = 0;
+   }
+}
+
+static void init_ring_key() {
+   pthread_key_create(&ring_key, release_ring);
+   pthread_atfork(NULL, NULL, drainer_forked);
+}
+
+
+// Find a free ring, or allocate one into an empty slot.  NULL if the table
+// is full.
+static LogRing* claim_ring() {
+   int i;
+
+   pthread_once(&ring_key_once, init_ring_key);
+
+   for (i=0; i<LOG_ASYNC_MAX_RINGS; ++i) {
+      LogRing* ring = log_rings[i];
+
+      if (ring) {
+         if (__sync_bool_compare_and_swap(&ring->in_use, 0, 1))
+            break;
+         continue;
+      }
+
+      ring = (LogRing*)calloc(1, sizeof(LogRing));
+      if (! ring)
+         return NULL;
+      ring->in_use = 1;
+      if (__sync_bool_compare_and_swap(&log_rings[i], NULL, ring))
+         break;
+      free(ring);               // lost the race for this slot
+   }
+   if (i == LOG_ASYNC_MAX_RINGS)
+      return NULL;
+
+   my_ring = log_rings[i];
+   pthread_setspecific(ring_key, my_ring);
+   return my_ring;
+}
+
+
+static void write_record(int prio, const char* msg, int len) {
+#ifdef USE_SYSLOG
+   syslog(prio, "%s", msg);
+#else
+   fwrite(msg, 1, len, stderr);
+#endif
+}
+
+// Drain everything currently in the rings.  Returns the number of
+// messages written.  Only called by the drainer (or at exit, after the
+// drainer has stopped).
+static size_t drain_rings() {
+   size_t count = 0;
+   int    i;
+
+   for (i=0; i<LOG_ASYNC_MAX_RINGS; ++i) {
+      LogRing* ring = log_rings[i];
+      if (! ring)
+         break;                 // rings are allocated in slot-order
+
+      size_t tail = ring->tail;
+      size_t head = ring->head;
+      __sync_synchronize();     // read records after reading <head>
+
+      for ( ; tail != head; ++tail) {
+         LogRecord* rec = &ring->rec[tail % LOG_ASYNC_RING_SLOTS];
+         write_record(rec->prio, rec->msg, rec->len);
+         ++count;
+      }
+
+      __sync_synchronize();     // finish reading, before freeing slots
+      ring->tail = tail;
+
+      size_t dropped = ring->dropped;
+      if (dropped != ring->dropped_reported) {
+         char msg[128];
+         int  len = snprintf(msg, sizeof(msg),
+                             LOG_ASYNC_PREFIX " [logging] dropped %lu messages (ring full)\n",
+                             (unsigned long)(dropped - ring->dropped_reported));
+         write_record(LOG_WARNING, msg, len);
+         ring->dropped_reported = dropped;
+      }
+   }
+
+#ifndef USE_SYSLOG
+   if (count)
+      fflush(stderr);
+#endif
+
+   // wake producers waiting for room (see wait_for_room())
+   __sync_synchronize();
+   if (count && room_waiters) {
+      pthread_mutex_lock(&drain_lock);
+      pthread_cond_broadcast(&room_cond);
+      pthread_mutex_unlock(&drain_lock);
+   }
+   return count;
+}
+
+// non-zero if any ring has undrained records
+static int rings_pending() {
+   int i;
+   for (i=0; i<LOG_ASYNC_MAX_RINGS; ++i) {
+      LogRing* ring = log_rings[i];
+      if (! ring)
+         break;
+      if (ring->head != ring->tail)
+         return 1;
+   }
+   return 0;
+}
+
+static void deadline_after(struct timespec* ts, long msec) {
+   clock_gettime(CLOCK_REALTIME, ts);
+   ts->tv_sec  += msec / 1000;
+   ts->tv_nsec += (msec % 1000) * 1000000L;
+   if (ts->tv_nsec >= 1000000000L) {
+      ts->tv_sec  += 1;
+      ts->tv_nsec -= 1000000000L;
+   }
+}
+
+static void wake_drainer() {
+   pthread_mutex_lock(&drain_lock);
+   pthread_cond_signal(&drain_cond);
+   pthread_mutex_unlock(&drain_lock);
+}
+
+// Producers read <drainer_idle> after publishing, and we re-check the
+// rings after setting it, so a wakeup can't be missed.  The timeout is
+// just a backstop.
+static void* drainer_main(void* arg) {
+   struct timespec deadline;
+
+   while (! drainer_stop) {
+      if (drain_rings())
+         continue;
+
+      pthread_mutex_lock(&drain_lock);
+      drainer_idle = 1;
+      __sync_synchronize();
+      if (! drainer_stop && ! rings_pending()) {
+         deadline_after(&deadline, LOG_ASYNC_IDLE_SEC * 1000L);
+         pthread_cond_timedwait(&drain_cond, &drain_lock, &deadline);
+      }
+      drainer_idle = 0;
+      pthread_mutex_unlock(&drain_lock);
+   }
+   return NULL;
+}
+
+// Stop the drainer, and write out anything that's left
+void log_async_flush() {
+   if (drainer_running
+       && __sync_bool_compare_and_swap(&drainer_running, 1, 0)) {
+      drainer_stop = 1;
+      wake_drainer();
+      pthread_join(drainer, NULL);
+      drainer_stop = 0;
+   }
+   drain_rings();
+}
+
+static void start_drainer() {
+   static volatile int atexit_done = 0;
+
+   if (! __sync_bool_compare_and_swap(&drainer_running, 0, 1))
+      return;
+   if (pthread_create(&drainer, NULL, drainer_main, NULL)) {
+      drainer_running = 0;
+      return;
+   }
+   if (__sync_bool_compare_and_swap(&atexit_done, 0, 1))
+      atexit(log_async_flush);
+}
+
+
+void log_async_init() {
+   log_init_level();
+   start_drainer();
+}
+
+
+// An error-level message found its ring full.  Wake the drainer, and wait
+// up to LOG_ASYNC_ERR_WAIT_MSEC for room.  Non-zero if there is room.
+static int wait_for_room(LogRing* ring, size_t head) {
+   struct timespec deadline;
+   int             room;
+
+   deadline_after(&deadline, LOG_ASYNC_ERR_WAIT_MSEC);
+
+   pthread_mutex_lock(&drain_lock);
+   room_waiters += 1;
+   __sync_synchronize();
+   while (! (room = (head - ring->tail < LOG_ASYNC_RING_SLOTS))) {
+      pthread_cond_signal(&drain_cond);
+      if (pthread_cond_timedwait(&room_cond, &drain_lock, &deadline) == ETIMEDOUT) {
+         room = (head - ring->tail < LOG_ASYNC_RING_SLOTS);
+         break;
+      }
+   }
+   room_waiters -= 1;
+   pthread_mutex_unlock(&drain_lock);
+
+   return room;
+}
+
+ssize_t log_async(int prio, const char* format, ...) {
+   LogRing* ring = my_ring;
+   if (! ring && ! (ring = claim_ring())) {
+      __sync_add_and_fetch(&log_lost, 1);
+      return -1;
+   }
+   if (! drainer_running)
+      start_drainer();
+
+   // If the ring is full, drop the message, unless it's an error, in
+   // which case we wait (a little) for the drainer to make room.
+   size_t head = ring->head;
+   if ((head - ring->tail >= LOG_ASYNC_RING_SLOTS)
+       && ((prio > LOG_ERR) || ! wait_for_room(ring, head))) {
+      ring->dropped += 1;
+      return -1;
+   }
+
+   LogRecord* rec = &ring->rec[head % LOG_ASYNC_RING_SLOTS];
+   va_list    list;
+   va_start(list, format);
+   int len = vsnprintf(rec->msg, LOG_ASYNC_MSG_MAX, format, list);
+   va_end(list);
+
+   if (len < 0)
+      return -1;
+   if (len >= LOG_ASYNC_MSG_MAX) {
+      len = LOG_ASYNC_MSG_MAX -1;
+      rec->msg[len -1] = '\n';  // truncated
+   }
+   rec->prio = prio;
+   rec->len  = len;
+
+   __sync_synchronize();        // record is complete, before publishing
+   ring->head = head +1;
+
+   __sync_synchronize();        // publish <head>, before reading <drainer_idle>
+   if (drainer_idle)
+      wake_drainer();
+   return len;
+}
+
+#endif // USE_ASYNC_LOG
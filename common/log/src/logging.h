@@ -31,25 +31,99 @@ extern "C" {
 #define xFMT  " [%s:%4d]%*s %-21s | %s"
 
 
-#ifdef USE_SYSLOG
+// ---------------------------------------------------------------------------
+// level filtering
+//
+// LOG_LEVEL_MAX is the compile-time limit (e.g. -DLOG_LEVEL_MAX=LOG_ERR).
+// Calls above it compile away.  <log_level> is the run-time limit, which
+// can be lowered without rebuilding (see log_set_level(), or the
+// MARFS_LOG_LEVEL env-var, which INIT_LOG() reads).  A LOG() call that is
+// filtered out at run-time costs one compare-and-branch, and doesn't
+// evaluate its arguments.
+// ---------------------------------------------------------------------------
+
+#ifndef LOG_LEVEL_MAX
+#  define LOG_LEVEL_MAX  LOG_DEBUG
+#endif
+
+extern int log_level;
+
+#define LOG_ENABLED(PRIO)                                               \
+   (((PRIO) <= LOG_LEVEL_MAX) && ((PRIO) <= log_level))
+
+int  log_set_level(int level);  // returns previous level
+void log_init_level();          // from MARFS_LOG_LEVEL, if set
+
+
+#if (defined USE_ASYNC_LOG) && ((defined USE_SYSLOG) || (defined USE_STDOUT))
+// ---------------------------------------------------------------------------
+// Asynchronous logging
+//
+// Each thread formats its messages into its own ring-buffer.  A background
+// thread drains the rings, and writes to syslog (USE_SYSLOG), or stderr
+// (USE_STDOUT).  Callers never take a lock, allocate, or make a syscall.
+// If a ring is full, the message is dropped (and counted, and the
+// drainer reports how many were dropped), except for LOG_ERR and worse,
+// which wait for room.  Messages are flushed at exit.
+// See logging.c
+// ---------------------------------------------------------------------------
+
+#  ifdef USE_SYSLOG
+#    define INIT_LOG()                                                  \
+   do {                                                                 \
+      openlog(LOG_PREFIX, LOG_CONS|LOG_PID, LOG_USER);                  \
+      log_async_init();                                                 \
+   } while (0)
+
+#    define LOG_ASYNC_PREFIX  ""      /* syslog adds the ident */
+#  else
+#    define INIT_LOG()        log_async_init()
+#    define LOG_ASYNC_PREFIX  LOG_PREFIX
+#  endif
+
+#  define LOG(PRIO, FMT, ...)                                           \
+   do {                                                                 \
+      if (LOG_ENABLED(PRIO))                                            \
+         log_async((PRIO), LOG_ASYNC_PREFIX xFMT FMT, __FILE__, __LINE__, \
+                   17-(int)strlen(__FILE__), "", __FUNCTION__,          \
+                   (((PRIO)<=LOG_ERR) ? "#ERR " : ""), ## __VA_ARGS__); \
+   } while (0)
+
+   void    log_async_init();
+   ssize_t log_async(int prio, const char* format, ...)
+      __attribute__ ((format (printf, 2, 3)));
+   void    log_async_flush();
+
+
+#elif (defined USE_SYSLOG)
 // calling syslog() as a regular user on rrz seems to be an expensive no-op
 // #  define INIT_LOG()  openlog(LOG_PREFIX, LOG_CONS|LOG_PERROR, LOG_USER)
-#  define INIT_LOG()  openlog(LOG_PREFIX, LOG_CONS|LOG_PID, LOG_USER)
+#  define INIT_LOG()                                                    \
+   do {                                                                 \
+      openlog(LOG_PREFIX, LOG_CONS|LOG_PID, LOG_USER);                  \
+      log_init_level();                                                 \
+   } while (0)
 
 #  define LOG(PRIO, FMT, ...)                                           \
-   syslog((PRIO), xFMT FMT, __FILE__, __LINE__,                         \
-          17-(int)strlen(__FILE__), "", __FUNCTION__,                   \
-          (((PRIO)<=LOG_ERR) ? "#ERR " : ""), ## __VA_ARGS__)
+   do {                                                                 \
+      if (LOG_ENABLED(PRIO))                                            \
+         syslog((PRIO), xFMT FMT, __FILE__, __LINE__,                   \
+                17-(int)strlen(__FILE__), "", __FUNCTION__,             \
+                (((PRIO)<=LOG_ERR) ? "#ERR " : ""), ## __VA_ARGS__);    \
+   } while (0)
 
 #elif (defined USE_STDOUT)
 // must start fuse with '-f' in order to allow stdout/stderr to work
 // NOTE: print_log call merges LOG_PREFIX w/ user format at compile-time
-#  define INIT_LOG()
+#  define INIT_LOG()  log_init_level()
 
 #  define LOG(PRIO, FMT, ...)                                           \
-   printf_log((PRIO), LOG_PREFIX xFMT FMT, __FILE__, __LINE__,          \
-              17-(int)strlen(__FILE__), "", __FUNCTION__,               \
-              (((PRIO)<=LOG_ERR) ? "#ERR " : ""), ## __VA_ARGS__)
+   do {                                                                 \
+      if (LOG_ENABLED(PRIO))                                            \
+         printf_log((PRIO), LOG_PREFIX xFMT FMT, __FILE__, __LINE__,    \
+                    17-(int)strlen(__FILE__), "", __FUNCTION__,         \
+                    (((PRIO)<=LOG_ERR) ? "#ERR " : ""), ## __VA_ARGS__); \
+   } while (0)
 
    ssize_t printf_log(size_t prio, const char* format, ...);
 
@@ -69,16 +69,24 @@ IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
 OF SUCH DAMAGE.
 */
 
+// _GNU_SOURCE defines syscall().  [See push_user()]
+#define _GNU_SOURCE
+
 #include "common.h"
+#include "latency.h"
+#include "ledger.h"
 
 #include <sys/types.h>          /* uid_t */
 #include <unistd.h>
+#include <sys/syscall.h>         /* SYS_setresuid */
 #include <attr/xattr.h>
 #include <errno.h>
 #include <stdlib.h>             /* calloc() */
 #include <string.h>
 #include <stdio.h>              /* rename() */
 #include <stdarg.h>
+#include <stddef.h>             /* offsetof() */
+#include <pthread.h>
 
 
 // ---------------------------------------------------------------------------
@@ -117,11 +125,155 @@ const char* marfs_sub_path(const char* path) {
 
 
 
+// push_user()
+//
+//   Save current user info from syscall into saved_user
+//   Set userid to requesting user (<new_uid>, <new_gid>, which fuse
+//   callers take from the fuse request context)
+//   return 0/negative for success/error
+//
+// NOTE: setuid() doesn't allow returning to priviledged user, from
+//       unpriviledged-user.  For that, we apparently need the (BSD)
+//       seteuid().
+//
+// NOTE: If seteuid() fails, and the problem is that we lack privs to call
+//       seteuid(), this means *we* are running unpriviledged.  This could
+//       happen if we're testing the FUSE mount as a non-root user.  In
+//       this case, the <uid> argument should be the same as the <uid> of
+//       the FUSE process.
+//       [We try the seteuid() first, for speed]
+//
+// NOTE: seteuid()/setegid() are process-wide.  (glibc signals every
+//       thread to make them all change credentials together.)  That means
+//       concurrent fuse threads would be stepping on each other's
+//       identity.  On Linux, credentials are actually per-thread in the
+//       kernel, so we make the raw setresuid/setresgid syscalls, which
+//       only affect the calling thread.  That lets the multi-threaded
+//       fuse loop run ops for different users at the same time.  Other
+//       platforms fall back to seteuid()/setegid(), and should be run
+//       single-threaded (fuse "-s").
+//
+// NOTE: Supplementary groups are not changed, same as before.
+//
+#if defined(__linux__) && defined(SYS_setresuid32)
+// 32-bit x86/ARM: the plain SYS_setresuid takes 16-bit ids
+#  define SET_THREAD_EUID(UID)  syscall(SYS_setresuid32, -1, (UID), -1)
+#  define SET_THREAD_EGID(GID)  syscall(SYS_setresgid32, -1, (GID), -1)
+#elif defined(__linux__) && defined(SYS_setresuid)
+#  define SET_THREAD_EUID(UID)  syscall(SYS_setresuid, -1, (UID), -1)
+#  define SET_THREAD_EGID(GID)  syscall(SYS_setresgid, -1, (GID), -1)
+#elif (_BSD_SOURCE || _POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600)
+#  define SET_THREAD_EUID(UID)  seteuid(UID)
+#  define SET_THREAD_EGID(GID)  setegid(GID)
+#else
+#  error "No support for per-thread setresuid(), or for seteuid()/setegid()"
+#endif
+
+int push_user(uid_t* saved_euid,
+              gid_t* saved_egid,
+              uid_t  new_uid,
+              gid_t  new_gid) {
+   //   fuse_context* ctx = fuse_get_context();
+   //   if (ctx->flags & PUSHED_USER) {
+   //      LOG(LOG_ERR, "push_user -- already pushed!\n");
+   //      return;
+   //   }
+   int rc;
+
+   // getegid()/geteuid() report the credentials of the calling thread
+   *saved_egid = getegid();
+   LOG(LOG_INFO, "user %ld (egid %ld) -> (egid %ld) ...\n",
+       (size_t)getgid(), (size_t)*saved_egid, (size_t)new_gid);
+   rc = SET_THREAD_EGID(new_gid);
+   if (rc == -1) {
+      if (((errno == EACCES) || (errno == EPERM)) && (new_gid == getgid())) {
+         LOG(LOG_INFO, "failed (but okay)\n");
+         return 0;              /* okay [see NOTE] */
+      }
+      else {
+         LOG(LOG_ERR, "failed!\n");
+         return -1;
+      }
+   }
+
+   *saved_euid = geteuid();
+   LOG(LOG_INFO, "user %ld (euid %ld) -> (euid %ld) ...\n",
+       (size_t)getuid(), (size_t)*saved_euid, (size_t)new_uid);
+   rc = SET_THREAD_EUID(new_uid);
+   if (rc == -1) {
+      if (((errno == EACCES) || (errno == EPERM)) && (new_uid == getuid())) {
+         LOG(LOG_INFO, "failed (but okay)\n");
+         return 0;              /* okay [see NOTE] */
+      }
+      else {
+         LOG(LOG_ERR, "failed!\n");
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+
+//  pop_user() changes the effective UID.  Here, we revert to the
+//  "real" UID.
+int pop_user(uid_t* saved_euid, gid_t* saved_egid) {
+   int rc;
+
+   uid_t  new_uid = *saved_euid;
+   rc = SET_THREAD_EUID(new_uid);
+   if (rc == -1) {
+      if (((errno == EACCES) || (errno == EPERM)) && (new_uid == getuid()))
+         return 0;              /* okay [see NOTE] */
+      else {
+         LOG(LOG_ERR,
+             "pop_user -- user %ld (euid %ld) failed seteuid(%ld)!\n",
+             (size_t)getuid(), (size_t)geteuid(), (size_t)new_uid);
+         return -1;
+      }
+   }
+
+   gid_t  new_gid = *saved_egid;
+   rc = SET_THREAD_EGID(new_gid);
+   if (rc == -1) {
+      if (((errno == EACCES) || (errno == EPERM)) && (new_gid == getgid()))
+         return 0;              /* okay [see NOTE] */
+      else {
+         LOG(LOG_ERR,
+             "pop_user -- user %ld (egid %ld) failed setegid(%ld)!\n",
+             (size_t)getgid(), (size_t)getegid(), (size_t)new_gid);
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+
+
+// Every fuse op used to memset() an entire PathInfo, which is several KB,
+// mostly because of the three MARFS_MAX_MD_PATH-sized buffers.  Those are
+// always filled (with snprintf(), strcpy(), or the xattr parsers) before
+// they are read, so we only need to terminate them.  Everything else is
+// zeroed, as before.  This depends on the big buffers being the last
+// member of MarFS_XattrPre, MarFS_XattrPost, and PathInfo.
+void init_path_info(PathInfo* info) {
+   memset(info, 0, offsetof(PathInfo, pre) + offsetof(MarFS_XattrPre, objid));
+   info->pre.objid[0] = 0;
+
+   memset(&info->post, 0, offsetof(MarFS_XattrPost, md_path));
+   info->post.md_path[0] = 0;
+
+   info->trash_md_path[0] = 0;
+}
+
+
 // NOTE: The Attractive Chaos tools actually include a suffix-tree data-structure.
 //       (Actually a suffix array.)
 //
 int expand_path_info(PathInfo*   info, /* side-effect */
                      const char* path) {
+   LATENCY_SCOPE(LAT_EXPAND_PATH_INFO);
    LOG(LOG_INFO, "path        %s\n", path);
 
    // (pass path, address to stuff, batch/interactive, working with existing file)
@@ -420,6 +572,8 @@ int stat_xattrs(PathInfo* info) {
    if (info->flags & PI_XATTR_QUERY)
       return 0;                 // already did this
 
+   LATENCY_SCOPE(LAT_STAT_XATTRS);
+
    // call stat_regular().
    __TRY0(stat_regular, info);
 
@@ -554,7 +708,7 @@ int batch_pre_process(const char* path, size_t file_size) {
    LOG(LOG_INFO, "%s, %ld\n", path, file_size);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
 
    EXPAND_PATH_INFO(&info, path);
    STAT_XATTRS(&info);
@@ -604,7 +758,7 @@ int batch_post_process(const char* path, size_t file_size) {
    LOG(LOG_INFO, "%s, %ld\n", path, file_size);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    STAT_XATTRS(&info);
@@ -651,6 +805,7 @@ int has_any_xattrs(PathInfo* info, XattrMaskType mask) {
 // on info->post.md_path.
 int save_xattrs(PathInfo* info, XattrMaskType mask) {
    TRY_DECLS();
+   LATENCY_SCOPE(LAT_SAVE_XATTRS);
 
    // call stat_regular().
    __TRY0(stat_regular, info);
@@ -807,6 +962,192 @@ int write_trash_companion_file(PathInfo*             info,
 }
 
 
+// Copy <size> bytes from the current offset of <in>, to the current
+// offset of <out>.  Where the kernel has copy_file_range(), the data
+// doesn't have to come up through user-space (and some file-systems can
+// do the copy on the server, or just share the blocks).  If that isn't
+// supported for these files (e.g. they're on different file-systems, in
+// older kernels), we carry on with read()/write().
+//
+// <out_path> is just for log messages.
+static int copy_file_data(int in, int out, size_t size, const char* out_path) {
+   size_t wr_total = 0;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+   while (wr_total < size) {
+      ssize_t n = syscall(SYS_copy_file_range, in, NULL, out, NULL,
+                          (size - wr_total), 0);
+      if (n > 0)
+         wr_total += n;
+      else if (n == 0)
+         return 0;              // EOF on <in>
+      else if ((errno == ENOSYS)
+               || (errno == EXDEV)
+               || (errno == EINVAL)
+               || (errno == EOPNOTSUPP)) {
+         LOG(LOG_INFO, "copy_file_range unsupported (%s), falling back\n",
+             strerror(errno));
+         break;
+      }
+      else if (errno != EINTR) {
+         LOG(LOG_ERR, "err copying to %s (byte %ld): %s\n",
+             out_path, wr_total, strerror(errno));
+         return -1;
+      }
+   }
+   if (wr_total == size)
+      return 0;
+#endif
+
+   // buf used for data-transfer
+   const size_t BUF_SIZE = 32 * 1024 * 1024; /* 32 MB */
+   char* buf = malloc(BUF_SIZE);
+   if (!buf) {
+      LOG(LOG_ERR, "malloc %ld bytes failed\n", BUF_SIZE);
+      return -1;
+   }
+
+   size_t phy_remain = size - wr_total;
+   size_t read_size = ((phy_remain < BUF_SIZE) ? phy_remain : BUF_SIZE);
+
+   // copy phy-data from md_file to trash_file, one buf at a time
+   ssize_t rd_count;
+   for (rd_count = read(in, (void*)buf, read_size);
+        (read_size && (rd_count > 0));
+        rd_count = read(in, (void*)buf, read_size)) {
+
+      char*  buf_ptr = buf;
+      size_t remain  = rd_count;
+      while (remain) {
+         ssize_t wr_count = write(out, buf_ptr, remain);
+         if (wr_count < 0) {
+            LOG(LOG_ERR, "err writing %s (byte %ld)\n",
+                out_path, wr_total);
+            free(buf);
+            return -1;
+         }
+         remain   -= wr_count;
+         wr_total += wr_count;
+         buf_ptr  += wr_count;
+      }
+
+      phy_remain = size - wr_total;
+      read_size = ((phy_remain < BUF_SIZE) ? phy_remain : BUF_SIZE);
+   }
+   free(buf);
+   if (rd_count < 0) {
+      LOG(LOG_ERR, "err reading (copying to %s, byte %ld)\n",
+          out_path, wr_total);
+      return -1;
+   }
+
+   return 0;
+}
+
+
+// Namespaces where rename(2) into the trash has failed with EXDEV (i.e.
+// the trash is in a different fileset or file-system), so trash_unlink()
+// doesn't keep trying.  Entries are only ever added.  Duplicates are
+// harmless.
+#define TRASH_XDEV_MAX  64
+
+static const MarFS_Namespace* trash_xdev[TRASH_XDEV_MAX];
+static volatile int           trash_xdev_count = 0;
+
+static int trash_is_xdev(const MarFS_Namespace* ns) {
+   int count = trash_xdev_count;
+   if (count > TRASH_XDEV_MAX)
+      count = TRASH_XDEV_MAX;
+
+   int i;
+   for (i=0; i<count; ++i) {
+      if (trash_xdev[i] == ns)
+         return 1;
+   }
+   return 0;
+}
+
+static void trash_set_xdev(const MarFS_Namespace* ns) {
+   int i = __sync_fetch_and_add(&trash_xdev_count, 1);
+   if (i < TRASH_XDEV_MAX)
+      trash_xdev[i] = ns;
+}
+
+
+// Put back a file that trash_rename() moved into the trash, after a later
+// step failed.  Removes any companion file, and restores the original
+// POST.  Preserves errno.
+static void trash_rename_undo(PathInfo* info) {
+   int  saved_errno = errno;
+   char companion_fname[MARFS_MAX_MD_PATH];
+
+   // don't unlink the wrong thing, if the name doesn't fit
+   int prt_count = snprintf(companion_fname, MARFS_MAX_MD_PATH, "%s%s",
+                            info->trash_md_path, MARFS_TRASH_COMPANION_SUFFIX);
+   if ((prt_count < 0) || (prt_count >= MARFS_MAX_MD_PATH))
+      LOG(LOG_ERR, "companion name for %s is too long\n", info->trash_md_path);
+   else if (unlink(companion_fname) && (errno != ENOENT))
+      LOG(LOG_ERR, "couldn't remove companion %s (%s)\n",
+          companion_fname, strerror(errno));
+
+   if (rename(info->trash_md_path, info->post.md_path))
+      LOG(LOG_ERR, "couldn't move %s back to %s (%s)\n",
+          info->trash_md_path, info->post.md_path, strerror(errno));
+   else if (save_xattrs(info, XVT_POST))
+      LOG(LOG_ERR, "couldn't restore POST on %s (%s)\n",
+          info->post.md_path, strerror(errno));
+
+   errno = saved_errno;
+}
+
+// Move the MD file into the trash with rename(2).  The data and xattrs go
+// with it, so we only have to mark the POST, and write the companion
+// file.  This only works if the trash is in the same fileset as the MD
+// file.  If not, we return -1 with errno = EXDEV, and the caller can copy,
+// instead.
+static int trash_rename(PathInfo*   info,
+                        const char* path) {
+   TRY_DECLS();
+
+   // same times that trash_truncate() installs
+   struct utimbuf trash_time;
+   trash_time.modtime = info->st.st_atime; // trash mtime = orig atime
+   trash_time.actime  = time(NULL);        // trash atime = now
+   if (trash_time.actime == (time_t)-1) {
+      LOG(LOG_ERR, "time() failed\n");
+      return -1;
+   }
+
+   __TRY0(expand_trash_info, info, path);
+   if (rename(info->post.md_path, info->trash_md_path)) {
+      if (errno == EXDEV)
+         LOG(LOG_INFO, "can't rename into trash for ns '%s'\n", info->ns->name);
+      else
+         LOG(LOG_ERR, "rename(%s, %s) failed (%s)\n",
+             info->post.md_path, info->trash_md_path, strerror(errno));
+      return -1;
+   }
+
+   // The POST in the trash records where the file now lives (see
+   // trash_truncate()).  The other xattrs came along with the rename.
+   // If any of this fails, move the file back, so the unlink fails
+   // cleanly, rather than leaving a trash file that can't be cleaned up.
+   PathInfo trash_info = *info;
+   memcpy(trash_info.post.md_path, trash_info.trash_md_path, MARFS_MAX_MD_PATH);
+   trash_info.post.flags |= POST_TRASH;
+   if (save_xattrs(&trash_info, XVT_POST)
+       || write_trash_companion_file(info, path, &trash_time)
+       || utime(info->trash_md_path, &trash_time)) {
+      LOG(LOG_ERR, "finishing trash %s failed (%s), moving it back\n",
+          info->trash_md_path, strerror(errno));
+      trash_rename_undo(info);
+      return -1;
+   }
+
+   return 0;
+}
+
+
 // [trash_file]
 // This is used to implement unlink().
 //
@@ -821,16 +1162,19 @@ int write_trash_companion_file(PathInfo*             info,
 //     then fail-over to moving the data, but we're not sure whether that
 //     could add considerable overhead in the case where the rename is
 //     going to fail.  [NOTE: could we just compute this once, up front,
-//     and store it as a flag in the Repo or Namespace structs?]  For now,
-//     we just always do a copy + unlink.
+//     and store it as a flag in the Repo or Namespace structs?]  We now
+//     try rename first, and remember the namespaces where that fails (see
+//     trash_rename()).  Those get copy + unlink.
 //
 //     On second thought, we want the inode of the truncated file to remain
-//     the same (?) Therefore, rename(2) would always be wrong.
+//     the same (?) Therefore, rename(2) would always be wrong for
+//     trash_truncate().
 
 // NOTE: Should we do something to make this thread-safe (like unlink()) ?
 //
 int  trash_unlink(PathInfo*   info,
                   const char* path) {
+   LATENCY_SCOPE(LAT_TRASH_UNLINK);
 
    //    pass in expanded_path_info_structure and file name to be trashed
    //    rename mdfile (with all xattrs) into trashmdnamepath,
@@ -889,8 +1233,19 @@ int  trash_unlink(PathInfo*   info,
 
    // we no longer assume that a simple rename into the trash will always
    // be possible (e.g. because trash will be in a different fileset, or
-   // filesystem).  It was thought we shouldn't even *try* the rename
-   // first.  Instead, we'll copy to the trash, then unlink the original.
+   // filesystem).  But, where it works, it is much cheaper than copying
+   // (e.g. for a Multi with many chunks), and a failed rename is just one
+   // system-call.  So, we try the rename, and remember namespaces where it
+   // gets EXDEV.  Otherwise, we copy to the trash, then unlink the
+   // original.
+   if (! trash_is_xdev(info->ns)) {
+      if (! trash_rename(info, path))
+         return 0;
+      if (errno != EXDEV)
+         return -1;
+      trash_set_xdev(info->ns);
+   }
+
    __TRY0(trash_truncate, info, path);
    __TRY0(unlink, info->post.md_path);
 
@@ -910,6 +1265,7 @@ int  trash_unlink(PathInfo*   info,
 //
 int  trash_truncate(PathInfo*   info,
                     const char* path) {
+   LATENCY_SCOPE(LAT_TRASH_TRUNCATE);
 
    //    pass in expanded_path_info_structure and file name to be trashed
    //    rename mdfile (with all xattrs) into trashmdnamepath,
@@ -970,12 +1326,29 @@ int  trash_truncate(PathInfo*   info,
    mode_t new_mode = info->st.st_mode & (S_IRWXU|S_IRWXG|S_IRWXO); // more-portable
 
 
-   // we'll read from md_file
-   int in = open(info->post.md_path, O_RDONLY);
-   if (in == -1) {
-      LOG(LOG_ERR, "open(%s, O_RDONLY) [oct]%o failed\n",
-          info->post.md_path, new_mode);
-      return -1;
+   // MD files are trunc'ed to their "logical" size (the size of the data
+   // they represent.  They may also contain some "system" data (blobs we
+   // have tucked inside, to track object-storage.  Move the physical data,
+   // then trunc to logical size.  Inline files hold all their data in the
+   // MD file.
+   //
+   // Uni and Packed files usually have no physical data, so there's
+   // nothing to read, and the trash-file only needs to be created with the
+   // right size.  This makes O_TRUNC opens of existing files cheap.
+   off_t log_size = info->st.st_size;
+   off_t phy_size = ((info->post.flags & POST_INLINE)
+                     ? log_size
+                     : info->post.chunk_info_bytes);
+
+   // we'll read from md_file (if there's anything to copy)
+   int in = -1;
+   if (phy_size) {
+      in = open(info->post.md_path, O_RDONLY);
+      if (in == -1) {
+         LOG(LOG_ERR, "open(%s, O_RDONLY) [oct]%o failed\n",
+             info->post.md_path, new_mode);
+         return -1;
+      }
    }
 
    // we'll write to trash_file
@@ -984,81 +1357,34 @@ int  trash_truncate(PathInfo*   info,
    if (out == -1) {
       LOG(LOG_ERR, "open(%s, (O_CREAT|O_WRONLY), [oct]%o) failed\n",
           info->trash_md_path, new_mode);
-      __TRY0(close, in);
+      if (in != -1)
+         __TRY0(close, in);
       return -1;
    }
 
-   // MD files are trunc'ed to their "logical" size (the size of the data
-   // they represent.  They may also contain some "system" data (blobs we
-   // have tucked inside, to track object-storage.  Move the physical data,
-   // then trunc to logical size.
-   off_t log_size = info->st.st_size;
-   off_t phy_size = info->post.chunk_info_bytes;
-
-   if (phy_size) {
-
-      // buf used for data-transfer
-      const size_t BUF_SIZE = 32 * 1024 * 1024; /* 32 MB */
-      char* buf = malloc(BUF_SIZE);
-      if (!buf) {
-         LOG(LOG_ERR, "malloc %ld bytes failed\n", BUF_SIZE);
+   if (phy_size
+       && copy_file_data(in, out, phy_size, info->trash_md_path)) {
 
-         // clean-up
-         __TRY0(close, in);
-         __TRY0(close, out);
-         return -1;
-      }
-
-      size_t read_size = ((phy_size < BUF_SIZE) ? phy_size : BUF_SIZE);
-      size_t wr_total = 0;
-
-      // copy phy-data from md_file to trash_file, one buf at a time
-      ssize_t rd_count;
-      for (rd_count = read(in, (void*)buf, read_size);
-           (read_size && (rd_count > 0));
-           rd_count = read(in, (void*)buf, read_size)) {
-
-         char*  buf_ptr = buf;
-         size_t remain  = rd_count;
-         while (remain) {
-            size_t wr_count = write(out, buf_ptr, remain);
-            if (wr_count < 0) {
-               LOG(LOG_ERR, "err writing %s (byte %ld)\n",
-                   info->trash_md_path, wr_total);
-
-               // clean-up
-               __TRY0(close, in);
-               __TRY0(close, out);
-               free(buf);
-               return -1;
-            }
-            remain   -= wr_count;
-            wr_total += wr_count;
-            buf_ptr  += wr_count;
-         }
-
-         size_t phy_remain = phy_size - wr_total;
-         read_size = ((phy_remain < BUF_SIZE) ? phy_remain : BUF_SIZE);
-      }
-      free(buf);
-      if (rd_count < 0) {
-         LOG(LOG_ERR, "err reading %s (byte %ld)\n",
-             info->trash_md_path, wr_total);
+      // clean-up
+      __TRY0(close, in);
+      __TRY0(close, out);
+      return -1;
+   }
 
-         // clean-up
-         __TRY0(close, in);
-         __TRY0(close, out);
-         return -1;
-      }
+   // trunc trash-file to size
+   if (ftruncate(out, log_size)) {
+      LOG(LOG_ERR, "ftruncate(%s, %ld) failed\n", info->trash_md_path, log_size);
+      if (in != -1)
+         close(in);
+      close(out);
+      return -1;
    }
 
    // clean-up
-   __TRY0(close, in);
+   if (in != -1)
+      __TRY0(close, in);
    __TRY0(close, out);
 
-   // trunc trash-file to size
-   __TRY0(truncate, info->trash_md_path, log_size);
-
    // copy xattrs to the trash-file.
    // ugly-but-simple: make a duplicate PathInfo, but with post.md_path
    // set to our trash_md_path.  Then save_xattrs() will just work on the
@@ -1079,8 +1405,17 @@ int  trash_truncate(PathInfo*   info,
    __TRY0(trunc_xattr, info);
 
    // old stat-info and xattr-info is obsolete.  Generate new obj-ID, etc.
-   info->flags &= ~(PI_STAT_QUERY | PI_XATTR_QUERY | PI_PRE_INIT | PI_POST_INIT);
-   __TRY0(stat_xattrs, info);   // has none, so initialize from scratch
+   // We just removed all the xattrs, so there's no need for
+   // stat_xattrs() to go looking for them.  Initialize from scratch, as
+   // it would.  (init_post() leaves the flags alone.  The new file isn't
+   // trash, or inline, yet.)
+   info->flags  &= ~(PI_STAT_QUERY | PI_PRE_INIT | PI_POST_INIT);
+   info->xattrs  = 0;
+   __TRY0(stat_regular, info);
+   __TRY0(init_pre, &info->pre, OBJ_FUSE, info->ns, info->ns->iwrite_repo, &info->st);
+   __TRY0(init_post, &info->post, info->ns, info->ns->iwrite_repo);
+   info->post.flags = 0;
+   info->flags |= (PI_XATTR_QUERY | PI_PRE_INIT | PI_POST_INIT);
 
    // NOTE: Unique-ness of Object-IDs currently comes from inode, plus
    //     obj-ctime, plus MD-file ctime.  It's possible the trashed file
@@ -1128,58 +1463,34 @@ int trunc_xattr(PathInfo* info) {
 // Then mknod()/create() can look there to see whether an attempt to create
 // a new object should be allowed to succeed.
 //
-// The first approach might be to store the contents of a fake statvfs
-// struct in the file, maybe in some human-readable form, for convenience.
-// However, the types of values in that struct may have some scaling
-// problems: Our equivalent of statvfs.f_frsize might want to be as large
-// as 10 GB, which couldn't fit into 32-bits, assuming an 'unsigned long'
-// could be 32 bits.
+// The quota-scan (and 'marfs_quota -l') also writes a ledger next to
+// fsinfo, with the total space and names.  The ledger module keeps these
+// cached, refreshing them in the background when the ledger changes, and
+// adds the changes this daemon has made since then (see ledger.h).  So
+// checking is just arithmetic, and both limits are enforced.  The name
+// limit is only enforced once there is a ledger.
 //
-// We could improve access time by making two fsinfo files, one having
-// size trunc'ed to be multiplier, and the other having size trunc'ed to be
-// a multiplicand.  Then we wouldn't have to do an open/read/write to check
-// quotes, for every call to mknod().
-//
-// For 0.1, I'll do something even cheaper (and quicker): assume fsinfo is
-// trunc'ed to the space-limit, and ignore name-limits.
-//
-// NOTE: We could possibly save ourselves some work by setting a flag
-//       (e.g. PI_STATVFS) in info->flags, to avoid redundantly updating
-//       info->stvfs, but probably we should be responsive to potential
-//       ongoing updates to fsinfo, and just always read it.
+// If the cache hasn't been loaded (e.g. couldn't read fsinfo at
+// start-up), we fall back to stat'ing fsinfo, which is trunc'ed to the
+// space used.
 //
 // NOTE: During testing, I sometimes forget to create a dummy version of
 //       this file.  That shouldn't happen in production, but if we're
 //       testing this, and you're seeing an error in the log because this
 //       file doesn't exist, just 'touch' it.
-//
-//
-// TBD: New approach.  We should periodically parse the results of Alfred's
-//     quota-scan, and maybe store the info into respective NS structs, and
-//     set ourselves a timestamp.  If we are called and the timestamp is
-//     older than gettimeofday(), then we reparse the quota-scan output.
-//     Otherwise, we use the cached results of the previous parse.  How do
-//     we cache the results?  Well, if all we care about is size, then we
-//     take the usage reported by the scan, minus the trash-usage reported
-//     by the scan, and say they have that much space.
-//
-//     Is it worth the trouble to truncate the fsinfo file to the new size,
-//     at marfs_release()?
 
 int check_quotas(PathInfo* info) {
 
-   //   TRY_DECLS();
-   //   if (! (info->flags & PI_STATVFS))
-   //      __TRY0(statvfs, info->ns->fsinfo, &info->stvfs);
+   // value of -1 for ns->quota_space (or quota_names) implies unlimited
+   int64_t space_limit = (int64_t)(long long)info->ns->quota_space;
+   int64_t names_limit = (int64_t)(long long)info->ns->quota_names;
+   int64_t space_used;
+   int64_t names_used;
 
-#if TBD
-   uint64_t  names_limit = (uint64_t)info->ns->quota_names;
-#endif
-
-   uint64_t space_limit = (uint64_t)info->ns->quota_space;
+   if ((space_limit < 0) && (names_limit < 0))
+      return 0;
 
-   // value of -1 for ns->quota_space implies unlimited
-   if (space_limit >= 0) {
+   if (ledger_usage(info->ns, &space_used, &names_used)) {
       struct stat st;
       if (stat(info->ns->fsinfo_path, &st)) {
          LOG(LOG_ERR, "couldn't stat fsinfo at '%s': %s\n",
@@ -1187,11 +1498,19 @@ int check_quotas(PathInfo* info) {
          errno = EINVAL;
          return -1;
       }
-      if (st.st_size > space_limit) { /* 0 = OK,  1 = no-more-space */
-         LOG(LOG_INFO, "quota (%lu) exceeded by %lu\n",
-             space_limit, (st.st_size - space_limit));
-         return 1;
-      }
+      space_used = st.st_size;
+      names_used = -1;
+   }
+
+   if ((space_limit >= 0) && (space_used > space_limit)) { /* 0 = OK,  1 = no-more-space */
+      LOG(LOG_INFO, "quota (%ld) exceeded by %ld\n",
+          space_limit, (space_used - space_limit));
+      return 1;
+   }
+   if ((names_limit >= 0) && (names_used >= names_limit)) {
+      LOG(LOG_INFO, "name quota (%ld) reached (%ld)\n",
+          names_limit, names_used);
+      return 1;
    }
 
    // not over quota
@@ -1199,10 +1518,64 @@ int check_quotas(PathInfo* info) {
 }
 
 
+// SEMI_DIRECT repos store each object as a file in a scatter-tree (see
+// init_scatter_tree()) under the directory given as the repo <host>.  The
+// leaf-dir comes from a hash of the object-ID, and the file-name is the
+// object-ID, with '/' changed to '#'.  For example:
+//
+//    <host>/<namespace>.0/3/5/1/<bucket>#ver.000_001#...#chnkno.0
+//
+// Because this can be computed from the object-ID, the POST xattr
+// doesn't need to record it.  (So semi-direct files can go to the trash.)
+int semi_direct_path(char*              path,
+                     size_t             max_size,
+                     const MarFS_Repo*  repo,
+                     const char*        ns_name,
+                     const char*        objid) {
+
+   // FNV-1a
+   uint32_t    hash = 2166136261u;
+   const char* ptr;
+   for (ptr=objid; *ptr; ++ptr)
+      hash = (hash ^ (uint8_t)*ptr) * 16777619u;
+   hash %= 1000;
+
+   const uint32_t shard = 0;   // (see init_mdfs())
+   int prt_count = snprintf(path, max_size, "%s/%s.%d/%d/%d/%d/",
+                            repo->host, ns_name, shard,
+                            (hash / 100), (hash / 10) % 10, hash % 10);
+   size_t objid_len = strlen(objid);
+   if ((prt_count < 0)
+       || ((prt_count + objid_len) >= max_size)) {
+      LOG(LOG_ERR, "no room for semi-direct path of %s\n", objid);
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+
+   char* dst = path + prt_count;
+   for (ptr=objid; *ptr; ++ptr)
+      *dst++ = ((*ptr == '/') ? '#' : *ptr);
+   *dst = 0;
+
+   return 0;
+}
+
+
 // update the URL in the ObjectStream, in our FileHandle
 int update_url(ObjectStream* os, PathInfo* info) {
    //   TRY_DECLS();
    //   __TRY0(update_pre, &info->pre);
+
+   // semi-direct "URL" is a file-path
+   os->is_file = (info->pre.repo->access_method == ACCESSMETHOD_SEMI_DIRECT);
+   if (os->is_file) {
+      if (semi_direct_path(os->url, MARFS_MAX_URL_SIZE,
+                           info->pre.repo, info->ns->name, info->pre.objid))
+         return -1;
+      LOG(LOG_INFO, "generated path %s\n", os->url);
+      return 0;
+   }
+
    strncpy(os->url, info->pre.objid, MARFS_MAX_URL_SIZE);
 
    // log the full URL, if possible:
@@ -1523,7 +1896,7 @@ ssize_t get_chunksize(const char* path,
    TRY_DECLS();
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    return get_chunksize_with_info(&info, file_size, desired_chunk_size, subtract_recovery_info);
@@ -1566,6 +1939,73 @@ size_t get_stream_open_size(MarFS_FileHandle* fh, uint8_t decrement) {
 }
 
 
+
+// FileHandle free-list.
+//
+// fuse_open() used to calloc() a fresh FileHandle for every open, and
+// fuse_release() freed it.  These are large (the ObjectStream has a URL
+// buffer, and the PathInfo has several path buffers), so at high open
+// rates that meant a lot of malloc traffic and page-faults.  Instead, we
+// carve handles out of slabs, and keep released handles on a free-list.
+// Slabs are never returned to the system; the free-list just holds the
+// high-water-mark of concurrently-open files.
+//
+// release() may run on a different thread than the corresponding open(),
+// so a per-thread cache doesn't help much here.  The lock is only held
+// long enough to push/pop a pointer.
+
+#define FH_SLAB_COUNT  64
+
+typedef union FHSlot {
+   MarFS_FileHandle  fh;
+   union FHSlot*     next;       // only valid while on the free-list
+} FHSlot;
+
+static FHSlot*          fh_free_list = NULL;
+static pthread_mutex_t  fh_lock      = PTHREAD_MUTEX_INITIALIZER;
+
+MarFS_FileHandle* alloc_filehandle() {
+   FHSlot* slot;
+
+   pthread_mutex_lock(&fh_lock);
+   if (! fh_free_list) {
+      FHSlot* slab = (FHSlot*)malloc(FH_SLAB_COUNT * sizeof(FHSlot));
+      if (! slab) {
+         pthread_mutex_unlock(&fh_lock);
+         LOG(LOG_ERR, "couldn't allocate a slab of %d FileHandles\n", FH_SLAB_COUNT);
+         errno = ENOMEM;
+         return NULL;
+      }
+      int i;
+      for (i=0; i<FH_SLAB_COUNT; ++i) {
+         slab[i].next = fh_free_list;
+         fh_free_list = &slab[i];
+      }
+   }
+   slot = fh_free_list;
+   fh_free_list = slot->next;
+   pthread_mutex_unlock(&fh_lock);
+
+   // Same as calloc(), except for the big path-buffers in the PathInfo
+   MarFS_FileHandle* fh = &slot->fh;
+   memset(fh, 0, offsetof(MarFS_FileHandle, info));
+   init_path_info(&fh->info);
+   return fh;
+}
+
+void free_filehandle(MarFS_FileHandle* fh) {
+   FHSlot* slot = (FHSlot*)fh;
+
+   stream_retry_buf(&fh->os, 0); // in case marfs_release() bailed early
+   free(fh->write_status.inline_buf);
+
+   pthread_mutex_lock(&fh_lock);
+   slot->next   = fh_free_list;
+   fh_free_list = slot;
+   pthread_mutex_unlock(&fh_lock);
+}
+
+
 // Make sure the hierarchical trash directory tree exists, for all namespaces.
 //
 // The configuration-file specifies a root trash-directory for each
@@ -1758,9 +2198,7 @@ int init_mdfs() {
         ns = namespace_next(&it)) {
 
       const uint32_t shard = 0;   // FUTURE: make scatter-tree for each shard?
-#if TBD
       MarFS_Repo*    repo  = ns->iwrite_repo; // for fuse
-#endif
       mode_t         mode  = (S_IRWXU | S_IRWXG ); // default 'chmod 770'
 
 
@@ -1870,20 +2308,36 @@ int init_mdfs() {
          return -1;
       }
 
+      // journal for this daemon's changes to the namespace's usage (see
+      // ledger.h).  Not fatal.  The next quota scan will catch up.
+      ledger_open(ns);
 
 
-#if TBD
-      // COMMENTED OUT.  Turns out there are issues with POSIX permissions
-      // in this setup, because "who owns the directory into which the
-      // user's data-files are stored"?  It was felt that, even if the
-      // storage file-system is unshared, the fact that the parent dir
-      // (i.e. leaf dir in the scatter-tree) would have to be
-      // world-writable was not good enough protection.
-
-      // create a scatter-tree for semi-direct fuse repos, if any
+
+      // create a scatter-tree for semi-direct fuse repos, if any.
+      //
+      // NOTE: There were issues with POSIX permissions in this setup,
+      //     because "who owns the directory into which the user's
+      //     data-files are stored"?  It was felt that, even if the storage
+      //     file-system is unshared, the fact that the parent dir (i.e.
+      //     leaf dir in the scatter-tree) would have to be world-writable
+      //     was not good enough protection.  Instead, the tree keeps the
+      //     same 'chmod 770' as everything else, and the object-stream
+      //     opens the data-files with the daemon's own credentials.
       if (repo->access_method == ACCESSMETHOD_SEMI_DIRECT) {
          __TRY0(init_scatter_tree, repo->host, ns->name, shard, mode);
       }
+
+#ifndef STATIC_CONFIG
+      // fuse may also write to the repos for size-ranges (see defer_repo())
+      int i;
+      for (i=0; i<ns->repo_range_list_count; ++i) {
+         MarFS_Repo* range_repo = ns->repo_range_list[i]->repo_ptr;
+         if ((range_repo != repo)
+             && (range_repo->access_method == ACCESSMETHOD_SEMI_DIRECT)) {
+            __TRY0(init_scatter_tree, range_repo->host, ns->name, shard, mode);
+         }
+      }
 #endif
 
    }
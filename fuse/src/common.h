@@ -367,23 +367,35 @@ typedef enum {
 } PathInfoFlagValue;
 
 
+// NOTE: Every fuse op builds one of these on the stack.  The small,
+//       frequently-touched fields are kept together at the front, and the
+//       large path-buffers (pre.objid, post.md_path, trash_md_path) are
+//       kept at the tail of their respective structs.  That allows
+//       init_path_info() to zero everything except those buffers, which
+//       are always written with snprintf() (or similar) before they are
+//       read, so they only need to be terminated.  If you add fields,
+//       keep the big buffers last.
+
 typedef struct PathInfo {
    MarFS_Namespace*     ns;
+   PathInfoFlagType     flags;
+   XattrMaskType        xattrs; // OR'ed XattrValueTypes, use has_any_xattrs()
+   unsigned int         seed;   // for rand_r()
+
    struct stat          st;
    // struct statvfs       stvfs;  // applies to Namespace.fsinfo
 
+   MarFS_XattrShard     shard;
    MarFS_XattrPre       pre;
    MarFS_XattrPost      post;
-   MarFS_XattrShard     shard;
-   XattrMaskType        xattrs; // OR'ed XattrValueTypes, use has_any_xattrs()
-
-   PathInfoFlagType     flags;
-   unsigned int         seed;   // for rand_r()
 
    // char                 md_path[MARFS_MAX_MD_PATH]; // full path to MDFS file
    char                 trash_md_path[MARFS_MAX_MD_PATH];
 } PathInfo;
 
+// replaces memset(&info, 0, sizeof(PathInfo)), at the top of fuse ops
+extern void init_path_info(PathInfo* info);
+
 
 
 // ...........................................................................
@@ -400,6 +412,8 @@ typedef enum {
    FH_WRITING      = 0x02,        // might someday allow O_RDWR
    FH_DIRECT       = 0x04,        // i.e. PathInfo.xattrs has no MD_
    FH_ALLOW_RISKY  = 0x08,        // implies pftool calling. (Can write N:1)
+   FH_INLINE       = 0x10,        // writes are buffered (see inline_spill())
+   FH_DEFER_REPO   = 0x20,        // repo is chosen when the buffer spills/closes
 } FHFlags;
 
 typedef uint16_t FHFlagType;
@@ -419,6 +433,25 @@ typedef struct {
    size_t        log_offset;    // effective offset (shows contiguous reads)
 } ReadStatus;
 
+// If a GET fails part-way (5xx, connection reset, timeout, short data),
+// marfs_read() re-opens the stream where it left off, switching to another
+// host in the repo (if there is more than one), after a delay that doubles
+// with each attempt.
+#define MARFS_READ_RETRIES          4
+#define MARFS_RETRY_BACKOFF_MS      50   /* first delay */
+#define MARFS_RETRY_BACKOFF_MAX_MS  2000
+
+// Hedged GETs.  If a new GET for a small read hasn't heard back from the
+// server within the MARFS_HEDGE_PERCENTILE time-to-first-byte (see
+// LAT_STREAM_FIRST_BYTE), marfs_read() sends a duplicate to the next
+// host, and uses whichever answers first.  Off, unless the environment
+// variable MARFS_HEDGE_PCT gives the max percentage of GETs that may be
+// hedged.
+#define MARFS_HEDGE_MAX_SIZE        (1024 * 1024) /* largest read to hedge */
+#define MARFS_HEDGE_PERCENTILE      95.0
+#define MARFS_HEDGE_MIN_SAMPLES     100  /* first-bytes seen, before hedging */
+#define MARFS_HEDGE_WAIT_MAX_MS     10000
+
 
 // write() can maintain state here
 //
@@ -472,29 +505,79 @@ typedef struct {
 // close-and-reopen to correctly track the remaining size, without getting
 // screwed by truncate.
 
+// If a chunk PUT fails, marfs_write() re-sends the chunk from a copy kept
+// by stream_put(), with the same backoff and host-switching as reads.
+// The copies of all open writers together are limited to
+// MARFS_WRITE_RETRY_BUDGET bytes, or the number of bytes in the
+// environment variable MARFS_WRITE_RETRY_BUDGET (0 turns the copies off).
+// A chunk whose copy won't fit in what's left can't be retried.
+// Semi-direct (file) repos are never copied.
+#define MARFS_WRITE_RETRIES         4
+#define MARFS_WRITE_RETRY_BUDGET    (512 * 1024 * 1024)
+
+// Small files can be kept "inline", in the MDFS file itself, with no
+// object at all.  marfs_open() buffers writes in WriteStatus.inline_buf,
+// instead of opening a stream.  If the file is closed before it grows
+// past the threshold, marfs_release() writes the buffer into the MDFS
+// file, and marks the POST xattr with POST_INLINE.  Otherwise, the buffer
+// is sent as the start of a normal object.  Off, unless the environment
+// variable MARFS_INLINE_MAX gives the threshold (bytes).
+#define MARFS_INLINE_ALLOC          4096 /* first allocation of inline_buf */
+
+// Fuse doesn't know how big a file will be, so it can't pick a repo from
+// the namespace's size-ranges, the way pftool does.  If the environment
+// variable MARFS_DEFER_REPO_MAX gives a size (bytes), fuse writes are
+// buffered (as for inline files) up to that size, and the repo is chosen
+// from the ranges when the file closes, using its final size.  A file
+// that outgrows the buffer goes to the repo for the largest files.
+#define MARFS_DEFER_REPO_BUF_MAX    (64 * 1024 * 1024)
+
+// marfs_statfs() reports a namespace's quota as the size of the
+// file-system, and its cached usage (see ledger.h) as the space used.
+// There's no real limit on an unlimited quota, so we report this much
+// free, beyond what's used.
+#define MARFS_STATFS_BSIZE          4096
+#define MARFS_STATFS_FREE_SPACE     (1LL << 50) /* 1 PiB, if unlimited */
+#define MARFS_STATFS_FREE_NAMES     (1LL << 32) /* if unlimited */
+
 typedef struct {
    size_t        sys_writes;    // discount this much from FileHandle.os.written
    RecoveryInfo  rec_info;      // (goes into tail of object)
    size_t        data_remain;   // remaining user-data size (incl current req)
    size_t        user_req;      // part of current request for user-data
    size_t        sys_req;       // part of current request for sys-data (recovery-info)
+   int           put_retries;   // times current chunk has been re-sent
+   char*         inline_buf;    // (if FH_INLINE) data written so far
+   size_t        inline_len;    // amount of data in inline_buf
+   size_t        inline_alloc;  // size of inline_buf
 } WriteStatus;
 
 
 
+// NOTE: Fields used on every read/write come first, so they share
+//       cache-lines.  The PathInfo (with its large path-buffers) is last.
+
 typedef struct {
-   PathInfo      info;          // includes xattrs, MDFS path, etc
-   int           md_fd;         // opened for reading meta-data, or data
    FHFlagType    flags;
+   int           md_fd;         // opened for reading meta-data, or data
    curl_off_t    open_offset;   // [see comments at marfs_open_with_offset()]
+   int           host_idx;      // which of the repo's hosts we're using
    ReadStatus    read_status;   // buffer_management, current_offset, etc
    WriteStatus   write_status;  // buffer-management, etc
    ObjectStream  os;            // handle for streaming access to objects
+   PathInfo      info;          // includes xattrs, MDFS path, etc
 } MarFS_FileHandle;
 
 // fuse/pftool-agnostic updates of data_remain, etc. (see comments, above)
 size_t get_stream_open_size(MarFS_FileHandle* fh, uint8_t decrement);
 
+// FileHandles are recycled through a free-list, which is refilled a slab
+// at a time.  alloc_filehandle() returns a handle in the same pristine
+// state as calloc() would (see the NOTE at fuse_open()), or NULL with
+// errno set.
+extern MarFS_FileHandle* alloc_filehandle();
+extern void              free_filehandle(MarFS_FileHandle* fh);
+
 
 // directory-handle covers two cases:
 // (a) Listing an MDFS directory -- just need a DIR*
@@ -508,25 +591,16 @@ typedef struct {
 } MarFS_DirHandle;
 
 
-// // In C++ I'd just steal the templated Pool<T> classes from pftool, to
-// // allow us to re-use dynamically-allocate objects.  Here, I'll make a
-// // crude stack and functions to alloc/free.
-// //
-// // Hmmm.  That's going to lead to a locking bottleneck.  Maybe we don't
-// // care, in fuse?
-// 
-// typedef struct Reusable {
-//    void*            obj;
-//    int              avail;
-//    struct Reusable* next;
-// } Reusable;
-// 
-// extern void* alloc_reusable(Reusable** ruse);
-// extern void  free_reusable (Reusable** ruse, void* obj);
 
 
 
 
+// fuse front-ends run each op with the credentials of the calling user
+extern int  push_user(uid_t* saved_euid, gid_t* saved_egid,
+                      uid_t  new_uid,    gid_t  new_gid);
+extern int  pop_user (uid_t* saved_euid, gid_t* saved_egid);
+
+
 // strip the leading <mnt_top> from an arbitrary path.
 // Return NULL if no match.
 extern const char* marfs_sub_path(const char* path);
@@ -561,6 +635,10 @@ extern int  check_quotas  (PathInfo* info);
 
 extern int  update_url(ObjectStream* os, PathInfo* info);
 
+// file-path of an object in a SEMI_DIRECT repo
+extern int  semi_direct_path(char* path, size_t max_size, const MarFS_Repo* repo,
+                             const char* ns_name, const char* objid);
+
 // write MultiChunkInfo (as binary data in network-byte-order), into file
 extern int     write_chunkinfo(int                   md_fd,
                                const PathInfo* const info,
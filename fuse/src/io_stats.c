@@ -0,0 +1,318 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// _GNU_SOURCE defines sched_getcpu()
+#define _GNU_SOURCE
+
+#include "logging.h"
+#include "io_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+
+#define IO_STATS_CACHE_LINE   64
+#define IO_STATS_SLOT_SIZE    (((IOS_COUNTER_COUNT * sizeof(uint64_t))       \
+                                + IO_STATS_CACHE_LINE -1)                    \
+                               & ~(IO_STATS_CACHE_LINE -1))
+
+typedef union {
+   volatile uint64_t  counter[IOS_COUNTER_COUNT];
+   char               pad[IO_STATS_SLOT_SIZE];
+} IoStatsSlot;
+
+struct IoStats {
+   IoStatsSlot   slot[IO_STATS_SLOTS];  // first, so it stays cache-aligned
+   IoStatsKind   kind;
+   char          name[IO_STATS_NAME_MAX];
+};
+
+
+// Entries are only ever appended.  Readers don't lock.  Writers (creating
+// a new entry) take the lock, so two threads can't both add the same name.
+static IoStats* volatile  ios_entry[IO_STATS_MAX_ENTRIES];
+static volatile int       ios_count = 0;
+static pthread_mutex_t    ios_lock  = PTHREAD_MUTEX_INITIALIZER;
+
+
+#define IO_STATS_NAME(NAME, STR)  STR,
+static const char* ios_names[] = {
+   IO_STATS_COUNTERS(IO_STATS_NAME)
+};
+
+static const char* ios_kind_names[]  = { "repo",  "host"  };
+static const char* ios_kind_plural[] = { "repos", "hosts" };
+
+
+
+static IoStats* ios_lookup(IoStatsKind kind, const char* name, int count) {
+   int i;
+   for (i=0; i<count; ++i) {
+      IoStats* stats = ios_entry[i];
+      if ((stats->kind == kind) && ! strcmp(stats->name, name))
+         return stats;
+   }
+   return NULL;
+}
+
+IoStats* io_stats_find(IoStatsKind kind, const char* name) {
+   if (! name)
+      return NULL;
+
+   int      count = ios_count;
+   __sync_synchronize();        // see entries up to <count>
+   IoStats* stats = ios_lookup(kind, name, count);
+   if (stats)
+      return stats;
+
+   pthread_mutex_lock(&ios_lock);
+
+   // somebody may have added it, since we looked
+   count = ios_count;
+   stats = ios_lookup(kind, name, count);
+   if (! stats && (count < IO_STATS_MAX_ENTRIES)) {
+      if (! posix_memalign((void**)&stats, IO_STATS_CACHE_LINE, sizeof(IoStats))) {
+         memset(stats, 0, sizeof(IoStats));
+         stats->kind = kind;
+         strncpy(stats->name, name, IO_STATS_NAME_MAX);
+         stats->name[IO_STATS_NAME_MAX -1] = 0;
+
+         ios_entry[count] = stats;
+         __sync_synchronize();  // publish entry, before the count
+         ios_count = count +1;
+      }
+      else
+         stats = NULL;
+   }
+   else if (! stats)
+      LOG(LOG_ERR, "no room for counters for %s '%s'\n",
+          ios_kind_names[kind], name);
+
+   pthread_mutex_unlock(&ios_lock);
+   return stats;
+}
+
+
+void io_stats_add(IoStats* stats, IoCounter counter, int64_t n) {
+   if (! stats)
+      return;
+
+   int cpu = sched_getcpu();
+   if (cpu < 0)
+      cpu = 0;
+   __sync_fetch_and_add(&stats->slot[cpu & (IO_STATS_SLOTS -1)].counter[counter],
+                        (uint64_t)n);
+}
+
+void io_stats_http(IoStats* stats, int http_code) {
+   if ((http_code >= 200) && (http_code < 300))
+      io_stats_add(stats, IOS_HTTP_2XX, 1);
+   else if ((http_code >= 300) && (http_code < 400))
+      io_stats_add(stats, IOS_HTTP_3XX, 1);
+   else if ((http_code >= 400) && (http_code < 500))
+      io_stats_add(stats, IOS_HTTP_4XX, 1);
+   else if ((http_code >= 500) && (http_code < 600))
+      io_stats_add(stats, IOS_HTTP_5XX, 1);
+   else
+      io_stats_add(stats, IOS_HTTP_ERR, 1);
+}
+
+uint64_t io_stats_get(IoStats* stats, IoCounter counter) {
+   uint64_t sum = 0;
+   int      i;
+
+   if (! stats)
+      return 0;
+   for (i=0; i<IO_STATS_SLOTS; ++i)
+      sum += stats->slot[i].counter[counter];
+   return sum;
+}
+
+
+
+// JSON strings from our config are plain, but quote them properly anyway
+static int ios_json_name(char* buf, size_t size, const char* name) {
+   size_t len = 0;
+   const char* ptr;
+
+   for (ptr=name; *ptr && (len +2 < size); ++ptr) {
+      if ((*ptr == '"') || (*ptr == '\\'))
+         buf[len++] = '\\';
+      if ((unsigned char)*ptr >= ' ')
+         buf[len++] = *ptr;
+   }
+   buf[len] = 0;
+   return (int)len;
+}
+
+// room held back for the truncation marker (see io_stats_report())
+#define IOS_TRUNC_RESERVE     32
+
+int io_stats_report(char* buf, size_t size, int json) {
+   size_t len = 0;
+   size_t mark = 0;             // <len> after the last complete piece
+   size_t avail;
+   int    open_kind = 0;        // JSON "repos"/"hosts" object left open
+   int    count = ios_count;
+   int    prt_count;
+   int    kind;
+   int    i;
+   int    c;
+   char   name[2 * IO_STATS_NAME_MAX];
+
+   if (size <= IOS_TRUNC_RESERVE) {
+      errno = ENOSPC;
+      return -1;
+   }
+   avail  = size - IOS_TRUNC_RESERVE;
+   buf[0] = 0;
+   __sync_synchronize();        // see entries up to <count>
+
+   // If a piece doesn't fit, back up to the last complete one, and finish
+   // with the marker.
+#define IOS_PRINT(...)                                                  \
+   do {                                                                 \
+      prt_count = snprintf(buf + len, avail - len, __VA_ARGS__);        \
+      if ((prt_count < 0) || (prt_count >= (int)(avail - len))) {       \
+         len = mark;                                                    \
+         goto truncated;                                                \
+      }                                                                 \
+      len += prt_count;                                                 \
+   } while (0)
+
+   if (json)
+      IOS_PRINT("{");
+   mark = len;
+
+   for (kind=IOS_REPO; kind<=IOS_HOST; ++kind) {
+      int first = 1;
+
+      if (json) {
+         IOS_PRINT("%s\"%s\":{", ((kind == IOS_REPO) ? "" : ","), ios_kind_plural[kind]);
+         open_kind = 1;
+         mark = len;
+      }
+
+      for (i=0; i<count; ++i) {
+         IoStats* stats = ios_entry[i];
+         if (stats->kind != kind)
+            continue;
+
+         if (json) {
+            ios_json_name(name, sizeof(name), stats->name);
+            IOS_PRINT("%s\"%s\":{", (first ? "" : ","), name);
+         }
+         else
+            IOS_PRINT("%s %s", ios_kind_names[kind], stats->name);
+
+         for (c=0; c<IOS_COUNTER_COUNT; ++c) {
+            unsigned long long value = io_stats_get(stats, (IoCounter)c);
+            if (json)
+               IOS_PRINT("%s\"%s\":%llu", (c ? "," : ""), ios_names[c], value);
+            else
+               IOS_PRINT(" %s=%llu", ios_names[c], value);
+         }
+
+         IOS_PRINT("%s", (json ? "}" : "\n"));
+         first = 0;
+         mark = len;
+      }
+
+      if (json) {
+         IOS_PRINT("}");
+         open_kind = 0;
+         mark = len;
+      }
+   }
+
+   if (json)
+      IOS_PRINT("}\n");
+#undef IOS_PRINT
+
+   return (int)len;
+
+ truncated:
+   // <len> < <avail>, so the marker always fits in the reserve
+   if (json)
+      prt_count = snprintf(buf + len, size - len, "%s%s\"truncated\":true}\n",
+                           (open_kind ? "}" : ""), ((len > 1) ? "," : ""));
+   else
+      prt_count = snprintf(buf + len, size - len, "truncated\n");
+   len += prt_count;
+
+   LOG(LOG_INFO, "report truncated at %lu bytes\n", (unsigned long)len);
+   return (int)len;
+}
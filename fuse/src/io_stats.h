@@ -0,0 +1,182 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// ---------------------------------------------------------------------------
+// I/O counters, per repo and per object-host
+//
+// Every GET/PUT stream (see object_stream.c) adds its traffic, its HTTP
+// result, and any timeouts, to a set of counters for its repo and another
+// for the host it is talking to.  (marfs_open() picks those.)  This lets
+// us see a degraded host, or an overloaded repo, without trawling the
+// logs for errors.
+//
+// Counters are cumulative since the daemon started.  Dashboards should
+// compute rates from successive samples.  IOS_ACTIVE is a gauge.
+//
+// Each set of counters is split into per-CPU slots, each a whole number
+// of cache-lines, so concurrent streams on different cores aren't fighting
+// over the same lines.  Readers sum the slots.  (Threads can migrate, so
+// adds are still atomic.)
+//
+// Fuse: see MARFS_IOC_IO_STATS and MARFS_IOC_IO_STATS_JSON, in marfs_ops.h.
+// ---------------------------------------------------------------------------
+
+#ifndef _MARFS_IO_STATS_H
+#define _MARFS_IO_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif
+
+
+// X(ENUM_SUFFIX, "report-name").  Add new ones at the end, so the report
+// format stays stable.
+#define IO_STATS_COUNTERS(X)              \
+   X(BYTES_IN,        "bytes_in")         \
+   X(BYTES_OUT,       "bytes_out")        \
+   X(ACTIVE,          "active_streams")   \
+   X(GETS,            "gets")             \
+   X(PUTS,            "puts")             \
+   X(HTTP_2XX,        "http_2xx")         \
+   X(HTTP_3XX,        "http_3xx")         \
+   X(HTTP_4XX,        "http_4xx")         \
+   X(HTTP_5XX,        "http_5xx")         \
+   X(HTTP_ERR,        "http_err")         \
+   X(TIMEOUTS,        "timeouts")         \
+   X(TIMEOUTS_KILLED, "timeouts_killed")  \
+   X(RETRIES,         "retries")          \
+   X(HEDGES,          "hedges")           \
+   X(HEDGE_WINS,      "hedge_wins")
+
+#define IO_STATS_ENUM(NAME, STR)  IOS_##NAME,
+
+typedef enum {
+   IO_STATS_COUNTERS(IO_STATS_ENUM)
+   IOS_COUNTER_COUNT
+} IoCounter;
+
+
+typedef enum {
+   IOS_REPO = 0,
+   IOS_HOST,
+} IoStatsKind;
+
+
+// may be overridden at compile-time (must be a power of 2)
+#ifndef IO_STATS_SLOTS
+#  define IO_STATS_SLOTS        32
+#endif
+
+#define IO_STATS_MAX_ENTRIES    512 /* repos + hosts */
+#define IO_STATS_NAME_MAX       128
+
+
+typedef struct IoStats IoStats; // one repo or host.  See io_stats.c
+
+
+// Find the counters for the named repo or host, creating them if needed.
+// These are never freed, so the pointer can be kept.  Returns NULL if we
+// run out of entries (in which case adds are quietly dropped).
+extern IoStats* io_stats_find(IoStatsKind kind, const char* name);
+
+// <stats> may be NULL
+extern void     io_stats_add(IoStats* stats, IoCounter counter, int64_t n);
+
+// add the class of an HTTP response-code (0 means no response)
+extern void     io_stats_http(IoStats* stats, int http_code);
+
+extern uint64_t io_stats_get(IoStats* stats, IoCounter counter);
+
+// Text has one line per repo or host:
+//
+//    repo <name> bytes_in=<n> bytes_out=<n> active_streams=<n> ...
+//    host <name> bytes_in=<n> ...
+//
+// JSON is {"repos":{"<name>":{"bytes_in":<n>,...},...},"hosts":{...}}
+//
+// Always NUL-terminated.  Returns the length.  If everything doesn't fit,
+// trailing entries are dropped, and the report ends with a "truncated"
+// line (text), or a "truncated":true member (JSON).  Returns -1 (ENOSPC)
+// only if <size> is too small even for that.
+extern int      io_stats_report(char* buf, size_t size, int json);
+
+
+#  ifdef __cplusplus
+}
+#  endif
+
+
+#endif // _MARFS_IO_STATS_H
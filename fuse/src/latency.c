@@ -0,0 +1,307 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+#define _XOPEN_SOURCE 700       /* POSIX 2008: clock_gettime() */
+
+#include "logging.h"
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+
+// One of these per thread that records anything.  They're never freed.
+// When a thread exits, its set goes back on the list for reuse by a new
+// thread (keeping its counts, which are still part of the totals).
+typedef struct LatencyThread {
+   struct LatencyThread*  next;
+   volatile int           in_use;
+   LatencyHisto           histo[LAT_OP_COUNT];
+} LatencyThread;
+
+
+static LatencyThread* volatile  lat_threads = NULL;   // push-only list
+
+static __thread LatencyThread*  lat_mine = NULL;
+static pthread_key_t            lat_key;
+static pthread_once_t           lat_key_once = PTHREAD_ONCE_INIT;
+
+
+#define LATENCY_NAME(NAME, STR)  STR,
+static const char* lat_names[] = {
+   LATENCY_OPS(LATENCY_NAME)
+};
+
+
+
+static void lat_release(void* arg) {
+   LatencyThread* lt = (LatencyThread*)arg;
+   __sync_synchronize();
+   lt->in_use = 0;
+}
+
+static void lat_init_key() {
+   pthread_key_create(&lat_key, lat_release);
+}
+
+static LatencyThread* lat_claim() {
+   LatencyThread* lt;
+
+   pthread_once(&lat_key_once, lat_init_key);
+
+   // reuse a set from a thread that has exited
+   for (lt=lat_threads; lt; lt=lt->next) {
+      if (__sync_bool_compare_and_swap(&lt->in_use, 0, 1))
+         break;
+   }
+
+   if (! lt) {
+      lt = (LatencyThread*)calloc(1, sizeof(LatencyThread));
+      if (! lt)
+         return NULL;
+      lt->in_use = 1;
+      do {
+         lt->next = lat_threads;
+      } while (! __sync_bool_compare_and_swap(&lat_threads, lt->next, lt));
+   }
+
+   lat_mine = lt;
+   pthread_setspecific(lat_key, lt);
+   return lt;
+}
+
+
+static inline unsigned lat_bucket(uint64_t ns) {
+   if (ns < LAT_SUB)
+      return (unsigned)ns;
+
+   // the last bucket also takes everything from 2^LAT_MAX_EXP up
+   unsigned exp = 63 - __builtin_clzll(ns);
+   if (exp >= LAT_MAX_EXP)
+      return LAT_BUCKETS -1;
+
+   return (((exp - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+           + (unsigned)((ns >> (exp - LAT_SUB_BITS)) & (LAT_SUB -1)));
+}
+
+// smallest value that goes into bucket <idx>
+static uint64_t lat_bucket_min(unsigned idx) {
+   if (idx < LAT_SUB)
+      return idx;
+
+   unsigned exp = (idx >> LAT_SUB_BITS) + LAT_SUB_BITS -1;
+   uint64_t sub = idx & (LAT_SUB -1);
+   return ((LAT_SUB + sub) << (exp - LAT_SUB_BITS));
+}
+
+// largest value that goes into bucket <idx>.  The last bucket is a
+// catch-all, with no upper bound.
+static uint64_t lat_bucket_max(unsigned idx) {
+   if (idx >= LAT_BUCKETS -1)
+      return UINT64_MAX;
+   return lat_bucket_min(idx +1) -1;
+}
+
+
+
+uint64_t latency_now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void latency_record(LatencyOp op, uint64_t nsecs) {
+   LatencyThread* lt = lat_mine;
+   if (! lt && ! (lt = lat_claim()))
+      return;
+
+   // only this thread writes to <lt>, so no atomics needed
+   LatencyHisto* h = &lt->histo[op];
+   h->count  += 1;
+   h->sum_ns += nsecs;
+   if (nsecs > h->max_ns)
+      h->max_ns = nsecs;
+   h->bucket[lat_bucket(nsecs)] += 1;
+}
+
+LatencyScope latency_scope_begin(LatencyOp op) {
+   LatencyScope scope = { op, latency_now() };
+   return scope;
+}
+
+void latency_scope_end(LatencyScope* scope) {
+   latency_record(scope->op, latency_now() - scope->start);
+}
+
+
+
+void latency_merge(LatencyOp op, LatencyHisto* result) {
+   LatencyThread* lt;
+   unsigned       i;
+
+   memset(result, 0, sizeof(LatencyHisto));
+   for (lt=lat_threads; lt; lt=lt->next) {
+      const LatencyHisto* h = &lt->histo[op];
+      if (! h->count)
+         continue;
+
+      result->count  += h->count;
+      result->sum_ns += h->sum_ns;
+      if (h->max_ns > result->max_ns)
+         result->max_ns = h->max_ns;
+      for (i=0; i<LAT_BUCKETS; ++i)
+         result->bucket[i] += h->bucket[i];
+   }
+}
+
+uint64_t latency_percentile(const LatencyHisto* h, double pct) {
+   uint64_t total = 0;
+   uint64_t seen  = 0;
+   unsigned i;
+
+   for (i=0; i<LAT_BUCKETS; ++i)
+      total += h->bucket[i];
+   if (! total)
+      return 0;
+
+   uint64_t want = (uint64_t)((pct / 100.0) * total);
+   if (want >= total)
+      want = total -1;
+
+   for (i=0; i<LAT_BUCKETS; ++i) {
+      seen += h->bucket[i];
+      if (seen > want)
+         break;
+   }
+   uint64_t upper = lat_bucket_max(i);
+   return ((upper < h->max_ns) ? upper : h->max_ns);
+}
+
+int latency_report(char* buf, size_t size) {
+   LatencyHisto h;
+   size_t       len = 0;
+   int          op;
+   int          prt_count;
+
+   if (! size) {
+      errno = ENOSPC;
+      return -1;
+   }
+   buf[0] = 0;
+
+#define LAT_PRINT(...)                                                  \
+   do {                                                                 \
+      prt_count = snprintf(buf + len, size - len, __VA_ARGS__);         \
+      if ((prt_count < 0) || (prt_count >= (int)(size - len))) {        \
+         errno = ENOSPC;                                                \
+         return -1;                                                     \
+      }                                                                 \
+      len += prt_count;                                                 \
+   } while (0)
+
+   LAT_PRINT("%-20s %10s %11s %11s %11s %11s %11s %11s   (usec)\n",
+             "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+   for (op=0; op<LAT_OP_COUNT; ++op) {
+      latency_merge((LatencyOp)op, &h);
+      if (! h.count)
+         continue;
+
+      LAT_PRINT("%-20s %10llu %11.1f %11.1f %11.1f %11.1f %11.1f %11.1f\n",
+                lat_names[op],
+                (unsigned long long)h.count,
+                (h.sum_ns / (double)h.count) / 1000.0,
+                latency_percentile(&h, 50.0) / 1000.0,
+                latency_percentile(&h, 90.0) / 1000.0,
+                latency_percentile(&h, 99.0) / 1000.0,
+                latency_percentile(&h, 99.9) / 1000.0,
+                h.max_ns / 1000.0);
+   }
+#undef LAT_PRINT
+
+   return (int)len;
+}
+
+void latency_reset() {
+   LatencyThread* lt;
+   for (lt=lat_threads; lt; lt=lt->next)
+      memset(lt->histo, 0, sizeof(lt->histo));
+   LOG(LOG_INFO, "latency histograms reset\n");
+}
+
+const char* latency_op_name(LatencyOp op) {
+   return ((op < LAT_OP_COUNT) ? lat_names[op] : "unknown");
+}
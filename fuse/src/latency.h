@@ -0,0 +1,216 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// ---------------------------------------------------------------------------
+// Latency histograms
+//
+// Low-overhead timing of every marfs_*() op, and of the interesting phases
+// underneath them (expand_path_info, xattrs, stream open/sync/close,
+// first-byte of a GET, trash).  Each thread records into its own set of
+// histograms, without locks or shared cache-lines, and the sets are only
+// merged when somebody asks for a report.  (Fuse: see MARFS_IOC_LATENCY,
+// in marfs_ops.h.)
+//
+// Histograms are log-linear ("HDR-style"): each power-of-two range of
+// nanoseconds is split into LAT_SUB linear sub-buckets, so the error of a
+// reported percentile is at most 1/LAT_SUB of the value, from nanoseconds
+// out to about 18 minutes.
+//
+// Usage, at the top of a function:
+//
+//     LATENCY_SCOPE(LAT_OP_READ);
+//
+// records the time from there until the function returns, however it
+// returns.  (This uses gcc's cleanup attribute.)  For intervals that span
+// functions, use latency_now() and latency_record().
+//
+// NOTE: Reset and report run concurrently with recording, without
+//     locks.  A report may be slightly inconsistent (e.g. a count that
+//     doesn't quite match the sum of the buckets), which is fine for
+//     profiling.
+// ---------------------------------------------------------------------------
+
+#ifndef _MARFS_LATENCY_H
+#define _MARFS_LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif
+
+
+// Everything we time.  X(ENUM_SUFFIX, "report-name")
+#define LATENCY_OPS(X)                                \
+   X(OP_ACCESS,          "marfs_access")              \
+   X(OP_CHMOD,           "marfs_chmod")               \
+   X(OP_CHOWN,           "marfs_chown")               \
+   X(OP_FSYNC,           "marfs_fsync")               \
+   X(OP_FTRUNCATE,       "marfs_ftruncate")           \
+   X(OP_GETATTR,         "marfs_getattr")             \
+   X(OP_GETXATTR,        "marfs_getxattr")            \
+   X(OP_LISTXATTR,       "marfs_listxattr")           \
+   X(OP_MKDIR,           "marfs_mkdir")               \
+   X(OP_MKNOD,           "marfs_mknod")               \
+   X(OP_OPEN,            "marfs_open")                \
+   X(OP_OPENDIR,         "marfs_opendir")             \
+   X(OP_READ,            "marfs_read")                \
+   X(OP_READDIR,         "marfs_readdir")             \
+   X(OP_READLINK,        "marfs_readlink")            \
+   X(OP_RELEASE,         "marfs_release")             \
+   X(OP_RELEASEDIR,      "marfs_releasedir")          \
+   X(OP_REMOVEXATTR,     "marfs_removexattr")         \
+   X(OP_RENAME,          "marfs_rename")              \
+   X(OP_RMDIR,           "marfs_rmdir")               \
+   X(OP_SETXATTR,        "marfs_setxattr")            \
+   X(OP_STATFS,          "marfs_statfs")              \
+   X(OP_SYMLINK,         "marfs_symlink")             \
+   X(OP_TRUNCATE,        "marfs_truncate")            \
+   X(OP_UNLINK,          "marfs_unlink")              \
+   X(OP_UTIMENS,         "marfs_utimens")             \
+   X(OP_WRITE,           "marfs_write")               \
+                                                      \
+   X(EXPAND_PATH_INFO,   "expand_path_info")          \
+   X(STAT_XATTRS,        "stat_xattrs")               \
+   X(SAVE_XATTRS,        "save_xattrs")               \
+   X(TRASH_UNLINK,       "trash_unlink")              \
+   X(TRASH_TRUNCATE,     "trash_truncate")            \
+   X(STREAM_OPEN,        "stream_open")               \
+   X(STREAM_FIRST_BYTE,  "stream_first_byte")         \
+   X(STREAM_SYNC,        "stream_sync")               \
+   X(STREAM_CLOSE,       "stream_close")
+
+#define LATENCY_ENUM(NAME, STR)  LAT_##NAME,
+
+typedef enum {
+   LATENCY_OPS(LATENCY_ENUM)
+   LAT_OP_COUNT
+} LatencyOp;
+
+
+#define LAT_SUB_BITS  3
+#define LAT_SUB       (1 << LAT_SUB_BITS)
+// Latencies of 2^LAT_MAX_EXP ns (about 18 minutes) or more all go in the
+// last bucket.
+#define LAT_MAX_EXP   40
+#define LAT_BUCKETS   ((LAT_MAX_EXP - LAT_SUB_BITS + 1) * LAT_SUB)
+
+
+typedef struct {
+   uint64_t  count;
+   uint64_t  sum_ns;
+   uint64_t  max_ns;
+   uint64_t  bucket[LAT_BUCKETS];
+} LatencyHisto;
+
+
+typedef struct {
+   LatencyOp  op;
+   uint64_t   start;
+} LatencyScope;
+
+
+extern uint64_t     latency_now();            // monotonic nsecs
+extern void         latency_record(LatencyOp op, uint64_t nsecs);
+
+extern LatencyScope latency_scope_begin(LatencyOp op);
+extern void         latency_scope_end(LatencyScope* scope);
+
+#define LATENCY_SCOPE(OP)                                               \
+   __attribute__ ((cleanup(latency_scope_end), unused))                 \
+      LatencyScope latency_scope__ = latency_scope_begin(OP)
+
+
+// merge all threads' histograms for <op>
+extern void         latency_merge(LatencyOp op, LatencyHisto* result);
+
+// upper bound (nsecs) of the bucket holding the <pct> percentile
+extern uint64_t     latency_percentile(const LatencyHisto* h, double pct);
+
+// One line per op that has been called, with count, mean, percentiles,
+// and max (in usecs).  Always NUL-terminated.  Returns the length of the
+// text, or -1 (ENOSPC) if it had to be truncated.
+extern int          latency_report(char* buf, size_t size);
+
+extern void         latency_reset();
+
+extern const char*  latency_op_name(LatencyOp op);
+
+
+#  ifdef __cplusplus
+}
+#  endif
+
+
+#endif // _MARFS_LATENCY_H
@@ -0,0 +1,415 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+#include "logging.h"
+#include "common.h"
+#include "ledger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+
+// Deltas not yet in the journal.  Only changed with __sync, so ops don't
+// take a lock.  The flusher subtracts what it wrote, so deltas that
+// arrive during a flush are kept for the next one.
+//
+// <used_bytes> and <used_names> are the cached usage.  <since_bytes> and
+// <since_names> are the changes made by this daemon since the cache was
+// read.  Only the flusher writes the cache.
+typedef struct {
+   const MarFS_Namespace* ns;
+   int                    fd;        // journal
+   volatile int64_t       bytes;
+   volatile int64_t       names;
+
+   volatile int           valid;     // cache has been read
+   volatile int64_t       used_bytes;
+   volatile int64_t       used_names;
+   volatile int64_t       since_bytes;
+   volatile int64_t       since_names;
+   ino_t                  src_ino;   // what the cache was read from
+   time_t                 src_mtime;
+} LedgerNS;
+
+static LedgerNS         ledger[LEDGER_NS_MAX];
+static size_t           ledger_count = 0;
+
+static pthread_mutex_t  ledger_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   ledger_once = PTHREAD_ONCE_INIT;
+
+
+
+// Re-read the cached usage of <l>, if its source has changed.  The ledger
+// is replaced by rename(), so a new inode also means a change.
+static void ledger_refresh(LedgerNS* l) {
+   char        path[MARFS_MAX_MD_PATH];
+   struct stat st;
+   long long   bytes;
+   long long   names = -1;
+
+   snprintf(path, MARFS_MAX_MD_PATH, "%s%s", l->ns->fsinfo_path, LEDGER_SUFFIX);
+   if (stat(path, &st)) {
+      // no ledger (yet).  fsinfo is trunc'ed to the space used.
+      strncpy(path, l->ns->fsinfo_path, MARFS_MAX_MD_PATH);
+      path[MARFS_MAX_MD_PATH -1] = 0;
+      if (stat(path, &st)) {
+         LOG(LOG_ERR, "couldn't stat fsinfo at '%s': %s\n", path, strerror(errno));
+         return;
+      }
+   }
+   if (l->valid
+       && (st.st_ino   == l->src_ino)
+       && (st.st_mtime == l->src_mtime))
+      return;
+
+   if (strcmp(path, l->ns->fsinfo_path)) {
+      FILE* fp = fopen(path, "r");
+      if (! fp) {
+         LOG(LOG_ERR, "couldn't open ledger '%s': %s\n", path, strerror(errno));
+         return;
+      }
+      int n = fscanf(fp, LEDGER_FORMAT, &bytes, &names);
+      fclose(fp);
+      if (n != 2) {
+         LOG(LOG_ERR, "couldn't parse ledger '%s'\n", path);
+         return;
+      }
+   }
+   else
+      bytes = st.st_size;
+
+   // Changes still waiting to be flushed can't be in the new totals, so
+   // they stay in since_*, and the rest are dropped.  (Ones that were
+   // flushed, but not yet applied, are lost from the count until 'marfs_quota
+   // -l' applies them.)  We subtract what's dropped, rather than storing,
+   // so deltas that arrive meanwhile aren't lost.  ledger_delta() adds to
+   // the pending count first, and we read since_* first, so a delta that
+   // races with us is counted twice (until the next refresh), not missed.
+   int64_t since_bytes = __sync_fetch_and_add(&l->since_bytes, 0);
+   int64_t since_names = __sync_fetch_and_add(&l->since_names, 0);
+   int64_t drop_bytes  = since_bytes - __sync_fetch_and_add(&l->bytes, 0);
+   int64_t drop_names  = since_names - __sync_fetch_and_add(&l->names, 0);
+
+   l->used_bytes  = bytes;
+   l->used_names  = names;
+   __sync_fetch_and_sub(&l->since_bytes, drop_bytes);
+   __sync_fetch_and_sub(&l->since_names, drop_names);
+   l->src_ino     = st.st_ino;
+   l->src_mtime   = st.st_mtime;
+   l->valid       = 1;
+
+   LOG(LOG_INFO, "%s: %lld bytes, %lld names (from %s)\n",
+       l->ns->name, bytes, names, path);
+}
+
+
+// Only called from init_mdfs(), before there are any other threads.
+int ledger_open(MarFS_Namespace* ns) {
+   char path[MARFS_MAX_MD_PATH];
+
+   if (ledger_count == LEDGER_NS_MAX) {
+      LOG(LOG_ERR, "too many namespaces for the ledger (max %d)\n", LEDGER_NS_MAX);
+      errno = ENOSPC;
+      return -1;
+   }
+   if (snprintf(path, MARFS_MAX_MD_PATH, "%s%s",
+                ns->fsinfo_path, LEDGER_JOURNAL_SUFFIX) >= MARFS_MAX_MD_PATH) {
+      LOG(LOG_ERR, "journal path too long for %s\n", ns->fsinfo_path);
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+
+   int fd = open(path, (O_WRONLY | O_APPEND | O_CREAT), (S_IRUSR | S_IWUSR));
+   if (fd < 0) {
+      LOG(LOG_ERR, "couldn't open journal %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+
+   LedgerNS* l = &ledger[ledger_count];
+   memset(l, 0, sizeof(LedgerNS));
+   l->ns    = ns;
+   l->fd    = fd;
+   ledger_refresh(l);
+   ledger_count++;
+
+   LOG(LOG_INFO, "journal %s\n", path);
+   return 0;
+}
+
+
+static LedgerNS* ledger_find(const MarFS_Namespace* ns) {
+   size_t i;
+   for (i=0; i<ledger_count; ++i) {
+      if (ledger[i].ns == ns)
+         return &ledger[i];
+   }
+   return NULL;
+}
+
+
+// Caller holds ledger_flush_lock
+static void ledger_flush(LedgerNS* l) {
+   int64_t bytes = l->bytes;
+   int64_t names = l->names;
+   if (! bytes && ! names)
+      return;
+
+   char line[64];
+   int  len = snprintf(line, sizeof(line), LEDGER_JOURNAL_FORMAT,
+                       (long long)bytes, (long long)names);
+
+   // marfs_quota takes this lock while it empties the journal
+   struct flock lk = { .l_type = F_WRLCK, .l_whence = SEEK_SET,
+                       .l_start = 0, .l_len = 0 };
+   if (fcntl(l->fd, F_SETLKW, &lk)) {
+      LOG(LOG_ERR, "couldn't lock journal for %s: %s\n",
+          l->ns->name, strerror(errno));
+      return;
+   }
+
+   ssize_t wrote = write(l->fd, line, len);
+
+   lk.l_type = F_UNLCK;
+   fcntl(l->fd, F_SETLK, &lk);
+
+   if (wrote != len) {
+      LOG(LOG_ERR, "couldn't write journal for %s: %s\n",
+          l->ns->name, ((wrote < 0) ? strerror(errno) : "short write"));
+      return;                   // keep the deltas, for the next try
+   }
+
+   __sync_fetch_and_sub(&l->bytes, bytes);
+   __sync_fetch_and_sub(&l->names, names);
+}
+
+
+void ledger_flush_all() {
+   size_t i;
+
+   pthread_mutex_lock(&ledger_flush_lock);
+   for (i=0; i<ledger_count; ++i)
+      ledger_flush(&ledger[i]);
+   pthread_mutex_unlock(&ledger_flush_lock);
+}
+
+static void ledger_refresh_all() {
+   size_t i;
+
+   pthread_mutex_lock(&ledger_flush_lock);
+   for (i=0; i<ledger_count; ++i)
+      ledger_refresh(&ledger[i]);
+   pthread_mutex_unlock(&ledger_flush_lock);
+}
+
+
+// Seconds between refreshes of the cached usage.  MARFS_QUOTA_REFRESH
+// overrides LEDGER_REFRESH_SECS.
+static unsigned ledger_refresh_secs() {
+   const char* env = getenv("MARFS_QUOTA_REFRESH");
+   unsigned    secs = (env ? strtoul(env, NULL, 10) : LEDGER_REFRESH_SECS);
+   return (secs ? secs : 1);
+}
+
+
+// The journals are only writable by root, so the flusher must run with the
+// daemon's own credentials, regardless of which user made the changes.
+// Credentials are per-thread (see push_user()), and a new thread gets the
+// credentials of the one that created it, which is whichever fuse op
+// called ledger_delta() or ledger_usage() first, running as its caller.
+// So the flusher switches back to the daemon's real uid/gid, for good.
+static void* ledger_flusher(void* arg) {
+   uid_t saved_euid;
+   gid_t saved_egid;
+   if (push_user(&saved_euid, &saved_egid, getuid(), getgid())) {
+      LOG(LOG_ERR, "ledger flusher couldn't switch to uid %d: %s\n",
+          getuid(), strerror(errno));
+      return NULL;
+   }
+
+   const unsigned refresh      = ledger_refresh_secs();
+   time_t         now          = time(NULL);
+   time_t         next_flush   = now + LEDGER_FLUSH_SECS;
+   time_t         next_refresh = now + refresh;
+
+   LOG(LOG_INFO, "flush every %d sec, refresh every %u sec\n",
+       LEDGER_FLUSH_SECS, refresh);
+
+   while (1) {
+      time_t next = ((next_flush < next_refresh) ? next_flush : next_refresh);
+      now = time(NULL);
+      if (next > now)
+         sleep(next - now);
+
+      now = time(NULL);
+      if (now >= next_flush) {
+         ledger_flush_all();
+         next_flush = now + LEDGER_FLUSH_SECS;
+      }
+      if (now >= next_refresh) {
+         ledger_refresh_all();
+         next_refresh = now + refresh;
+      }
+   }
+   return NULL;
+}
+
+// Started on the first delta, rather than in ledger_open(), because fuse
+// forks (to daemonize) after init_mdfs(), and threads don't survive that.
+static void ledger_start_flusher() {
+   pthread_t      thr;
+   pthread_attr_t attr;
+
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   if (pthread_create(&thr, &attr, ledger_flusher, NULL))
+      LOG(LOG_ERR, "couldn't start ledger flusher: %s\n", strerror(errno));
+   pthread_attr_destroy(&attr);
+}
+
+
+void ledger_delta(const MarFS_Namespace* ns, int64_t bytes, int64_t names) {
+   LedgerNS* l = ledger_find(ns);
+   if (! l)
+      return;                   // no journal (e.g. root NS)
+
+   pthread_once(&ledger_once, ledger_start_flusher);
+
+   if (bytes) {
+      __sync_fetch_and_add(&l->bytes, bytes);
+      __sync_fetch_and_add(&l->since_bytes, bytes);
+   }
+   if (names) {
+      __sync_fetch_and_add(&l->names, names);
+      __sync_fetch_and_add(&l->since_names, names);
+   }
+}
+
+
+int ledger_usage(const MarFS_Namespace* ns, int64_t* bytes, int64_t* names) {
+   LedgerNS* l = ledger_find(ns);
+   if (! l || ! l->valid)
+      return -1;
+
+   pthread_once(&ledger_once, ledger_start_flusher);
+
+   *bytes = l->used_bytes + l->since_bytes;
+   *names = ((l->used_names < 0)
+             ? -1
+             : l->used_names + l->since_names);
+   return 0;
+}
+
+
+int ledger_usage_all(int64_t* bytes,       int64_t* names,
+                     int64_t* space_limit, int64_t* names_limit) {
+   size_t i;
+   size_t found = 0;
+
+   *bytes       = 0;
+   *names       = 0;
+   *space_limit = 0;
+   *names_limit = 0;
+
+   for (i=0; i<ledger_count; ++i) {
+      int64_t ns_bytes;
+      int64_t ns_names;
+      if (ledger_usage(ledger[i].ns, &ns_bytes, &ns_names))
+         continue;
+      found++;
+
+      *bytes += ns_bytes;
+      if ((*names >= 0) && (ns_names >= 0))
+         *names += ns_names;
+      else
+         *names = -1;
+
+      long long quota_space = ledger[i].ns->quota_space;
+      long long quota_names = ledger[i].ns->quota_names;
+      if ((*space_limit >= 0) && (quota_space >= 0))
+         *space_limit += quota_space;
+      else
+         *space_limit = -1;
+      if ((*names_limit >= 0) && (quota_names >= 0))
+         *names_limit += quota_names;
+      else
+         *names_limit = -1;
+   }
+
+   return (found ? 0 : -1);
+}
@@ -0,0 +1,176 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// ---------------------------------------------------------------------------
+// Quota ledger
+//
+// marfs_quota computes each namespace's usage by scanning every inode, and
+// publishes it by truncating the fsinfo file, which check_quotas() stats.
+// Between scans, usage drifts by hours.  The ledger closes that gap:
+//
+// -- Each fuse daemon keeps per-namespace running totals of the changes it
+//    makes (bytes written at release, bytes moved to the trash by
+//    truncate/unlink, names created/unlinked).  ledger_delta() just adds
+//    to these, atomically.
+//
+// -- A thread appends the totals to the namespace's journal
+//    (<fsinfo_path>.delta) every LEDGER_FLUSH_SECS, one line per flush,
+//    under an fcntl() write-lock on the journal, and subtracts what it
+//    wrote.  The journals are opened at start-up (as root), and kept
+//    open.
+//
+// -- 'marfs_quota -l' takes the same lock, adds the journal lines to the
+//    namespace's ledger (<fsinfo_path>.ledger), truncates fsinfo to the
+//    new total, and empties the journal.  This is cheap, so it can run
+//    every minute or so.
+//
+// -- A full 'marfs_quota' scan empties the journals when it starts, and
+//    replaces the ledger totals with what it counted.  This reconciles any
+//    drift (e.g. from a daemon that died with unflushed deltas, or changes
+//    made directly in the MDFS).  Changes made while the scan is running
+//    may be counted twice (once by the scan, once in the journal), until
+//    the next scan.
+//
+// Only files with marfs xattrs are counted, to match the scan.
+//
+// The same thread also keeps a cached copy of each namespace's usage, for
+// check_quotas() and marfs_statfs().  Every LEDGER_REFRESH_SECS (or the
+// number of seconds in the environment variable MARFS_QUOTA_REFRESH), it
+// stats the ledger (or, if there is none, fsinfo), and re-reads it only if
+// it has changed.  Usage is
+// the cached total, plus the changes this daemon has made since the cache
+// was read.  So quota checks cost no system-calls, and see this daemon's
+// own writes right away.  (Other daemons' changes show up once
+// 'marfs_quota -l' has applied their journals.)
+// ---------------------------------------------------------------------------
+
+#ifndef _MARFS_LEDGER_H
+#define _MARFS_LEDGER_H
+
+#include "marfs_base.h"        // MarFS_Namespace (either config)
+
+#include <stdint.h>
+
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif
+
+
+#define LEDGER_JOURNAL_SUFFIX   ".delta"
+#define LEDGER_SUFFIX           ".ledger"
+
+// one journal line:  <bytes> <names>
+#define LEDGER_JOURNAL_FORMAT   "%lld %lld\n"
+
+// ledger file
+#define LEDGER_FORMAT           "bytes: %lld\nnames: %lld\n"
+
+// may be overridden at compile-time
+#ifndef LEDGER_FLUSH_SECS
+#  define LEDGER_FLUSH_SECS     10
+#endif
+#ifndef LEDGER_REFRESH_SECS
+#  define LEDGER_REFRESH_SECS   10
+#endif
+
+#define LEDGER_NS_MAX           256
+
+
+// Open <ns>'s journal.  Called from init_mdfs(), before fuse starts.
+extern int  ledger_open(MarFS_Namespace* ns);
+
+// Record a change in <ns>'s usage
+extern void ledger_delta(const MarFS_Namespace* ns,
+                         int64_t bytes, int64_t names);
+
+// Write all pending deltas to the journals (e.g. at shutdown)
+extern void ledger_flush_all();
+
+// Current usage of <ns>, from the cache.  <names> is -1 if only fsinfo
+// was available (no ledger yet).  Returns -1 if there's no cached usage.
+extern int  ledger_usage(const MarFS_Namespace* ns,
+                         int64_t* bytes, int64_t* names);
+
+// Total usage and limits of all namespaces with cached usage (e.g. for the
+// root NS).  A limit is -1 if any namespace is unlimited, and <names> is
+// -1 if any namespace has no ledger.  Returns -1 if there are none.
+extern int  ledger_usage_all(int64_t* bytes,       int64_t* names,
+                             int64_t* space_limit, int64_t* names_limit);
+
+
+#  ifdef __cplusplus
+}
+#  endif
+
+
+#endif // _MARFS_LEDGER_H
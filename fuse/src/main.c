@@ -73,6 +73,8 @@ OF SUCH DAMAGE.
 #include "common.h"
 #include "marfs_base.h"
 #include "marfs_ops.h"
+#include "stat_cache.h"
+#include "ledger.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -85,6 +87,7 @@ OF SUCH DAMAGE.
 #include <utime.h>              /* for deprecated marfs_utime() */
 #include <stdio.h>
 #include <time.h>
+#include <stddef.h>             /* offsetof() */
 
 // #include "marfs_fuse.h"
 #define FUSE_USE_VERSION 26
@@ -103,117 +106,14 @@ OF SUCH DAMAGE.
    ENTRY();                                                             \
    uid_t saved_euid = -1;                                               \
    gid_t saved_egid = -1;                                               \
-   __TRY0(push_user, &saved_euid, &saved_egid)
+   __TRY0(push_user, &saved_euid, &saved_egid,                          \
+          fuse_get_context()->uid, fuse_get_context()->gid)
 
 #define POP_USER()                                                      \
    __TRY0(pop_user, &saved_euid, &saved_egid);                          \
    EXIT()
 
 
-// push_user()
-//
-//   Save current user info from syscall into saved_user
-//   Set userid to requesting user (in fuse request structure)
-//   return 0/negative for success/error
-//
-// NOTE: setuid() doesn't allow returning to priviledged user, from
-//       unpriviledged-user.  For that, we apparently need the (BSD)
-//       seteuid().
-//
-// NOTE: If seteuid() fails, and the problem is that we lack privs to call
-//       seteuid(), this means *we* are running unpriviledged.  This could
-//       happen if we're testing the FUSE mount as a non-root user.  In
-//       this case, the <uid> argument should be the same as the <uid> of
-//       the FUSE process, which we can extract from the fuse_context.
-//       [We try the seteuid() first, for speed]
-//
-int push_user(uid_t* saved_euid, gid_t* saved_egid) {
-#if (_BSD_SOURCE || _POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600)
-   //   fuse_context* ctx = fuse_get_context();
-   //   if (ctx->flags & PUSHED_USER) {
-   //      LOG(LOG_ERR, "push_user -- already pushed!\n");
-   //      return;
-   //   }
-   int rc;
-
-   *saved_egid = getegid();
-   gid_t new_gid = fuse_get_context()->gid;
-   LOG(LOG_INFO, "user %ld (egid %ld) -> (egid %ld) ...\n",
-       (size_t)getgid(), (size_t)*saved_egid, (size_t)new_gid);
-   rc = setegid(new_gid);
-   if (rc == -1) {
-      if ((errno == EACCES) && (new_gid == getgid())) {
-         LOG(LOG_INFO, "failed (but okay)\n");
-         return 0;              /* okay [see NOTE] */
-      }
-      else {
-         LOG(LOG_ERR, "failed!\n");
-         return -1;
-      }
-   }
-
-   *saved_euid = geteuid();
-   uid_t new_uid = fuse_get_context()->uid;
-   LOG(LOG_INFO, "user %ld (euid %ld) -> (euid %ld) ...\n",
-       (size_t)getuid(), (size_t)*saved_euid, (size_t)new_uid);
-   rc = seteuid(new_uid);
-   if (rc == -1) {
-      if ((errno == EACCES) && (new_uid == getuid())) {
-         LOG(LOG_INFO, "failed (but okay)\n");
-         return 0;              /* okay [see NOTE] */
-      }
-      else {
-         LOG(LOG_ERR, "failed!\n");
-         return -1;
-      }
-   }
-
-   return 0;
-#else
-#  error "No support for seteuid()/setegid()"
-#endif
-}
-
-
-//  pop_user() changes the effective UID.  Here, we revert to the
-//  "real" UID.
-int pop_user(uid_t* saved_euid, gid_t* saved_egid) {
-#if (_BSD_SOURCE || _POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600)
-   int rc;
-
-   uid_t  new_uid = *saved_euid;
-   rc = seteuid(new_uid);
-   if (rc == -1) {
-      if ((errno == EACCES) && (new_uid == getuid()))
-         return 0;              /* okay [see NOTE] */
-      else {
-         LOG(LOG_ERR,
-             "pop_user -- user %ld (euid %ld) failed seteuid(%ld)!\n",
-             (size_t)getuid(), (size_t)geteuid(), (size_t)new_uid);
-         return -1;
-      }
-   }
-
-   gid_t  new_gid = *saved_egid;
-   rc = setegid(new_gid);
-   if (rc == -1) {
-      if ((errno == EACCES) && (new_gid == getgid()))
-         return 0;              /* okay [see NOTE] */
-      else {
-         LOG(LOG_ERR,
-             "pop_user -- user %ld (egid %ld) failed setegid(%ld)!\n",
-             (size_t)getgid(), (size_t)getegid(), (size_t)new_gid);
-         return -1;
-      }
-   }
-
-   return 0;
-#else
-#  error "No support for seteuid()/setegid()"
-#endif
-}
-
-
 // --- wrappers just call the corresponding library-function, to support a
 //     given fuse-function.  The library-functions are meant to be used by
 //     both fuse and pftool, so they don't do seteuid(), and don't expect
@@ -240,6 +140,22 @@ int pop_user(uid_t* saved_euid, gid_t* saved_egid) {
    return fncall_rc /* caller provides semi */
 
 
+// Same as WRAP(), but also drops cached stat-info (see stat_cache.h) that
+// the op may have changed.  We invalidate even if the op failed, because
+// it may have failed part-way through.
+#define WRAP_INVAL(PATH, HOW, FNCALL)                  \
+   PUSH_USER();                                        \
+   int fncall_rc = FNCALL;                             \
+   stat_cache_invalidate((PATH), (HOW));               \
+   POP_USER();                                         \
+   if (fncall_rc < 0) {                                \
+      LOG(LOG_ERR, "ERR %s, errno=%d '%s'\n",          \
+          #FNCALL, errno, strerror(errno));            \
+      return -errno;                                   \
+   }                                                   \
+   return fncall_rc /* caller provides semi */
+
+
 
 
 // ---------------------------------------------------------------------------
@@ -266,6 +182,7 @@ void marfs_fuse_exit (void* private_data) {
    // daemon exits. I suppose they wait for all threads to finish before
    // leaving, so this should be ok.
    LOG(LOG_INFO, "shutting down\n");
+   ledger_flush_all();
 }
 
 
@@ -308,7 +225,8 @@ int fuse_access (const char* path,
 int fuse_chmod(const char* path,
                mode_t      mode) {
 
-   WRAP( marfs_chmod(path, mode) );
+   // on a directory, this can change access to everything below it
+   WRAP_INVAL( path, SCI_ALL, marfs_chmod(path, mode) );
 }
 
 
@@ -316,7 +234,7 @@ int fuse_chown (const char* path,
                 uid_t       uid,
                 gid_t       gid) {
 
-   WRAP( marfs_chown(path, uid, gid) );
+   WRAP_INVAL( path, SCI_ALL, marfs_chown(path, uid, gid) );
 }
 
 // int fuse_close()   --->  it's called "fuse_release()".
@@ -362,15 +280,35 @@ int fuse_ftruncate(const char*            path,
                    off_t                  length,
                    struct fuse_file_info* ffi) {
 
-   WRAP( marfs_ftruncate(path, length, (MarFS_FileHandle*)ffi->fh) );
+   WRAP_INVAL( path, SCI_PATH, marfs_ftruncate(path, length, (MarFS_FileHandle*)ffi->fh) );
 }
 
 
 // This is "stat()"
+//
+// Results are kept in the stat-cache (see stat_cache.h).  Errors
+// (e.g. ENOENT) are not cached.
 int fuse_getattr (const char*  path,
                   struct stat* stp) {
 
-   WRAP( marfs_getattr(path, stp) );
+   uid_t          uid = fuse_get_context()->uid;
+   gid_t          gid = fuse_get_context()->gid;
+   StatCacheToken tok;
+
+   if (stat_cache_get(path, uid, gid, stp, &tok))
+      return 0;
+
+   PUSH_USER();
+   int fncall_rc = marfs_getattr(path, stp);
+   POP_USER();
+   if (fncall_rc < 0) {
+      LOG(LOG_INFO, "ERR marfs_getattr(%s), errno=%d '%s'\n",
+          path, errno, strerror(errno));
+      return -errno;
+   }
+
+   stat_cache_put(path, uid, gid, stp, &tok);
+   return fncall_rc;
 }
 
 
@@ -419,7 +357,7 @@ int fuse_listxattr (const char* path,
 int fuse_mkdir (const char* path,
                 mode_t      mode) {
 
-   WRAP( marfs_mkdir(path, mode) );
+   WRAP_INVAL( path, SCI_PARENT, marfs_mkdir(path, mode) );
 }
 
 
@@ -439,7 +377,7 @@ int fuse_mknod (const char* path,
                 mode_t      mode,
                 dev_t       rdev) {
 
-   WRAP( marfs_mknod(path, mode, rdev) );
+   WRAP_INVAL( path, SCI_PARENT, marfs_mknod(path, mode, rdev) );
 }
 
 
@@ -490,12 +428,12 @@ int fuse_mknod (const char* path,
 
 
 // NOTE: stream_open() assumes the OS is in a pristine state.  fuse_open()
-//       currently always allocates a fresh OS (inside the new FileHandle),
+//       gets its FileHandle from alloc_filehandle(), which recycles
+//       handles released by fuse_release(), but wipes them clean first,
 //       so that assumption is safe.  stream_close() doesn't wipe
 //       everything clean, because we want some of that info (e.g. how much
-//       data was written).  If you decide to start reusing FileHandles,
-//       you should probably (a) assure they have been flushed/closed, and
-//       (b) wipe them clean.  [See fuse_read(), which now performs a
+//       data was written), so handles must only go back to the free-list
+//       after marfs_release().  [See fuse_read(), which now performs a
 //       distinct S3 request for every call, and reuses the ObjectStream
 //       inside the FileHandle.]
 int fuse_open (const char*            path,
@@ -508,7 +446,7 @@ int fuse_open (const char*            path,
       LOG(LOG_ERR, "unexpected non-NULL file-handle\n");
       return -EINVAL;
    }
-   if (! (ffi->fh = (uint64_t) calloc(1, sizeof(MarFS_FileHandle)))) {
+   if (! (ffi->fh = (uint64_t) alloc_filehandle())) {
       LOG(LOG_ERR, "couldn't allocate a MarFS_FileHandle\n");
       return -ENOMEM;
    }
@@ -516,9 +454,11 @@ int fuse_open (const char*            path,
 
    rc_ssize = marfs_open(path, fh, ffi->flags, 0); /* content-length unknown */
    if (rc_ssize < 0) {
-      free(fh);
+      free_filehandle(fh);
       ffi->fh = 0;
    }
+   if ((ffi->flags & O_ACCMODE) != O_RDONLY)
+      stat_cache_invalidate(path, SCI_PATH);
 
    POP_USER();
    if (rc_ssize)
@@ -577,13 +517,46 @@ int fuse_read (const char*            path,
 }
 
 
+// marfs_readdir() returns attributes along with names.  The high-level
+// fuse API doesn't hand those to the kernel as readdirplus, so we also
+// stash them in the stat-cache, where the getattr that 'ls -l' makes
+// right after the readdir will find them.  (See stat_cache_prime().)
+typedef struct {
+   void*            buf;
+   fuse_fill_dir_t  filler;
+   const char*      dir_path;     // "" for "/", to avoid "//name"
+   uid_t            uid;
+   gid_t            gid;
+} ReaddirContext;
+
+static int readdir_filler(void*              ctx_ptr,
+                          const char*        name,
+                          const struct stat* st,
+                          off_t              off) {
+   ReaddirContext* ctx = (ReaddirContext*)ctx_ptr;
+
+   if (st) {
+      char path[MARFS_MAX_MD_PATH];
+      int  prt_count = snprintf(path, MARFS_MAX_MD_PATH, "%s/%s", ctx->dir_path, name);
+      if ((prt_count > 0) && (prt_count < MARFS_MAX_MD_PATH))
+         stat_cache_prime(path, ctx->uid, ctx->gid, st);
+   }
+   return ctx->filler(ctx->buf, name, st, off);
+}
+
 int fuse_readdir (const char*            path,
                   void*                  buf,
                   fuse_fill_dir_t        filler,
                   off_t                  offset,
                   struct fuse_file_info* ffi) {
 
-   WRAP( marfs_readdir(path, buf, (marfs_fill_dir_t)filler, offset, (MarFS_DirHandle*)ffi->fh) );
+   ReaddirContext ctx = { .buf      = buf,
+                          .filler   = filler,
+                          .dir_path = (strcmp(path, "/") ? path : ""),
+                          .uid      = fuse_get_context()->uid,
+                          .gid      = fuse_get_context()->gid };
+
+   WRAP( marfs_readdir(path, &ctx, (marfs_fill_dir_t)readdir_filler, offset, (MarFS_DirHandle*)ffi->fh) );
 }
 
 
@@ -643,7 +616,9 @@ int fuse_release (const char*            path,
    MarFS_FileHandle* fh = (MarFS_FileHandle*)ffi->fh; /* shorthand */
 
    rc_ssize = marfs_release(path, fh);
-   free(fh);
+   if (fh->flags & FH_WRITING)
+      stat_cache_invalidate(path, SCI_PATH); /* size was just fixed up */
+   free_filehandle(fh);
    ffi->fh = 0;
 
    POP_USER();
@@ -697,21 +672,22 @@ int fuse_releasedir (const char*            path,
 int fuse_removexattr (const char* path,
                       const char* name) {
 
-   WRAP( marfs_removexattr(path, name) );
+   WRAP_INVAL( path, SCI_PATH, marfs_removexattr(path, name) );
 }
 
 
+// <path> might be a directory, so any cached path below it is now wrong
 int fuse_rename (const char* path,
                  const char* to) {
 
-   WRAP( marfs_removexattr(path, to) );
+   WRAP_INVAL( path, SCI_ALL, marfs_rename(path, to) );
 }
 
 
 // using looked up mdpath, do statxattr and get object name
 int fuse_rmdir (const char* path) {
 
-   WRAP( marfs_rmdir(path) );
+   WRAP_INVAL( path, SCI_PARENT, marfs_rmdir(path) );
 }
 
 
@@ -721,7 +697,7 @@ int fuse_setxattr (const char* path,
                    size_t      size,
                    int         flags) {
 
-   WRAP( marfs_setxattr(path, name, value, size, flags) );
+   WRAP_INVAL( path, SCI_PATH, marfs_setxattr(path, name, value, size, flags) );
 }
 
 // The OS seems to call this from time to time, with <path>=/ (and
@@ -744,7 +720,7 @@ int fuse_statfs (const char*      path,
 int fuse_symlink (const char* target,
                   const char* linkname) {
 
-   WRAP( marfs_symlink(target, linkname) );
+   WRAP_INVAL( linkname, SCI_PARENT, marfs_symlink(target, linkname) );
 }
 
 
@@ -752,13 +728,13 @@ int fuse_symlink (const char* target,
 int fuse_truncate (const char* path,
                    off_t       size) {
 
-   WRAP( marfs_truncate(path, size) );
+   WRAP_INVAL( path, SCI_PATH, marfs_truncate(path, size) );
 }
 
 
 int fuse_unlink (const char* path) {
 
-   WRAP( marfs_unlink(path) );
+   WRAP_INVAL( path, SCI_PARENT, marfs_unlink(path) );
 }
 
 // deprecated in 2.6
@@ -767,7 +743,7 @@ int fuse_unlink (const char* path) {
 int fuse_utime(const char*     path,
                struct utimbuf* buf) {   
 
-   WRAP( marfs_utime(path, buf) );
+   WRAP_INVAL( path, SCI_PATH, marfs_utime(path, buf) );
 }
 
 // System is giving us timestamps that should be applied to the path.
@@ -775,7 +751,7 @@ int fuse_utime(const char*     path,
 int fuse_utimens(const char*           path,
                  const struct timespec tv[2]) {   
 
-   WRAP( marfs_utimens(path, tv) );
+   WRAP_INVAL( path, SCI_PATH, marfs_utimens(path, tv) );
 }
 
 
@@ -805,7 +781,7 @@ int fuse_write(const char*            path,
    if (wk_size == (128 * 1024))
       wk_size -= 96;
 
-   WRAP( marfs_write(path, buf, wk_size, offset, (MarFS_FileHandle*)ffi->fh) );
+   WRAP_INVAL( path, SCI_PATH, marfs_write(path, buf, wk_size, offset, (MarFS_FileHandle*)ffi->fh) );
 #endif
 }
 
@@ -955,6 +931,20 @@ int fuse_poll(const char*             path,
 // ---------------------------------------------------------------------------
 
 
+// marfs-specific "-o" options.  fuse_opt_parse() strips these out of the
+// command-line before it is handed to fuse_main().  Other "-o" options
+// (e.g. attr_timeout, entry_timeout) are passed through to fuse.
+typedef struct {
+   double   stat_cache_ttl;     // seconds.  0 disables stat-cache
+} MarFS_FuseOpts;
+
+static struct fuse_opt marfs_fuse_opts[] = {
+   { "stat_cache_ttl=%lf", offsetof(MarFS_FuseOpts, stat_cache_ttl), 0 },
+   FUSE_OPT_END
+};
+
+
+
 int main(int argc, char* argv[])
 {
    TRY_DECLS();
@@ -963,6 +953,13 @@ int main(int argc, char* argv[])
    LOG(LOG_INFO, "\n");
    LOG(LOG_INFO, "=== FUSE starting\n");
 
+   struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+   MarFS_FuseOpts   opts = { .stat_cache_ttl = STAT_CACHE_TTL_DEFAULT };
+   if (fuse_opt_parse(&args, &opts, marfs_fuse_opts, NULL) == -1) {
+      LOG(LOG_ERR, "fuse_opt_parse() failed.  Quitting\n");
+      return -1;
+   }
+
    // Not sure why, but I've seen machines where I'm logged in as root, and
    // I run fuse in the background, and the process has an euid of some other user.
    // This fixes that.
@@ -1036,6 +1033,8 @@ int main(int argc, char* argv[])
    // plus a storage "scatter-tree" for any semi-direct repos.
    __TRY0(init_mdfs);
 
+   __TRY0(stat_cache_init, opts.stat_cache_ttl);
+
    // function-pointers used by fuse, to dispatch calls to our handlers.
    struct fuse_operations marfs_oper = {
       .init        = marfs_fuse_init,
@@ -1086,5 +1085,5 @@ int main(int argc, char* argv[])
 #endif
    };
 
-   return fuse_main(argc, argv, &marfs_oper, NULL);
+   return fuse_main(args.argc, args.argv, &marfs_oper, NULL);
 }
@@ -0,0 +1,1189 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// ---------------------------------------------------------------------------
+// Low-level (inode-based) fuse front-end
+//
+// main.c uses the high-level fuse API, where libfuse maintains its own
+// inode table, rebuilds the full path for every callback, and hands us
+// path strings.  This is an alternative front-end, using the fuse
+// low-level API, where the kernel talks to us in terms of node-IDs.  It
+// calls the same marfs_*() ops as main.c, so behavior should be the same.
+//
+// Each node-ID we give to the kernel is the address of an LLNode, which
+// caches the marfs path of the entry.  An op on an existing node just
+// copies that path, instead of having libfuse walk the tree to rebuild it.
+// Nodes live until the kernel forgets them.  A rename updates the cached
+// path of the renamed node and everything below it.
+//
+// NOTE: We cache paths rather than O_PATH fds or name_to_handle_at()
+//     handles, because the marfs_*() ops (and everything under them:
+//     expand_path_info(), xattrs, the trash, etc) are path-based, and we
+//     want to share them with pftool.
+//
+// NOTE: Unlike main.c, kernel attribute/entry timeouts are set by us, in
+//     each reply.  See "-o attr_timeout=SECS" and "-o entry_timeout=SECS".
+//
+// Build with 'make fuse.ll'.  Mount the same way as marfs_fuse.
+// ---------------------------------------------------------------------------
+
+
+#include "common.h"
+#include "marfs_base.h"
+#include "marfs_ops.h"
+#include "ledger.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>             /* offsetof() */
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define FUSE_USE_VERSION 26
+#include <fuse_lowlevel.h>
+
+
+
+// ---------------------------------------------------------------------------
+// node table
+// ---------------------------------------------------------------------------
+
+typedef struct LLNode {
+   struct LLNode*  hash_next;
+   uint64_t        nlookup;     // kernel references.  (See ll_forget())
+   char*           path;        // marfs path, e.g. "/ns/dir/file"
+   int             stale;       // detached from <path>  (see ll_detach_node())
+} LLNode;
+
+#define LL_HASH_BUCKETS  65536  /* power of 2 */
+
+static LLNode*           ll_hash[LL_HASH_BUCKETS];
+static LLNode            ll_root = { .path = "/" };   // FUSE_ROOT_ID
+static pthread_rwlock_t  ll_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static double            ll_attr_timeout  = 1.0;
+static double            ll_entry_timeout = 1.0;
+
+
+// FNV-1a
+static uint32_t ll_bucket(const char* path) {
+   uint32_t hash = 2166136261u;
+   const unsigned char* ptr;
+   for (ptr=(const unsigned char*)path; *ptr; ++ptr) {
+      hash ^= *ptr;
+      hash *= 16777619u;
+   }
+   return hash & (LL_HASH_BUCKETS -1);
+}
+
+static LLNode* ll_node(fuse_ino_t ino) {
+   return ((ino == FUSE_ROOT_ID) ? &ll_root : (LLNode*)(uintptr_t)ino);
+}
+
+// Copy the cached path for <ino> into <path>.  A stale node's path now
+// names some other file (or nothing), so only ops that go through an open
+// handle may use it.
+static int ll_copy_path(fuse_ino_t ino, char* path, int stale_ok) {
+   int rc = 0;
+
+   pthread_rwlock_rdlock(&ll_lock);
+   LLNode*     node      = ll_node(ino);
+   const char* node_path = node->path;
+   if (node->stale && ! stale_ok)
+      rc = ESTALE;
+   else if (strlen(node_path) >= MARFS_MAX_MD_PATH)
+      rc = ENAMETOOLONG;
+   else
+      strcpy(path, node_path);
+   pthread_rwlock_unlock(&ll_lock);
+
+   return rc;
+}
+
+// for ops that act on the file by name
+static int ll_path(fuse_ino_t ino, char* path) {
+   return ll_copy_path(ino, path, 0);
+}
+
+// for ops on an open handle, which still work after unlink
+static int ll_fh_path(fuse_ino_t ino, char* path) {
+   return ll_copy_path(ino, path, 1);
+}
+
+// build the path of <name> in the directory <parent>
+static int ll_child_path(fuse_ino_t parent, const char* name, char* path) {
+   int rc = 0;
+
+   pthread_rwlock_rdlock(&ll_lock);
+   LLNode*     node = ll_node(parent);
+   const char* dir  = node->path;
+   if (node->stale)
+      rc = ESTALE;
+   else {
+      int prt_count = snprintf(path, MARFS_MAX_MD_PATH, "%s/%s",
+                               (strcmp(dir, "/") ? dir : ""), name);
+      if ((prt_count < 0) || (prt_count >= MARFS_MAX_MD_PATH))
+         rc = ENAMETOOLONG;
+   }
+   pthread_rwlock_unlock(&ll_lock);
+
+   return rc;
+}
+
+// find-or-create the node for <path>, and add a kernel reference
+static LLNode* ll_lookup_node(const char* path) {
+   if (! strcmp(path, "/")) {
+      __sync_add_and_fetch(&ll_root.nlookup, 1);
+      return &ll_root;
+   }
+
+   uint32_t bucket = ll_bucket(path);
+   LLNode*  node;
+
+   pthread_rwlock_wrlock(&ll_lock);
+   for (node=ll_hash[bucket]; node; node=node->hash_next) {
+      if (! strcmp(node->path, path))
+         break;
+   }
+   if (! node) {
+      node = (LLNode*)calloc(1, sizeof(LLNode));
+      if (node && ! (node->path = strdup(path))) {
+         free(node);
+         node = NULL;
+      }
+      if (node) {
+         node->hash_next = ll_hash[bucket];
+         ll_hash[bucket] = node;
+      }
+   }
+   if (node)
+      node->nlookup += 1;
+   pthread_rwlock_unlock(&ll_lock);
+
+   return node;
+}
+
+static void ll_forget_node(LLNode* node, uint64_t nlookup) {
+   if (node == &ll_root)
+      return;
+
+   pthread_rwlock_wrlock(&ll_lock);
+   node->nlookup -= ((nlookup > node->nlookup) ? node->nlookup : nlookup);
+   if (! node->nlookup) {
+      if (! node->stale) {
+         LLNode** pp = &ll_hash[ll_bucket(node->path)];
+         while (*pp && (*pp != node))
+            pp = &(*pp)->hash_next;
+         if (*pp)
+            *pp = node->hash_next;
+      }
+      free(node->path);
+      free(node);
+   }
+   pthread_rwlock_unlock(&ll_lock);
+}
+
+// Take the node for <path> out of the table.  Caller holds the write-lock.
+static void ll_detach_locked(const char* path) {
+   LLNode** pp = &ll_hash[ll_bucket(path)];
+   while (*pp && strcmp((*pp)->path, path))
+      pp = &(*pp)->hash_next;
+   if (*pp) {
+      LLNode* node    = *pp;
+      *pp             = node->hash_next;
+      node->hash_next = NULL;
+      node->stale     = 1;
+   }
+}
+
+// After unlink or rmdir, the kernel may still hold the old inode (e.g.
+// through an open fd), until it sends a forget.  Detach the node from its
+// path, so a new file with the same name gets a new node, and lookups by
+// the old inode fail with ESTALE, rather than act on the new file.
+static void ll_detach_node(const char* path) {
+   pthread_rwlock_wrlock(&ll_lock);
+   ll_detach_locked(path);
+   pthread_rwlock_unlock(&ll_lock);
+}
+
+// After a successful rename, every node at or below <from> moves to the
+// corresponding spot below <to>.  Rename is rare enough that walking the
+// whole table is okay.  If allocation fails, the node keeps its old path,
+// and subsequent ops on it will fail with ENOENT, until the kernel
+// looks it up again.
+static void ll_rename_nodes(const char* from, const char* to) {
+   size_t   from_len = strlen(from);
+   size_t   to_len   = strlen(to);
+   LLNode*  moved    = NULL;
+   uint32_t i;
+
+   if (! strcmp(from, to))
+      return;
+
+   pthread_rwlock_wrlock(&ll_lock);
+
+   // anything that was at <to> has been replaced  (see ll_detach_node())
+   ll_detach_locked(to);
+
+   // pull out the affected nodes, because their hash-buckets will change
+   for (i=0; i<LL_HASH_BUCKETS; ++i) {
+      LLNode** pp = &ll_hash[i];
+      while (*pp) {
+         LLNode* node = *pp;
+         if (! strncmp(node->path, from, from_len)
+             && ((node->path[from_len] == 0) || (node->path[from_len] == '/'))) {
+            *pp             = node->hash_next;
+            node->hash_next = moved;
+            moved           = node;
+         }
+         else
+            pp = &node->hash_next;
+      }
+   }
+
+   // fix their paths, and put them back
+   while (moved) {
+      LLNode* node   = moved;
+      size_t  suffix = strlen(node->path) - from_len;
+      char*   path   = (char*)malloc(to_len + suffix +1);
+      moved = node->hash_next;
+
+      if (path) {
+         memcpy(path, to, to_len);
+         memcpy(path + to_len, node->path + from_len, suffix +1);
+         free(node->path);
+         node->path = path;
+      }
+      else
+         LOG(LOG_ERR, "couldn't allocate renamed path for '%s'\n", node->path);
+
+      uint32_t bucket = ll_bucket(node->path);
+      node->hash_next = ll_hash[bucket];
+      ll_hash[bucket] = node;
+   }
+
+   pthread_rwlock_unlock(&ll_lock);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// utilities
+// ---------------------------------------------------------------------------
+
+// Same idea as PUSH_USER()/POP_USER() in main.c, but low-level callbacks
+// return void, and must always send a reply.
+#define LL_PUSH_USER(REQ)                                               \
+   uid_t saved_euid = -1;                                               \
+   gid_t saved_egid = -1;                                               \
+   if (push_user(&saved_euid, &saved_egid,                              \
+                 fuse_req_ctx(REQ)->uid, fuse_req_ctx(REQ)->gid)) {     \
+      fuse_reply_err((REQ), (errno ? errno : EPERM));                   \
+      return;                                                           \
+   }
+
+// preserves errno from the op
+#define LL_POP_USER()                                                   \
+   do {                                                                 \
+      int saved_errno = errno;                                          \
+      if (pop_user(&saved_euid, &saved_egid))                           \
+         LOG(LOG_ERR, "pop_user failed\n");                             \
+      errno = saved_errno;                                              \
+   } while (0)
+
+// For release-style paths, which must finish (and free) whether or not we
+// can become the user.  Doesn't reply or return.  <PUSHED> is non-zero if
+// the push succeeded, in which case LL_POP_USER_IF() pops it.
+#define LL_TRY_PUSH_USER(REQ, PUSHED)                                   \
+   uid_t saved_euid = -1;                                               \
+   gid_t saved_egid = -1;                                               \
+   int   PUSHED = ! push_user(&saved_euid, &saved_egid,                 \
+                              fuse_req_ctx(REQ)->uid,                   \
+                              fuse_req_ctx(REQ)->gid);                  \
+   if (! PUSHED)                                                        \
+      LOG(LOG_ERR, "push_user failed: %s\n", strerror(errno))
+
+#define LL_POP_USER_IF(PUSHED)                                          \
+   do {                                                                 \
+      if (PUSHED)                                                       \
+         LL_POP_USER();                                                 \
+   } while (0)
+
+#define LL_PATH(REQ, INO, PATH)                                         \
+   do {                                                                 \
+      int path_rc = ll_path((INO), (PATH));                             \
+      if (path_rc) {                                                    \
+         fuse_reply_err((REQ), path_rc);                                \
+         return;                                                        \
+      }                                                                 \
+   } while (0)
+
+#define LL_FH_PATH(REQ, INO, PATH)                                      \
+   do {                                                                 \
+      int path_rc = ll_fh_path((INO), (PATH));                          \
+      if (path_rc) {                                                    \
+         fuse_reply_err((REQ), path_rc);                                \
+         return;                                                        \
+      }                                                                 \
+   } while (0)
+
+#define LL_CHILD_PATH(REQ, PARENT, NAME, PATH)                          \
+   do {                                                                 \
+      int path_rc = ll_child_path((PARENT), (NAME), (PATH));            \
+      if (path_rc) {                                                    \
+         fuse_reply_err((REQ), path_rc);                                \
+         return;                                                        \
+      }                                                                 \
+   } while (0)
+
+// reply with 0 for success, or errno (left by a failed marfs op)
+#define LL_REPLY_RC(REQ, RC)                                            \
+   fuse_reply_err((REQ), (((RC) < 0) ? (errno ? errno : EIO) : 0))
+
+
+// We read the whole directory (names plus attributes, see marfs_readdir())
+// into a buffer of fuse dirents on the first readdir, then hand out
+// pieces of that buffer, as the kernel asks for them.
+typedef struct {
+   MarFS_DirHandle  dh;
+   fuse_req_t       req;        // only valid while filling
+   char*            buf;
+   size_t           size;
+   int              filled;
+} LLDirHandle;
+
+
+// Reply to lookup/mknod/mkdir/symlink.  Caller has done PUSH_USER.
+static void ll_reply_entry(fuse_req_t req, const char* path) {
+   struct fuse_entry_param e;
+   memset(&e, 0, sizeof(e));
+
+   if (marfs_getattr(path, &e.attr) < 0) {
+      fuse_reply_err(req, (errno ? errno : EIO));
+      return;
+   }
+
+   LLNode* node = ll_lookup_node(path);
+   if (! node) {
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   e.ino           = ((node == &ll_root) ? FUSE_ROOT_ID : (fuse_ino_t)(uintptr_t)node);
+   e.attr_timeout  = ll_attr_timeout;
+   e.entry_timeout = ll_entry_timeout;
+
+   // if the kernel didn't get the reply, it won't send a forget
+   if (fuse_reply_entry(req, &e))
+      ll_forget_node(node, 1);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// inits
+// ---------------------------------------------------------------------------
+
+static void ll_init(void* userdata, struct fuse_conn_info* conn) {
+   conn->max_write = MARFS_WRITEBUF_MAX;
+   conn->want     |= FUSE_CAP_BIG_WRITES;
+
+   // To disable: Set zero here, and clear FUSE_CAP_ASYNC_READ from <want>
+   conn->async_read = 0;
+}
+
+static void ll_destroy(void* userdata) {
+   LOG(LOG_INFO, "shutting down\n");
+   ledger_flush_all();
+}
+
+
+
+// ---------------------------------------------------------------------------
+// Fuse low-level routines in alpha order
+// ---------------------------------------------------------------------------
+
+
+static void ll_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_access(path, mask);
+   LL_POP_USER();
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+   ll_forget_node(ll_node(ino), nlookup);
+   fuse_reply_none(req);
+}
+
+
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                     struct fuse_file_info* fi) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_FH_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_fsync(path, datasync, (MarFS_FileHandle*)fi->fh);
+   LL_POP_USER();
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                        struct fuse_file_info* fi) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_FH_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_fsyncdir(path, datasync, &((LLDirHandle*)fi->fh)->dh);
+   LL_POP_USER();
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+   char        path[MARFS_MAX_MD_PATH];
+   struct stat st;
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_getattr(path, &st);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_attr(req, &st, ll_attr_timeout);
+}
+
+
+// size==0 means the caller wants to know how big a buffer to provide
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char* name,
+                        size_t size) {
+   char  path[MARFS_MAX_MD_PATH];
+   char* value = NULL;
+   LL_PATH(req, ino, path);
+
+   if (size && ! (value = (char*)malloc(size))) {
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   LL_PUSH_USER(req);
+   int rc = marfs_getxattr(path, name, value, size);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else if (! size)
+      fuse_reply_xattr(req, rc);
+   else
+      fuse_reply_buf(req, value, rc);
+   free(value);
+}
+
+
+// Only restricted ioctls (see MARFS_IOC_*, in marfs_ops.h).  The kernel
+// tells us how big the output buffer is, from the command.
+static void ll_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void* arg,
+                     struct fuse_file_info* fi, unsigned flags,
+                     const void* in_buf, size_t in_bufsz, size_t out_bufsz) {
+   char  path[MARFS_MAX_MD_PATH];
+   char* out = NULL;
+   LL_PATH(req, ino, path);
+   LL_PUSH_USER(req);
+
+   // in_buf is only for _IOW commands, and we don't have any yet.
+   if (out_bufsz && ! (out = (char*)calloc(1, out_bufsz))) {
+      LL_POP_USER();
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   // opendir gives us an LLDirHandle, not a MarFS_FileHandle
+   MarFS_FileHandle* fh = ((flags & FUSE_IOCTL_DIR)
+                           ? NULL
+                           : (MarFS_FileHandle*)fi->fh);
+
+   int rc = marfs_ioctl(path, cmd, arg, fh, flags, out);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_ioctl(req, rc, out, out_bufsz);
+   free(out);
+}
+
+
+static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
+   char  path[MARFS_MAX_MD_PATH];
+   char* list = NULL;
+   LL_PATH(req, ino, path);
+
+   if (size && ! (list = (char*)malloc(size))) {
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   LL_PUSH_USER(req);
+   int rc = marfs_listxattr(path, list, size);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else if (! size)
+      fuse_reply_xattr(req, rc);
+   else
+      fuse_reply_buf(req, list, rc);
+   free(list);
+}
+
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent, name, path);
+
+   LL_PUSH_USER(req);
+   ll_reply_entry(req, path);
+   LL_POP_USER();
+}
+
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name,
+                     mode_t mode) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent, name, path);
+
+   LL_PUSH_USER(req);
+   if (marfs_mkdir(path, mode) < 0)
+      LL_REPLY_RC(req, -1);
+   else
+      ll_reply_entry(req, path);
+   LL_POP_USER();
+}
+
+
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char* name,
+                     mode_t mode, dev_t rdev) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent, name, path);
+
+   LL_PUSH_USER(req);
+   if (marfs_mknod(path, mode, rdev) < 0)
+      LL_REPLY_RC(req, -1);
+   else
+      ll_reply_entry(req, path);
+   LL_POP_USER();
+}
+
+
+// [See the NOTE above fuse_open(), in main.c]
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_PATH(req, ino, path);
+   LL_PUSH_USER(req);
+
+   MarFS_FileHandle* fh = alloc_filehandle();
+   if (! fh) {
+      LL_POP_USER();
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   int rc = marfs_open(path, fh, fi->flags, 0); /* content-length unknown */
+   LL_POP_USER();
+
+   if (rc < 0) {
+      LL_REPLY_RC(req, rc);
+      free_filehandle(fh);
+      return;
+   }
+
+   fi->fh        = (uint64_t)fh;
+   fi->direct_io = 1;           /* same as "-o direct_io", with main.c */
+
+   // if the open was interrupted, there will be no release
+   if (fuse_reply_open(req, fi)) {
+      LL_TRY_PUSH_USER(req, pushed);
+      marfs_release(path, fh);
+      LL_POP_USER_IF(pushed);
+      free_filehandle(fh);
+   }
+}
+
+
+static int ll_fill_dir(void*              ctx,
+                       const char*        name,
+                       const struct stat* st,
+                       off_t              off) {
+   LLDirHandle* lldh = (LLDirHandle*)ctx;
+   struct stat  empty;
+
+   if (! st) {
+      memset(&empty, 0, sizeof(empty));
+      st = &empty;
+   }
+
+   size_t old_size = lldh->size;
+   size_t ent_size = fuse_add_direntry(lldh->req, NULL, 0, name, NULL, 0);
+   char*  new_buf  = (char*)realloc(lldh->buf, old_size + ent_size);
+   if (! new_buf)
+      return 1;                 /* stop.  (Kernel gets a short listing) */
+
+   lldh->buf  = new_buf;
+   lldh->size = old_size + ent_size;
+   fuse_add_direntry(lldh->req, lldh->buf + old_size, ent_size,
+                     name, st, lldh->size);
+   return 0;
+}
+
+
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_PATH(req, ino, path);
+   LL_PUSH_USER(req);
+
+   LLDirHandle* lldh = (LLDirHandle*)calloc(1, sizeof(LLDirHandle));
+   if (! lldh) {
+      LL_POP_USER();
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   int rc = marfs_opendir(path, &lldh->dh);
+   LL_POP_USER();
+
+   if (rc < 0) {
+      LL_REPLY_RC(req, rc);
+      free(lldh);
+      return;
+   }
+
+   fi->fh = (uint64_t)lldh;
+   if (fuse_reply_open(req, fi)) {
+      LL_TRY_PUSH_USER(req, pushed);
+      marfs_releasedir(path, &lldh->dh);
+      LL_POP_USER_IF(pushed);
+      free(lldh->buf);
+      free(lldh);
+   }
+}
+
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                    struct fuse_file_info* fi) {
+   char  path[MARFS_MAX_MD_PATH];
+   LL_FH_PATH(req, ino, path);
+
+   char* buf = (char*)malloc(size);
+   if (! buf) {
+      fuse_reply_err(req, ENOMEM);
+      return;
+   }
+
+   LL_PUSH_USER(req);
+   int rc = marfs_read(path, buf, size, off, (MarFS_FileHandle*)fi->fh);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_buf(req, buf, rc);
+   free(buf);
+}
+
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       struct fuse_file_info* fi) {
+   char         path[MARFS_MAX_MD_PATH];
+   LLDirHandle* lldh = (LLDirHandle*)fi->fh;
+   LL_FH_PATH(req, ino, path);
+
+   if (! lldh->filled) {
+      LL_PUSH_USER(req);
+      lldh->req = req;
+      int rc = marfs_readdir(path, lldh, ll_fill_dir, 0, &lldh->dh);
+      lldh->req = NULL;
+      LL_POP_USER();
+
+      if (rc < 0) {
+         LL_REPLY_RC(req, rc);
+         return;
+      }
+      lldh->filled = 1;
+   }
+
+   if (off < lldh->size) {
+      size_t remain = lldh->size - off;
+      fuse_reply_buf(req, lldh->buf + off, ((remain < size) ? remain : size));
+   }
+   else
+      fuse_reply_buf(req, NULL, 0);
+}
+
+
+static void ll_readlink(fuse_req_t req, fuse_ino_t ino) {
+   char path[MARFS_MAX_MD_PATH];
+   char target[MARFS_MAX_MD_PATH];
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_readlink(path, target, MARFS_MAX_MD_PATH);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_readlink(req, target);
+}
+
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+   char              path[MARFS_MAX_MD_PATH];
+   MarFS_FileHandle* fh = (MarFS_FileHandle*)fi->fh;
+
+   // If we can't get the path, we still need to free the handle.  If we
+   // can't become the user, release as the daemon, rather than leaving the
+   // stream open.
+   int rc = ll_fh_path(ino, path);
+   if (rc) {
+      errno = rc;
+      rc    = -1;
+   }
+   else {
+      LL_TRY_PUSH_USER(req, pushed);
+      rc = marfs_release(path, fh);
+      LL_POP_USER_IF(pushed);
+   }
+   free_filehandle(fh);
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+   char         path[MARFS_MAX_MD_PATH];
+   LLDirHandle* lldh = (LLDirHandle*)fi->fh;
+
+   int rc = ll_fh_path(ino, path);
+   if (rc) {
+      errno = rc;
+      rc    = -1;
+   }
+   else {
+      LL_TRY_PUSH_USER(req, pushed);
+      rc = marfs_releasedir(path, &lldh->dh);
+      LL_POP_USER_IF(pushed);
+   }
+   free(lldh->buf);
+   free(lldh);
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char* name) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_removexattr(path, name);
+   LL_POP_USER();
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+                      fuse_ino_t newparent, const char* newname) {
+   char path[MARFS_MAX_MD_PATH];
+   char to[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent,    name,    path);
+   LL_CHILD_PATH(req, newparent, newname, to);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_rename(path, to);
+   LL_POP_USER();
+
+   if (! rc)
+      ll_rename_nodes(path, to);
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent, name, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_rmdir(path);
+   LL_POP_USER();
+
+   if (! rc)
+      ll_detach_node(path);
+   LL_REPLY_RC(req, rc);
+}
+
+
+// Each attribute is applied with the same marfs op the high-level API
+// would use (chmod, chown, truncate/ftruncate, utimens), then we reply
+// with fresh attributes.
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                       int to_set, struct fuse_file_info* fi) {
+   char        path[MARFS_MAX_MD_PATH];
+   struct stat st;
+   int         rc = 0;
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+
+   if (! rc && (to_set & FUSE_SET_ATTR_MODE))
+      rc = marfs_chmod(path, attr->st_mode);
+
+   if (! rc && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+      rc = marfs_chown(path,
+                       ((to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1),
+                       ((to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1));
+
+   if (! rc && (to_set & FUSE_SET_ATTR_SIZE)) {
+      if (fi && fi->fh)
+         rc = marfs_ftruncate(path, attr->st_size, (MarFS_FileHandle*)fi->fh);
+      else
+         rc = marfs_truncate(path, attr->st_size);
+   }
+
+   if (! rc && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+      struct timespec tv[2];
+      tv[0].tv_nsec = UTIME_OMIT;
+      tv[1].tv_nsec = UTIME_OMIT;
+      if (to_set & FUSE_SET_ATTR_ATIME)
+         tv[0] = attr->st_atim;
+      if (to_set & FUSE_SET_ATTR_MTIME)
+         tv[1] = attr->st_mtim;
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+      if (to_set & FUSE_SET_ATTR_ATIME_NOW)
+         tv[0].tv_nsec = UTIME_NOW;
+      if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+         tv[1].tv_nsec = UTIME_NOW;
+#endif
+      rc = marfs_utimens(path, tv);
+   }
+
+   if (! rc)
+      rc = marfs_getattr(path, &st);
+
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_attr(req, &st, ll_attr_timeout);
+}
+
+
+static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char* name,
+                        const char* value, size_t size, int flags) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_setxattr(path, name, value, size, flags);
+   LL_POP_USER();
+
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+   char           path[MARFS_MAX_MD_PATH];
+   struct statvfs stv;
+   LL_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_statfs(path, &stv);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_statfs(req, &stv);
+}
+
+
+static void ll_symlink(fuse_req_t req, const char* target, fuse_ino_t parent,
+                       const char* name) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent, name, path);
+
+   LL_PUSH_USER(req);
+   if (marfs_symlink(target, path) < 0)
+      LL_REPLY_RC(req, -1);
+   else
+      ll_reply_entry(req, path);
+   LL_POP_USER();
+}
+
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_CHILD_PATH(req, parent, name, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_unlink(path);
+   LL_POP_USER();
+
+   if (! rc)
+      ll_detach_node(path);
+   LL_REPLY_RC(req, rc);
+}
+
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf,
+                     size_t size, off_t off, struct fuse_file_info* fi) {
+   char path[MARFS_MAX_MD_PATH];
+   LL_FH_PATH(req, ino, path);
+
+   LL_PUSH_USER(req);
+   int rc = marfs_write(path, buf, size, off, (MarFS_FileHandle*)fi->fh);
+   LL_POP_USER();
+
+   if (rc < 0)
+      LL_REPLY_RC(req, rc);
+   else
+      fuse_reply_write(req, rc);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// main
+// ---------------------------------------------------------------------------
+
+// marfs-specific "-o" options.  (See NOTE at the top.)
+typedef struct {
+   double   attr_timeout;
+   double   entry_timeout;
+} MarFS_LLOpts;
+
+static struct fuse_opt marfs_ll_opts[] = {
+   { "attr_timeout=%lf",  offsetof(MarFS_LLOpts, attr_timeout),  0 },
+   { "entry_timeout=%lf", offsetof(MarFS_LLOpts, entry_timeout), 0 },
+   FUSE_OPT_END
+};
+
+
+int main(int argc, char* argv[])
+{
+   TRY_DECLS();
+
+   INIT_LOG();
+   LOG(LOG_INFO, "\n");
+   LOG(LOG_INFO, "=== FUSE (low-level) starting\n");
+
+   struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+   MarFS_LLOpts     opts = { .attr_timeout  = ll_attr_timeout,
+                             .entry_timeout = ll_entry_timeout };
+   if (fuse_opt_parse(&args, &opts, marfs_ll_opts, NULL) == -1) {
+      LOG(LOG_ERR, "fuse_opt_parse() failed.  Quitting\n");
+      return -1;
+   }
+   ll_attr_timeout  = opts.attr_timeout;
+   ll_entry_timeout = opts.entry_timeout;
+
+   // The rest of the initialization is the same as in main.c
+   __TRY0(seteuid, 0);
+
+#ifdef STATIC_CONFIG
+   if (read_config("~/marfs.config")) {
+      LOG(LOG_ERR, "load_config() failed.  Quitting\n");
+      return -1;
+   }
+#else
+   if (read_configuration()) {
+      LOG(LOG_ERR, "read_configuration() failed.  Quitting\n");
+      return -1;
+   }
+#endif
+
+   if (validate_config()) {
+      LOG(LOG_ERR, "validate_config() failed.  Quitting\n");
+      return -1;
+   }
+
+   init_xattr_specs();
+
+   aws_init();
+   aws_reuse_connections(1);
+
+#if (DEBUG > 1)
+   aws_set_debug(1);
+#endif
+
+#ifdef USE_SPROXYD
+   int config_fail_ok = 1;
+#else
+   int config_fail_ok = 0;
+#endif
+
+   char* const user_name = (getenv("USER"));
+   if (aws_read_config(user_name)) {
+      LOG(LOG_ERR, "aws-read-config for user '%s' failed\n", user_name);
+      if (! config_fail_ok)
+         exit(1);
+   }
+
+   __TRY0(init_mdfs);
+
+   // function-pointers used by fuse, to dispatch calls to our handlers.
+   struct fuse_lowlevel_ops marfs_ll_oper = {
+      .init        = ll_init,
+      .destroy     = ll_destroy,
+
+      .access      = ll_access,
+      .forget      = ll_forget,
+      .fsync       = ll_fsync,
+      .fsyncdir    = ll_fsyncdir,
+      .getattr     = ll_getattr,
+      .getxattr    = ll_getxattr,
+      .ioctl       = ll_ioctl,
+      .listxattr   = ll_listxattr,
+      .lookup      = ll_lookup,
+      .mkdir       = ll_mkdir,
+      .mknod       = ll_mknod,
+      .open        = ll_open,
+      .opendir     = ll_opendir,
+      .read        = ll_read,
+      .readdir     = ll_readdir,
+      .readlink    = ll_readlink,
+      .release     = ll_release,
+      .releasedir  = ll_releasedir,
+      .removexattr = ll_removexattr,
+      .rename      = ll_rename,
+      .rmdir       = ll_rmdir,
+      .setattr     = ll_setattr,
+      .setxattr    = ll_setxattr,
+      .statfs      = ll_statfs,
+      .symlink     = ll_symlink,
+      .unlink      = ll_unlink,
+      .write       = ll_write,
+   };
+
+   char*                mountpoint;
+   int                  multithreaded;
+   int                  foreground;
+   struct fuse_chan*    ch;
+   struct fuse_session* se;
+   int                  err = -1;
+
+   if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1) {
+      LOG(LOG_ERR, "fuse_parse_cmdline() failed.  Quitting\n");
+      return -1;
+   }
+   if (! (ch = fuse_mount(mountpoint, &args))) {
+      LOG(LOG_ERR, "fuse_mount(%s) failed.  Quitting\n", mountpoint);
+      return -1;
+   }
+
+   se = fuse_lowlevel_new(&args, &marfs_ll_oper, sizeof(marfs_ll_oper), NULL);
+   if (se) {
+      if (fuse_set_signal_handlers(se) != -1) {
+         fuse_session_add_chan(se, ch);
+         fuse_daemonize(foreground);
+
+         err = (multithreaded
+                ? fuse_session_loop_mt(se)
+                : fuse_session_loop(se));
+
+         fuse_remove_signal_handlers(se);
+         fuse_session_remove_chan(ch);
+      }
+      fuse_session_destroy(se);
+   }
+   fuse_unmount(mountpoint, ch);
+   fuse_opt_free_args(&args);
+
+   return (err ? 1 : 0);
+}
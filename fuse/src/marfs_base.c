@@ -732,21 +732,20 @@ int post_2_str(char*                  post_str,
    const int minor = post->config_vers_min;
 
    // putting the md_path into the xattr is really only useful if the marfs
-   // file is in the trash, or is SEMI_DIRECT.  For other types of marfs
-   // files, this md_path will be wrong as soon as the user renames it (or
-   // a parent-directory) to some other path.  Therefore, one would never
-   // want to trust it in those cases.  [Gary thought of an example where
-   // several renames could get the path to point to the wrong file.]
-   // So, let's only write it when it is needed and reliable.
+   // file is in the trash.  For other types of marfs files, this md_path
+   // will be wrong as soon as the user renames it (or a parent-directory)
+   // to some other path.  Therefore, one would never want to trust it in
+   // those cases.  [Gary thought of an example where several renames could
+   // get the path to point to the wrong file.]  So, let's only write it
+   // when it is needed and reliable.
    //
-   // NOTE: Because we use the same xattr-field to point to the semi-direct
-   //     file-system *OR* to the location of the file in the trash, we can
-   //     not currently support moving semi-direct files to the trash.
-   //     Deleting a semi-direct file must just delete it.
-   const char* md_path = ( ((repo->access_method == ACCESSMETHOD_SEMI_DIRECT)
-                            || (post->flags & POST_TRASH))
-                           ? post->md_path
-                           : "");
+   // NOTE: This field was also going to point to the file in the
+   //     semi-direct file-system, which would have kept semi-direct files
+   //     out of the trash.  Now, that path is computed from the object-ID
+   //     (see semi_direct_path()), so they are trashed like any other.
+   const char* md_path = ((post->flags & POST_TRASH)
+                          ? post->md_path
+                          : "");
 
    ssize_t bytes_printed = snprintf(post_str, max_size,
                                     MARFS_POST_FORMAT,
@@ -428,7 +428,7 @@ typedef struct MarFS_XattrPre {
    // uint16_t           shard;        // TBD: for hashing directories across shard-nodes
 
    char               bucket[MARFS_MAX_BUCKET_SIZE];
-   char               objid [MARFS_MAX_OBJID_SIZE]; // not including bucket
+   char               objid [MARFS_MAX_OBJID_SIZE]; // not including bucket (keep last, see init_path_info())
 
 } MarFS_XattrPre;
 
@@ -482,6 +482,7 @@ int update_pre(MarFS_XattrPre* pre);
 
 typedef enum {
    POST_TRASH           = 0x01, // file is in trash?
+   POST_INLINE          = 0x02, // data is in the MDFS file (no object)
 } PostFlags;
 
 typedef uint8_t  PostFlagsType;
@@ -498,8 +499,8 @@ typedef struct MarFS_XattrPost {
    EncryptInfo        encrypt_info;  // any info reqd to decrypt the data
    size_t             chunks;        // (context-dependent.  See NOTE)
    size_t             chunk_info_bytes; // total size of chunk-info in MDFS file (Multi)
-   char               md_path[MARFS_MAX_MD_PATH]; // full path to MDFS file
    PostFlagsType      flags;
+   char               md_path[MARFS_MAX_MD_PATH]; // full path to MDFS file (keep last, see init_path_info())
 } MarFS_XattrPost;
 
 
@@ -596,7 +597,8 @@ int str_2_rec(RecoveryInfo* rec_info, const char* rec_info_str); // from string
 // on to the next one.  Therefore, for any offset into the user-data, we
 // can compute the name of the object containing that data.  If something
 // fails during a write, and the write is restarted, we start over from
-// scratch, and all previous progress is trashed.
+// scratch, and all previous progress is trashed.  (Before giving up,
+// fuse re-sends a failed chunk a few times.  See resume_put().)
 //
 // However, pftool wants the ability to restart a large copy, picking up
 // where it left off.  It also may do an N:1 style of write, so chunks may
@@ -175,7 +175,13 @@ typedef enum {
    ACCESSMETHOD_S3_EMC,                // should include installed release version
 } MarFS_AccessMethod;
 
-#define ACCESSMETHOD_IS_S3(ACCESSMETHOD)  ((ACCESSMETHOD) & (ACCESSMETHOD_S3 | ACCESSMETHOD_S3_SCALITY | ACCESSMETHOD_S3_EMC | ACCESSMETHOD_SPROXYD))
+// NOTE: These aren't bit-flags, so OR-ing them into a mask would match
+//     every non-DIRECT method (including SEMI_DIRECT).
+#define ACCESSMETHOD_IS_S3(ACCESSMETHOD)           \
+   (   ((ACCESSMETHOD) == ACCESSMETHOD_S3)         \
+    || ((ACCESSMETHOD) == ACCESSMETHOD_S3_SCALITY) \
+    || ((ACCESSMETHOD) == ACCESSMETHOD_S3_EMC)     \
+    || ((ACCESSMETHOD) == ACCESSMETHOD_SPROXYD))
 
 
 
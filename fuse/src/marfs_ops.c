@@ -72,6 +72,10 @@ OF SUCH DAMAGE.
 
 #include "common.h"
 #include "marfs_ops.h"
+#include "latency.h"
+#include "io_stats.h"
+#include "purge.h"
+#include "ledger.h"
 
 /*
 @@@-HTTPS:
@@ -94,6 +98,7 @@ include the files on which a code unit depends.
 #include <string.h>
 #include <utime.h>              /* for deprecated marfs_utime() */
 #include <stdio.h>
+#include <limits.h>             /* NAME_MAX */
 
 
 
@@ -106,9 +111,10 @@ include the files on which a code unit depends.
 int marfs_access (const char* path,
                   int         mask) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_ACCESS);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM
@@ -144,9 +150,10 @@ int marfs_access (const char* path,
 int marfs_chmod(const char* path,
                 mode_t      mode) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_CHMOD);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -172,9 +179,10 @@ int marfs_chown (const char* path,
                  uid_t       uid,
                  gid_t       gid) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_CHOWN);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -194,6 +202,7 @@ int marfs_fsync (const char*            path,
                  int                    isdatasync,
                  MarFS_FileHandle*      fh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_FSYNC);
    // I don’t know if we do anything here, I don’t think so, we will be in
    // sync at the end of each thread end
 
@@ -245,6 +254,7 @@ int marfs_ftruncate(const char*            path,
                     off_t                  length,
                     MarFS_FileHandle*      fh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_FTRUNCATE);
 
    PathInfo*         info = &fh->info;                  /* shorthand */
    ObjectStream*     os   = &fh->os;
@@ -297,9 +307,14 @@ int marfs_ftruncate(const char*            path,
    }
 
    // object-stream is still open to the old object.  Close that in such a
-   // way that the server will not persist the PUT.
-   TRY0(stream_abort, os);
-   TRY0(stream_close, os);
+   // way that the server will not persist the PUT.  (Nothing has been
+   // sent for an inline file.  Just drop the buffer.)
+   if (fh->flags & FH_INLINE)
+      fh->write_status.inline_len = 0;
+   else {
+      TRY0(stream_abort, os);
+      TRY0(stream_close, os);
+   }
 
    // open a stream to the new object.  We assume that the libaws4c context
    // initializations done in marfs_open are still valid.  trash_truncate()
@@ -309,7 +324,8 @@ int marfs_ftruncate(const char*            path,
    // the recovery-info, to be written at the tail.
    size_t open_size = get_stream_open_size(fh, 0);
    TRY0(update_url, os, info);
-   TRY0(stream_open, os, OS_PUT, open_size, 0);
+   if (! (fh->flags & FH_INLINE))
+      TRY0(stream_open, os, OS_PUT, open_size, 0);
 
    // (see marfs_mknod() -- empty non-DIRECT file needs *some* marfs xattr,
    // so marfs_open() won't assume it is a DIRECT file.)
@@ -331,8 +347,9 @@ int marfs_ftruncate(const char*            path,
 int marfs_getattr (const char*  path,
                    struct stat* stp) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_GETATTR);
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
    LOG(LOG_INFO, "expanded    %s -> %s\n", path, info.post.md_path);
 
@@ -396,12 +413,13 @@ int marfs_getxattr (const char* path,
                     char*       value,
                     size_t      size) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_GETXATTR);
    //   LOG(LOG_INFO, "not implemented  (path %s, key %s)\n", path, name);
    //   errno = ENOSYS;
    //   return -1;
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM
@@ -446,7 +464,63 @@ int marfs_ioctl(const char*            path,
    // if we need an ioctl for something or other
    // *** we need a way for daemon to read up new config file without stopping
 
-   LOG(LOG_INFO, "NOP for %s", path);
+   // Except for MARFS_IOC_PURGE, these are daemon-wide, so <path> and
+   // <fh> don't matter.  Nothing here reveals file data.  Ops run as the
+   // caller (see push_user()), so geteuid() is the caller's uid.
+   switch (cmd) {
+
+   case MARFS_IOC_LATENCY:
+      TRY_GE0(latency_report, (char*)data, MARFS_IOC_TEXT_MAX);
+      break;
+
+   // the histograms are shared by all users
+   case MARFS_IOC_LATENCY_RESET:
+      if (geteuid()) {
+         LOG(LOG_ERR, "non-root (%d) can't reset latency stats\n", geteuid());
+         errno = EPERM;
+         return -1;
+      }
+      latency_reset();
+      break;
+
+   case MARFS_IOC_IO_STATS:
+      TRY_GE0(io_stats_report, (char*)data, MARFS_IOC_TEXT_MAX, 0);
+      break;
+
+   case MARFS_IOC_IO_STATS_JSON:
+      TRY_GE0(io_stats_report, (char*)data, MARFS_IOC_TEXT_MAX, 1);
+      break;
+
+   case MARFS_IOC_PURGE_STATUS:
+      TRY_GE0(purge_report, (char*)data, MARFS_IOC_TEXT_MAX, geteuid());
+      break;
+
+   case MARFS_IOC_PURGE_CANCEL:
+      TRY0(purge_cancel, geteuid());
+      break;
+
+   // Purge does delete things, so it gets the same checks as unlink(),
+   // and runs as the caller.
+   case MARFS_IOC_PURGE: {
+      PathInfo info;
+      init_path_info(&info);
+      EXPAND_PATH_INFO(&info, path);
+      CHECK_PERMS(info.ns->iperms, (R_META | W_META | R_DATA | W_DATA));
+      if (IS_ROOT_NS(info.ns)) {
+         LOG(LOG_INFO, "is_root\n");
+         errno = EPERM;
+         return -1;
+      }
+      TRY0(purge_start, path, geteuid(), getegid());
+      break;
+   }
+
+   default:
+      LOG(LOG_INFO, "unknown cmd 0x%x for %s\n", cmd, path);
+      errno = ENOTTY;
+      return -1;
+   }
+
    EXIT();
    return 0;
 }
@@ -464,12 +538,13 @@ int marfs_listxattr (const char* path,
                      char*       list,
                      size_t      size) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_LISTXATTR);
    //   LOG(LOG_INFO, "listxattr(%s, ...) not implemented\n", path);
    //   errno = ENOSYS;
    //   return -1;
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -554,9 +629,10 @@ int marfs_listxattr (const char* path,
 int marfs_mkdir (const char* path,
                  mode_t      mode) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_MKDIR);
 
    PathInfo  info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -588,9 +664,10 @@ int marfs_mknod (const char* path,
                  mode_t      mode,
                  dev_t       rdev) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_MKNOD);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op
@@ -638,6 +715,7 @@ int marfs_mknod (const char* path,
       info.flags  |= PI_RESTART;
       info.xattrs |= XVT_RESTART;
       SAVE_XATTRS(&info, XVT_RESTART);
+      ledger_delta(info.ns, 0, 1);
    }
    else
       LOG(LOG_INFO, "iwrite_repo.access_method = DIRECT\n");
@@ -649,6 +727,206 @@ int marfs_mknod (const char* path,
 
 
 
+// If the conifguration specifies more than one host in the repo,
+// Then we expect the following features in the config:
+//    marfs_config.host         = "10.135.0.%d:81"   (for example)
+//    marfs_config.host_offset  = 15                 (for example)
+//    marfs_config.host_count   = 4                  (for example)
+//
+// This allows us to generate a valid random IP address in a select
+// set of IP ranges.
+//
+// NOTE: If you want to have DNS round-robin do this for you, you
+//     would just set marfs_config.host to a name that your DNS
+//     service knows, and set host_count=1.
+//
+// Install host number <host_idx> (mod host_count) into <ctx>, and attach
+// that host's I/O counters to <os>.  Negative <host_idx> means pick one
+// at random.  marfs_read() uses this to move to another host, when
+// resuming a failed GET.  Returns the index used, or -1.
+static int install_host(PathInfo*     info,
+                        ObjectStream* os,
+                        AWSContext*   ctx,
+                        int           host_idx) {
+
+   const size_t HOST_BUF_SIZE = 512;
+   char         host_buf[HOST_BUF_SIZE];
+   char*        host_name = info->pre.repo->host;
+   if (info->pre.repo->host_count > 1) {
+
+      if (host_idx < 0) {
+         // seed the random-number generator from the clock
+         // (i.e. in case we need to close/reopen)
+         struct timespec ts;
+         if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts))
+            return -1;
+         union {
+            long         l;
+            unsigned int ui;
+         } down_cast;
+         down_cast.l = ts.tv_nsec;
+         info->seed = down_cast.ui;
+
+         host_idx = rand_r(&info->seed) % info->pre.repo->host_count;
+      }
+      else
+         host_idx %= info->pre.repo->host_count;
+
+      // uint8_t octet = (info->pre.repo->host_offset
+      //                  + (ts.tv_nsec % info->pre.repo->host_count));
+      uint8_t octet = (info->pre.repo->host_offset + host_idx);
+      snprintf(host_buf, HOST_BUF_SIZE,
+               info->pre.repo->host, octet);
+      host_name = host_buf;
+   }
+   else
+      host_idx = 0;
+
+   s3_set_host_r(host_name, ctx);
+   LOG(LOG_INFO, "host   '%s'\n", host_name);
+   os->stats_host = io_stats_find(IOS_HOST, host_name);
+
+   return host_idx;
+}
+
+
+// Configure a private AWSContext for the repo in info->pre, install it
+// in the FileHandle's ObjectStream, and set up the URL.  marfs_open()
+// calls this.  So does defer_repo(), if it changes the repo of a file
+// that is being written.
+static int install_repo(MarFS_FileHandle* fh) {
+   TRY_DECLS();
+   PathInfo*         info = &fh->info;                  /* shorthand */
+   ObjectStream*     os   = &fh->os;
+   IOBuf*            b    = &fh->os.iob;
+
+   AWSContext* ctx = aws_context_clone();
+   if (ACCESSMETHOD_IS_S3(info->pre.repo->access_method)) { // (includes S3_EMC)
+
+      // install the host and bucket
+      fh->host_idx = install_host(info, os, ctx, -1);
+      if (fh->host_idx < 0) {
+         aws_context_free_r(ctx);
+         return -1;
+      }
+      // fprintf(stderr, "host   '%s'\n", ctx->S3Host); // for debugging pftool
+
+      s3_set_bucket_r(info->pre.bucket, ctx);
+      LOG(LOG_INFO, "bucket '%s'\n", info->pre.bucket);
+   }
+
+   if (info->pre.repo->access_method == ACCESSMETHOD_S3_EMC) {
+      s3_enable_EMC_extensions_r(1, ctx);
+
+      // For now if we're using HTTPS, I'm just assuming that it is without
+      // validating the SSL certificate (curl's -k or --insecure flags). If
+      // we ever get a validated certificate, we will want to put a flag
+      // into the MarFS_Repo struct that says it's validated or not.
+      if ( info->pre.repo->ssl ) {
+        s3_https_r( 1, ctx );
+        s3_https_insecure_r( 1, ctx );
+      }
+   }
+
+   if (info->pre.repo->access_method == ACCESSMETHOD_SPROXYD) {
+      s3_enable_Scality_extensions_r(1, ctx);
+      s3_sproxyd_r(1, ctx);
+
+      // For now if we're using HTTPS, I'm just assuming that it is without
+      // validating the SSL certificate (curl's -k or --insecure flags). If
+      // we ever get a validated certificate, we will want to put a flag
+      // into the MarFS_Repo struct that says it's validated or not.
+      if ( info->pre.repo->ssl ) {
+        s3_https_r( 1, ctx );
+        s3_https_insecure_r( 1, ctx );
+      }
+   }
+
+   // install custom context (replacing any previous one)
+   if (b->context)
+      aws_context_free_r(b->context);
+   aws_iobuf_context(b, ctx);
+   os->stats_repo = io_stats_find(IOS_REPO, info->pre.repo->name);
+
+   // initialize the URL in the ObjectStream, in our FileHandle
+   TRY0(update_url, os, info);
+
+   return 0;
+}
+
+
+// Largest file that will be kept inline in the MDFS file (see
+// MARFS_INLINE_ALLOC), or 0 if inlining is off.  Always less than the
+// logical size of a chunk, so spilling the buffer never fills a chunk.
+static size_t inline_max_env = (size_t)-1;  // -1 = not yet read from environment
+
+static size_t inline_max(PathInfo* info) {
+   if (inline_max_env == (size_t)-1) {
+      const char* env = getenv("MARFS_INLINE_MAX");
+      inline_max_env = (env ? strtoull(env, NULL, 10) : 0);
+   }
+
+   const size_t recovery = sizeof(RecoveryInfo) +8;
+   size_t       log_size = info->pre.repo->chunk_size - recovery;
+   return ((inline_max_env < log_size) ? inline_max_env : log_size -1);
+}
+
+// Largest file whose repo is chosen by its final size (see
+// MARFS_DEFER_REPO_BUF_MAX), or 0 if that is off.
+static size_t defer_max_env = (size_t)-1;   // -1 = not yet read from environment
+
+static size_t defer_max() {
+   if (defer_max_env == (size_t)-1) {
+      const char* env = getenv("MARFS_DEFER_REPO_MAX");
+      defer_max_env = (env ? strtoull(env, NULL, 10) : 0);
+      if (defer_max_env > MARFS_DEFER_REPO_BUF_MAX)
+         defer_max_env = MARFS_DEFER_REPO_BUF_MAX;
+   }
+   return defer_max_env;
+}
+
+// How much marfs_write() may buffer, for a file opened with FH_INLINE
+static size_t buffer_max(MarFS_FileHandle* fh) {
+   size_t max = inline_max(&fh->info);
+   if ((fh->flags & FH_DEFER_REPO) && (defer_max() > max))
+      max = defer_max();
+   return max;
+}
+
+// Switch a file opened with FH_DEFER_REPO to the namespace's repo for
+// files of size <size>.  Nothing has been written to the old repo, yet,
+// so we can just regenerate the Pre (keeping <unique>, in case
+// trash_truncate() bumped it), and replace the AWSContext.
+static int defer_repo(MarFS_FileHandle* fh, size_t size) {
+   TRY_DECLS();
+   PathInfo*         info = &fh->info;                  /* shorthand */
+
+   fh->flags &= ~(FH_DEFER_REPO);
+
+   MarFS_Repo* repo = find_repo_by_range(info->ns, size);
+   if (! repo
+       || (repo == info->pre.repo)
+       || (repo->access_method == ACCESSMETHOD_DIRECT)) {
+      LOG(LOG_INFO, "keeping repo '%s' for size %ld\n", info->pre.repo->name, size);
+      return 0;
+   }
+   LOG(LOG_INFO, "repo '%s' -> '%s' for size %ld\n",
+       info->pre.repo->name, repo->name, size);
+
+   uint8_t unique = info->pre.unique;
+   TRY0(init_pre, &info->pre, info->pre.obj_type, info->ns, repo, &info->st);
+   info->pre.unique = unique;
+   TRY0(update_pre, &info->pre);
+
+   TRY0(install_repo, fh);
+
+   // the retry-buffer holds one chunk of the new repo
+   stream_retry_buf(&fh->os, info->pre.chunk_size);
+   return 0;
+}
+
+
+
 // OPEN
 //
 // We maintain a MarFS_FileHandle, which has info needed by
@@ -713,6 +991,7 @@ int marfs_open(const char*         path,
                int                 flags,
                curl_off_t          content_length) { // use 0 for unknown
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_OPEN);
    LOG(LOG_INFO, "flags=(oct)%02o, content-length: %ld\n", flags, content_length);
 
    // Poke the xattr stuff into some memory for the file (poke the address
@@ -724,7 +1003,6 @@ int marfs_open(const char*         path,
    //
    PathInfo*         info = &fh->info;                  /* shorthand */
    ObjectStream*     os   = &fh->os;
-   IOBuf*            b    = &fh->os.iob;
 
    EXPAND_PATH_INFO(info, path);
 
@@ -786,7 +1064,8 @@ int marfs_open(const char*         path,
    // some kinds of reads need to get info from inside the MD-file
    else if ((fh->flags & FH_READING)
             && ((info->post.obj_type == OBJ_MULTI)
-                || (info->post.obj_type == OBJ_PACKED))) {
+                || (info->post.obj_type == OBJ_PACKED)
+                || (info->post.flags & POST_INLINE))) {
       fh->md_fd = open(info->post.md_path, (O_RDONLY)); // no O_BINARY in Linux.  Not needed.
       if (fh->md_fd < 0) {
          fh->md_fd = 0;
@@ -854,94 +1133,29 @@ int marfs_open(const char*         path,
          info->pre.obj_type = OBJ_Nto1;
       }
 
-      // see get_stream_open_size()
-      fh->write_status.data_remain = content_length;
-   }
-
-
-   // Configure a private AWSContext, for this request
-   AWSContext* ctx = aws_context_clone();
-   if (ACCESSMETHOD_IS_S3(info->pre.repo->access_method)) { // (includes S3_EMC)
-
-      // If the conifguration specifies more than one host in the repo,
-      // Then we expect the following features in the config:
-      //    marfs_config.host         = "10.135.0.%d:81"   (for example)
-      //    marfs_config.host_offset  = 15                 (for example)
-      //    marfs_config.host_count   = 4                  (for example)
-      //
-      // This allows us to generate a valid random IP address in a select
-      // set of IP ranges.
-      //
-      // NOTE: If you want to have DNS round-robin do this for you, you
-      //     would just set marfs_config.host to a name that your DNS
-      //     service knows, and set host_count=1.
-      const size_t HOST_BUF_SIZE = 512;
-      char         host_buf[HOST_BUF_SIZE];
-      char*        host_name = info->pre.repo->host;
-      if (info->pre.repo->host_count > 1) {
-
-         // seed the random-number generator from the clock
-         // (i.e. in case we need to close/reopen)
-         struct timespec ts;
-         __TRY0(clock_gettime, CLOCK_MONOTONIC_RAW, &ts);
-         union {
-            long         l;
-            unsigned int ui;
-         } down_cast;
-         down_cast.l = ts.tv_nsec;
-         info->seed = down_cast.ui;
-
-         // uint8_t octet = (info->pre.repo->host_offset
-         //                  + (ts.tv_nsec % info->pre.repo->host_count));
-         uint8_t octet = (info->pre.repo->host_offset
-                          + (rand_r(&info->seed) % info->pre.repo->host_count));
-         snprintf(host_buf, HOST_BUF_SIZE,
-                  info->pre.repo->host, octet);
-         host_name = host_buf;
+      // If the size is unknown (i.e. fuse), we may buffer the start of
+      // the file, and choose the repo later (see defer_repo()).
+      else if (! content_length && defer_max()) {
+         LOG(LOG_INFO, "writing with deferred repo\n");
+         fh->flags |= (FH_INLINE | FH_DEFER_REPO);
       }
 
-
-      // install the host and bucket
-      s3_set_host_r(host_name, ctx);
-      LOG(LOG_INFO, "host   '%s'\n", host_name);
-      // fprintf(stderr, "host   '%s'\n", host_name); // for debugging pftool
-
-      s3_set_bucket_r(info->pre.bucket, ctx);
-      LOG(LOG_INFO, "bucket '%s'\n", info->pre.bucket);
-   }
-
-   if (info->pre.repo->access_method == ACCESSMETHOD_S3_EMC) {
-      s3_enable_EMC_extensions_r(1, ctx);
-
-      // For now if we're using HTTPS, I'm just assuming that it is without
-      // validating the SSL certificate (curl's -k or --insecure flags). If
-      // we ever get a validated certificate, we will want to put a flag
-      // into the MarFS_Repo struct that says it's validated or not.
-      if ( info->pre.repo->ssl ) {
-        s3_https_r( 1, ctx );
-        s3_https_insecure_r( 1, ctx );
+      // A small file can be kept inline in the MD file (see
+      // MARFS_INLINE_ALLOC).  If we're told the size, we know up front
+      // whether it will fit.  Otherwise, marfs_write() finds out.
+      else if (inline_max(info)
+               && (content_length <= inline_max(info))) {
+         LOG(LOG_INFO, "writing inline\n");
+         fh->flags |= FH_INLINE;
       }
-   }
-
-   if (info->pre.repo->access_method == ACCESSMETHOD_SPROXYD) {
-      s3_enable_Scality_extensions_r(1, ctx);
-      s3_sproxyd_r(1, ctx);
 
-      // For now if we're using HTTPS, I'm just assuming that it is without
-      // validating the SSL certificate (curl's -k or --insecure flags). If
-      // we ever get a validated certificate, we will want to put a flag
-      // into the MarFS_Repo struct that says it's validated or not.
-      if ( info->pre.repo->ssl ) {
-        s3_https_r( 1, ctx );
-        s3_https_insecure_r( 1, ctx );
-      }
+      // see get_stream_open_size()
+      fh->write_status.data_remain = content_length;
    }
 
-   // install custom context
-   aws_iobuf_context(b, ctx);
 
-   // initialize the URL in the ObjectStream, in our FileHandle
-   TRY0(update_url, os, info);
+   // Configure a private AWSContext for the repo, and set up the URL
+   TRY0(install_repo, fh);
 
    // explicit content-length is faster, in requests through a Scality
    // sproxyd connector.  Save info so we only write MarFS chunk-size
@@ -962,8 +1176,17 @@ int marfs_open(const char*         path,
    // offsets, we let marfs_read() determine the offset where it should
    // open, so it can do its own GET, with byte-ranges.  Therefore, for
    // reads, we don't open the stream, here.
-   if (fh->flags & FH_WRITING)
-      TRY0(stream_open, os, OS_PUT, open_size, 0);
+   if (fh->flags & FH_WRITING) {
+
+      // keep a copy of each chunk, so a failed PUT can be re-sent
+      // (see resume_put())
+      stream_retry_buf(os, info->pre.chunk_size);
+
+      // inline writes don't open a stream unless they outgrow the buffer
+      // (see inline_spill())
+      if (! (fh->flags & FH_INLINE))
+         TRY0(stream_open, os, OS_PUT, open_size, 0);
+   }
 #endif
 
    EXIT();
@@ -1026,9 +1249,10 @@ int marfs_open_at_offset(const char*         path,
 int marfs_opendir (const char*       path,
                    MarFS_DirHandle*  dh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_OPENDIR);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM
@@ -1066,6 +1290,345 @@ int marfs_opendir (const char*       path,
    return 0;
 }
 
+// Before retrying a failed GET or PUT, wait a bit, and switch to the next
+// host in the repo (if there is more than one).  The delay doubles with
+// each <attempt>, up to MARFS_RETRY_BACKOFF_MAX_MS.
+
+static void retry_backoff(MarFS_FileHandle* fh, int attempt) {
+   PathInfo*         info = &fh->info;
+   ObjectStream*     os   = &fh->os;
+
+   size_t delay_ms = ((size_t)MARFS_RETRY_BACKOFF_MS << attempt);
+   if (delay_ms > MARFS_RETRY_BACKOFF_MAX_MS)
+      delay_ms = MARFS_RETRY_BACKOFF_MAX_MS;
+
+   LOG(LOG_INFO, "retry %d for %s, after %ld ms\n",
+       attempt +1, os->url, delay_ms);
+
+   struct timespec delay = { (delay_ms / 1000), (delay_ms % 1000) * 1000000 };
+   nanosleep(&delay, NULL);
+
+   if (ACCESSMETHOD_IS_S3(info->pre.repo->access_method)
+       && (info->pre.repo->host_count > 1)) {
+      int host_idx = install_host(info, os, os->iob.context, fh->host_idx +1);
+      if (host_idx >= 0)
+         fh->host_idx = host_idx;
+   }
+
+   io_stats_add(os->stats_repo, IOS_RETRIES, 1);
+   io_stats_add(os->stats_host, IOS_RETRIES, 1);
+}
+
+
+// A GET failed (error response, connection reset, timeout) or ended
+// early, after delivering some of the data we asked for.  Shut down the
+// broken stream, and re-open it at <chunk_offset> within the current
+// chunk, asking for <size> bytes.  (see retry_backoff())
+//
+// Returns 0 if the stream was re-opened, otherwise -1, and the caller
+// should give up.
+
+static int resume_get(MarFS_FileHandle* fh,
+                      size_t            chunk_offset,
+                      size_t            size,
+                      int               attempt) {
+   ObjectStream*     os   = &fh->os;
+
+   // We already know the stream failed, so we don't care what these
+   // return.  We only need the op-thread to be gone, before we can
+   // re-open.
+   if (os->flags & OSF_OPEN) {
+      stream_sync(os);
+      if (! (os->flags & (OSF_JOINED | OSF_TIMEOUT_K))) {
+         LOG(LOG_ERR, "couldn't stop failed GET (%s)\n", os->url);
+         return -1;
+      }
+      stream_close(os);
+   }
+
+   retry_backoff(fh, attempt);
+   LOG(LOG_INFO, "resuming GET at offset %ld\n", chunk_offset);
+
+   stream_range(os, chunk_offset, -1);
+   if (stream_open(os, OS_GET, size, 1)) {
+      LOG(LOG_ERR, "couldn't re-open GET (%s)\n", os->url);
+      return -1;
+   }
+   return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// HEDGED GETs
+//
+// One slow server can dominate the time-to-first-byte of small reads.  If
+// enabled (see MARFS_HEDGE_PCT, in common.h), and a freshly-opened GET
+// hasn't heard back within the recent MARFS_HEDGE_PERCENTILE of
+// first-byte times, we send the same request to the next host in the
+// repo, on a private ObjectStream, and use whichever responds first.  The
+// loser is cancelled.
+//
+// Each hedge counts against a budget of <hedge_pct> percent of eligible
+// GETs, so the extra load on the servers stays bounded.
+// ---------------------------------------------------------------------------
+
+static int            hedge_pct = -1;  // -1 = not yet read from environment
+static volatile size_t hedge_gets;      // GETs that could have been hedged
+static volatile size_t hedge_count;     // hedges actually sent
+
+static uint64_t       hedge_delay_ns;   // 0 = not enough samples yet
+static uint64_t       hedge_delay_time; // when <hedge_delay_ns> was computed
+
+static int hedge_enabled() {
+   if (hedge_pct < 0) {
+      const char* env = getenv("MARFS_HEDGE_PCT");
+      int pct = (env ? atoi(env) : 0);
+      hedge_pct = ((pct < 0) ? 0 : (pct > 100) ? 100 : pct);
+      LOG(LOG_INFO, "hedged GETs: %d%%\n", hedge_pct);
+   }
+   return hedge_pct;
+}
+
+// merging the per-thread histograms isn't free, so only do it once a second
+static uint64_t hedge_delay() {
+   uint64_t now = latency_now();
+   if ((now - hedge_delay_time) > 1000000000UL) {
+      LatencyHisto h;
+      latency_merge(LAT_STREAM_FIRST_BYTE, &h);
+      hedge_delay_ns   = ((h.count < MARFS_HEDGE_MIN_SAMPLES)
+                          ? 0
+                          : latency_percentile(&h, MARFS_HEDGE_PERCENTILE));
+      hedge_delay_time = now;
+   }
+   return hedge_delay_ns;
+}
+
+// stop the op-thread of a GET that lost the race
+static void hedge_cancel(ObjectStream* os) {
+   os->flags |= OSF_TIMEOUT;    // stream_sync() will cancel the op-thread
+   stream_sync(os);
+   stream_close(os);
+}
+
+// Called just after marfs_read() opens fh->os, for a GET of <size> bytes
+// at <chunk_offset>.  If the hedge wins, its data goes straight into
+// <buf>, fh->os is left closed, and we return the number of bytes
+// delivered.  (marfs_read() resumes the GET if that is less than <size>.)
+// Otherwise, we return 0, and the caller reads from fh->os as usual.
+
+static size_t hedge_get(MarFS_FileHandle* fh,
+                        char*             buf,
+                        size_t            chunk_offset,
+                        size_t            size) {
+   PathInfo*         info = &fh->info;
+   ObjectStream*     os   = &fh->os;
+
+   if (! hedge_enabled()
+       || (size > MARFS_HEDGE_MAX_SIZE)
+       || ! ACCESSMETHOD_IS_S3(info->pre.repo->access_method)
+       || (info->pre.repo->host_count < 2))
+      return 0;
+
+   size_t gets  = __sync_add_and_fetch(&hedge_gets, 1);
+   uint64_t delay = hedge_delay();
+   if (! delay)
+      return 0;
+
+   // primary answered in time?
+   uint64_t start = os->open_ns;
+   if (! start)
+      return 0;                 // (already saw first byte)
+   if (stream_wait_responded(os, NULL, start + delay))
+      return 0;
+
+   // over budget?
+   if ((hedge_count * 100) >= (gets * hedge_pct))
+      return 0;
+   __sync_add_and_fetch(&hedge_count, 1);
+
+   // hedge is a copy of the primary, pointed at the next host
+   ObjectStream* h = (ObjectStream*)calloc(1, sizeof(ObjectStream));
+   if (! h)
+      return 0;
+   strncpy(h->url, os->url, MARFS_MAX_URL_SIZE);
+   h->stats_repo = os->stats_repo;
+
+   AWSContext* ctx = aws_context_clone_r(os->iob.context);
+   aws_iobuf_context(&h->iob, ctx);
+   int hedge_idx = install_host(info, h, ctx, fh->host_idx +1);
+   s3_set_byte_range_r(chunk_offset, size, ctx);
+
+   io_stats_add(h->stats_repo, IOS_HEDGES, 1);
+   io_stats_add(h->stats_host, IOS_HEDGES, 1);
+   LOG(LOG_INFO, "hedging GET %s after %lu ns\n", os->url, delay);
+
+   size_t got = 0;
+   if ((hedge_idx < 0)
+       || stream_open(h, OS_GET, size, 0)) {
+      LOG(LOG_ERR, "couldn't open hedge for %s\n", os->url);
+   }
+   else {
+      ObjectStream* winner = stream_wait_responded(os, h,
+                                                   start + (MARFS_HEDGE_WAIT_MAX_MS * 1000000UL));
+
+      if ((winner == h) && !(h->flags & OSF_GET_FAILED)) {
+         LOG(LOG_INFO, "hedge won\n");
+         io_stats_add(h->stats_repo, IOS_HEDGE_WINS, 1);
+         io_stats_add(h->stats_host, IOS_HEDGE_WINS, 1);
+         hedge_cancel(os);
+
+         // stay on the faster host, for subsequent GETs
+         fh->host_idx = install_host(info, os, os->iob.context, hedge_idx);
+
+         while (got < size) {
+            ssize_t rc_ssize = stream_get(h, buf + got, size - got);
+            if (rc_ssize <= 0)
+               break;
+            got += rc_ssize;
+         }
+         stream_sync(h);
+         stream_close(h);
+
+         // as if read through fh->os.  marfs_read() re-opens it with
+         // <preserve_os_written>, so the total across chunks stays right.
+         os->written += got;
+      }
+      else
+         hedge_cancel(h);
+   }
+
+   // <ctx> is ours, not the IOBuf's (as in install_repo())
+   h->iob.context = NULL;
+   aws_iobuf_reset_hard(&h->iob);
+   aws_context_free_r(ctx);
+   free(h);
+   return got;
+}
+
+
+// A PUT of the current chunk failed (error response, connection reset,
+// timeout).  Each chunk is a separate object, so we can just PUT it
+// again, from the copy kept by stream_put().  (see stream_put_retry(),
+// retry_backoff())  The previous chunks are unaffected.
+//
+// Returns 0 if everything written so far into the current chunk has been
+// re-sent, and the caller can carry on.  Otherwise -1.
+
+static int resume_put(MarFS_FileHandle* fh) {
+   ObjectStream*     os   = &fh->os;
+
+   while (fh->write_status.put_retries < MARFS_WRITE_RETRIES) {
+      retry_backoff(fh, fh->write_status.put_retries++);
+      if (! stream_put_retry(os))
+         return 0;
+      if (os->flags & OSF_NO_RETRY)
+         break;
+   }
+
+   LOG(LOG_ERR, "giving up on %s\n", os->url);
+   errno = EIO;
+   return -1;
+}
+
+// Like TRY_GE0(), for calls that stream_put() into the current chunk.
+// The data is already in the copy that resume_put() re-sends, so, if that
+// works, we just treat the call as having returned <SIZE>.
+#define TRY_PUT(FH, SIZE, FUNCTION, ...)                                \
+   do {                                                                 \
+      rc_ssize = (ssize_t)FUNCTION(__VA_ARGS__);                        \
+      if (rc_ssize < 0) {                                               \
+         LOG(LOG_INFO, "FAIL: %s (%ld), errno=%d '%s'\n\n",             \
+             #FUNCTION, rc_ssize, errno, strerror(errno));              \
+         if (resume_put(FH))                                            \
+            RETURN(-1);                                                 \
+         rc_ssize = (SIZE);                                             \
+      }                                                                 \
+   } while (0)
+
+// Finish the PUT of the current chunk, re-sending it if the PUT failed.
+static int close_put(MarFS_FileHandle* fh) {
+   TRY_DECLS();
+   ObjectStream*     os   = &fh->os;
+
+   while (stream_sync(os)) {
+      LOG(LOG_ERR, "PUT failed (%s)\n", os->url);
+      if (resume_put(fh))
+         return -1;
+   }
+   TRY0(stream_close, os);
+
+   fh->write_status.put_retries = 0;
+   return 0;
+}
+
+
+// INLINE
+//
+// Writes to a file opened with FH_INLINE accumulate in
+// WriteStatus.inline_buf.  If the file outgrows buffer_max(), or is
+// closed while too big to be inline, we open the stream that marfs_open()
+// skipped, and write the buffer as the start of the object.  After that,
+// it's a normal write.  With FH_DEFER_REPO, we first pick the repo for a
+// file of <size>.
+//
+// The buffer may be bigger than a chunk in the new repo, so it goes
+// through marfs_write(), to be split into chunks.
+static int inline_spill(MarFS_FileHandle* fh, size_t size) {
+   TRY_DECLS();
+   ObjectStream*     os   = &fh->os;
+   WriteStatus*      ws   = &fh->write_status;
+
+   char*  buf = ws->inline_buf;
+   size_t len = ws->inline_len;
+
+   LOG(LOG_INFO, "spilling %ld buffered bytes\n", len);
+   if (fh->flags & FH_DEFER_REPO)
+      TRY0(defer_repo, fh, size);
+   fh->flags &= ~(FH_INLINE);
+
+   ws->inline_buf   = NULL;
+   ws->inline_len   = 0;
+   ws->inline_alloc = 0;
+
+   size_t open_size = get_stream_open_size(fh, 0);
+   rc = stream_open(os, OS_PUT, open_size, 0);
+   if (! rc && len)
+      rc = ((marfs_write(fh->info.post.md_path, buf, len, 0, fh) < 0) ? -1 : 0);
+
+   free(buf);
+   return (rc ? -1 : 0);
+}
+
+// Closing a file that is still FH_INLINE.  Put the data into the MD file,
+// and mark the POST.  The caller truncates the MD file and saves xattrs.
+static int inline_save(MarFS_FileHandle* fh) {
+   TRY_DECLS();
+   PathInfo*         info = &fh->info;
+   WriteStatus*      ws   = &fh->write_status;
+
+   LOG(LOG_INFO, "saving %ld inline bytes\n", ws->inline_len);
+   if (ws->inline_len) {
+      int fd = open(info->post.md_path, (O_WRONLY));
+      if (fd < 0) {
+         LOG(LOG_ERR, "open %s failed (%s)\n", info->post.md_path, strerror(errno));
+         return -1;
+      }
+      ssize_t wrote = pwrite(fd, ws->inline_buf, ws->inline_len, 0);
+      if (wrote != (ssize_t)ws->inline_len) {
+         LOG(LOG_ERR, "pwrite %s failed (%ld of %ld)\n",
+             info->post.md_path, wrote, ws->inline_len);
+         close(fd);
+         errno = ((wrote < 0) ? errno : EIO);
+         return -1;
+      }
+      TRY0(close, fd);
+   }
+
+   info->post.flags |= POST_INLINE;
+   return 0;
+}
+
+
 // return actual number of bytes read.  0 indicates EOF.
 // negative means error.
 //
@@ -1078,13 +1641,13 @@ int marfs_read (const char*        path,
                 off_t              offset,
                 MarFS_FileHandle*  fh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_READ);
 
    ///   PathInfo info;
    ///   memset((char*)&info, 0, sizeof(PathInfo));
    ///   EXPAND_PATH_INFO(&info, path);
    PathInfo*         info = &fh->info;                  /* shorthand */
    ObjectStream*     os   = &fh->os;
-   IOBuf*            b    = &os->iob;
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM  RD
    CHECK_PERMS(info->ns->iperms, (R_META | R_DATA));
@@ -1101,6 +1664,13 @@ int marfs_read (const char*        path,
       return rc_ssize;
    }
 
+   // Inline files have their data in the MD file (see inline_save())
+   if (info->post.flags & POST_INLINE) {
+      LOG(LOG_INFO, "reading inline\n");
+      TRY_GE0(pread, fh->md_fd, buf, size, offset);
+      return rc_ssize;
+   }
+
    //   File is objtype packed or uni
    //      Make sure start and end are within the object
    //           (according to file size and objoffset)
@@ -1198,6 +1768,7 @@ int marfs_read (const char*        path,
                           : chunk_remain);
 
    size_t read_count   = 0;     // amount read during this call
+   size_t hedged       = 0;     // amount delivered by hedge_get()
 
 
    // discontiguous read could happen if user calls seek()
@@ -1233,7 +1804,7 @@ int marfs_read (const char*        path,
 
       if (! (os->flags & OSF_OPEN)) {
          // open-ended byte-range, starting at offset in this chunk
-         s3_set_byte_range_r(chunk_offset, -1, b->context);
+         stream_range(os, chunk_offset, -1);
 
          // NOTE: stream_open() potentially wipes ObjectStream.written.  We
          //     want this field to track the total amount read across all
@@ -1243,6 +1814,9 @@ int marfs_read (const char*        path,
          //     probably should allow os->written to be reset.
          //
          TRY0(stream_open, os, OS_GET, read_size, 1);
+
+         // maybe send a duplicate GET to another host (see hedge_get())
+         hedged = hedge_get(fh, buf_ptr, chunk_offset, read_size);
       }
 
       // Because we are reading byte-ranges, we may see '206 Partial Content'.
@@ -1255,33 +1829,39 @@ int marfs_read (const char*        path,
       //
       // Keep trying until we read all of read_size, or get an error (or get 0).
 
-      size_t sub_read = read_size; // bytes remaining within <read_size>
-      do {
+      //
+      // If the GET fails, or ends early, we resume it at the failed offset
+      // (see resume_get()).
+
+      size_t sub_read = read_size - hedged; // bytes remaining within <read_size>
+      int    retries  = 0;
+
+      buf_ptr += hedged;
+      hedged   = 0;
+
+      while (sub_read) {
          rc_ssize = stream_get(os, buf_ptr, sub_read);
-         if ((rc_ssize < 0)
-             && (os->iob.code != 200)
-             && (os->iob.code != 206)) {
-            LOG(LOG_ERR, "stream_get returned < 0: %ld '%s' (%d '%s')\n",
-                rc_ssize, strerror(errno), os->iob.code, os->iob.result);
-            errno = EIO;
-            return -1;
-         }
          if (rc_ssize < 0) {
             LOG(LOG_ERR, "stream_get returned < 0: %ld '%s' (%d '%s')\n",
                 rc_ssize, strerror(errno), os->iob.code, os->iob.result);
-            errno = EIO;
-            return -1;
          }
          // // handy for debugging small reads (but too voluminous for normal use)
          // LOG(LOG_INFO, "result: '%*s'\n", rc_ssize, buf);
 
          // Q: This might legitimately happen if stream_get() hits EOF?
          // A: No, read_size was adjusted to account for logical EOF
-         if (rc_ssize == 0) {
+         else if (rc_ssize == 0) {
             LOG(LOG_ERR, "request for range %ld-%ld (%ld bytes) returned 0 bytes\n",
                 (chunk_offset + read_size - sub_read),
                 (chunk_offset + read_size),
                 sub_read);
+         }
+
+         if (rc_ssize <= 0) {
+            if ((retries < MARFS_READ_RETRIES)
+                && ! resume_get(fh, (chunk_offset + read_size - sub_read),
+                                sub_read, retries++))
+               continue;
             errno = EIO;
             return -1;
          }
@@ -1299,7 +1879,7 @@ int marfs_read (const char*        path,
          buf_ptr       += rc_ssize;
          sub_read      -= rc_ssize;
 
-      } while (sub_read);
+      }
       LOG(LOG_INFO, "completed read_size = %lu\n", read_size);
 
       total_remain  -= read_size;
@@ -1317,11 +1897,14 @@ int marfs_read (const char*        path,
                         ? total_remain
                         : chunk_remain);
 
-      // reading another chunk?
+      // reading another chunk?  (If hedge_get() won, <os> was already
+      // closed.)
       if (total_remain) {
 
-         TRY0(stream_sync, os);
-         TRY0(stream_close, os);
+         if (os->flags & OSF_OPEN) {
+            TRY0(stream_sync, os);
+            TRY0(stream_close, os);
+         }
 
          // update the URL in the ObjectStream, in our FileHandle
          info->pre.chunk_no = chunk;
@@ -1341,9 +1924,10 @@ int marfs_readdir (const char*        path,
                    off_t              offset,
                    MarFS_DirHandle*   dh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_READDIR);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM
@@ -1369,7 +1953,9 @@ int marfs_readdir (const char*        path,
    }
    else {
       DIR*           dirp = dh->internal.dirp;
+      int            dfd  = dirfd(dirp);
       struct dirent* dent;
+      struct stat    st;
    
       while (1) {
          // #if _POSIX_C_SOURCE >= 1 || _XOPEN_SOURCE || _BSD_SOURCE || _SVID_SOURCE || _POSIX_SOURCE
@@ -1389,7 +1975,23 @@ int marfs_readdir (const char*        path,
             break;              /* EOF */
          }
          dent = (struct dirent*)rc_ssize;
-         if (filler(buf, dent->d_name, NULL, 0))
+
+         // Return attributes with each name (readdirplus semantics), so
+         // 'ls -l' and 'find' don't have to follow every entry with a
+         // separate getattr.  fstatat() relative to the open DIR* avoids
+         // building a full MDFS path per entry.  Same masking as
+         // marfs_getattr().  If the entry vanished since readdir(), or it
+         // is "." or ".." (which may be outside the namespace), just
+         // return the name.
+         const struct stat* stp = NULL;
+         if ((dfd >= 0)
+             && strcmp(dent->d_name, ".")
+             && strcmp(dent->d_name, "..")
+             && ! fstatat(dfd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+            st.st_mode &= ~(S_ISUID | S_ISGID);
+            stp = &st;
+         }
+         if (filler(buf, dent->d_name, stp, 0))
             break;                 /* no more room in <buf>*/
          // #endif
       
@@ -1431,8 +2033,9 @@ int marfs_readlink (const char* path,
                     char*       buf,
                     size_t      size) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_READLINK);
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM
@@ -1475,6 +2078,7 @@ int marfs_readlink (const char* path,
 int marfs_release (const char*        path,
                    MarFS_FileHandle*  fh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_RELEASE);
 
    // if writing there will be an objid stuffed into a address  in fuse open table
    //       seal that object if needed
@@ -1507,24 +2111,44 @@ int marfs_release (const char*        path,
    //
    // NOTE: Even-newer approach: we now allow that maybe read left a stream
    //     open, in an attempt to avoid extra calls to stream_close/reopen.
+   //
+   // A file that never outgrew the write buffer has no object, yet.  If
+   // it's small enough, it is kept inline.  Otherwise, the buffer is
+   // written to an object (in a repo that suits the final size, if that
+   // was deferred), which is then closed, below.
+   if (fh->flags & FH_INLINE) {
+      if (inline_max(info)
+          && (fh->write_status.inline_len <= inline_max(info)))
+         TRY0(inline_save, fh);
+      else
+         TRY0(inline_spill, fh, fh->write_status.inline_len);
+   }
+
    if (fh->os.flags & OSF_OPEN) {
 
       if (! (fh->os.flags & OSF_ERRORS)) {
 
          if (fh->flags & FH_WRITING) {
             // add final recovery-info, at the tail of the object
-            TRY_GE0(write_recoveryinfo, os, info);
+            const size_t recovery = sizeof(RecoveryInfo) +8;
+            TRY_PUT(fh, recovery, write_recoveryinfo, os, info);
             fh->write_status.sys_writes += rc_ssize; // accumulate non-user-data written
          }
       }
 
-      TRY0(stream_sync, os);
-      TRY0(stream_close, os);
+      if ((fh->flags & FH_WRITING)
+          && !(fh->os.flags & OSF_ERRORS))
+         TRY0(close_put, fh);
+      else {
+         TRY0(stream_sync, os);
+         TRY0(stream_close, os);
+      }
    }
 #endif
 
    // free aws4c resources
    aws_iobuf_reset_hard(&os->iob);
+   stream_retry_buf(os, 0);
 
    // close MD file, if it's open
    if (fh->md_fd) {
@@ -1568,7 +2192,11 @@ int marfs_release (const char*        path,
    if ((fh->flags & FH_WRITING)
        && has_any_xattrs(info, MARFS_ALL_XATTRS)
        && !(fh->flags & FH_ALLOW_RISKY)) {
-      TRY0(truncate, info->post.md_path, os->written - fh->write_status.sys_writes);
+      size_t log_size = ((fh->flags & FH_INLINE)
+                         ? fh->write_status.inline_len
+                         : os->written - fh->write_status.sys_writes);
+      TRY0(truncate, info->post.md_path, log_size);
+      ledger_delta(info->ns, log_size, 0);
    }
 
 
@@ -1610,12 +2238,13 @@ int marfs_release (const char*        path,
 int marfs_releasedir (const char*       path,
                       MarFS_DirHandle*  dh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_RELEASEDIR);
    LOG(LOG_INFO, "releasedir %s\n", path);
 
    // If path == "-", assume we are closing a deleted dir.  (see NOTE)
    if ((path[0] != '-') || (path[1] != 0)) {
       PathInfo info;
-      memset((char*)&info, 0, sizeof(PathInfo));
+      init_path_info(&info);
       EXPAND_PATH_INFO(&info, path);
 
       // Check/act on iperms from expanded_path_info_structure, this op requires RM
@@ -1642,12 +2271,13 @@ int marfs_releasedir (const char*       path,
 int marfs_removexattr (const char* path,
                        const char* name) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_REMOVEXATTR);
    //   LOG(LOG_INFO, "removexattr(%s, %s) not implemented\n", path, name);
    //   errno = ENOSYS;
    //   return -1;
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -1681,13 +2311,14 @@ int marfs_removexattr (const char* path,
 int marfs_rename (const char* path,
                   const char* to) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_RENAME);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    PathInfo info2;
-   memset((char*)&info2, 0, sizeof(PathInfo));
+   init_path_info(&info2);
    EXPAND_PATH_INFO(&info2, to);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -1721,9 +2352,10 @@ int marfs_rename (const char* path,
 //
 int marfs_rmdir (const char* path) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_RMDIR);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -1751,9 +2383,10 @@ int marfs_setxattr (const char* path,
                     size_t      size,
                     int         flags) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_SETXATTR);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -1788,28 +2421,63 @@ int marfs_setxattr (const char* path,
 int marfs_statfs (const char*      path,
                   struct statvfs*  statbuf) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_STATFS);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RM
    CHECK_PERMS(info.ns->iperms, (R_META));
 
-   // NOTE: Until fsinfo is available, we're just ignoring.
-   errno = ENOSYS;
-   return -1;
+   // Usage comes from the ledger cache, so this costs no system-calls.
+   // The root NS reports the totals of all the namespaces.
+   int64_t space_limit = (int64_t)(long long)info.ns->quota_space;
+   int64_t names_limit = (int64_t)(long long)info.ns->quota_names;
+   int64_t space_used;
+   int64_t names_used;
 
-   //   if (geteuid()) {
-   //      LOG(LOG_ERR, "non-root can't stavfs()\n");
-   //      errno = EACCES;
-   //      return -1;
-   //   }
-   //   // Open and read from lazy-fsinfo data file updated by batch process fsinfopath 
-   //   // Size of file sytem is quota etc.
-   //   memset(statbuf, 0, sizeof(struct statvfs));
-   //   statbuf->f_bsize = 512;      // matches GPFS
-   //   ...
+   if (IS_ROOT_NS(info.ns)) {
+      if (ledger_usage_all(&space_used, &names_used, &space_limit, &names_limit)) {
+         space_used = 0;
+         names_used = 0;
+      }
+   }
+   else if (ledger_usage(info.ns, &space_used, &names_used)) {
+      struct stat st;
+      if (stat(info.ns->fsinfo_path, &st)) {
+         LOG(LOG_ERR, "couldn't stat fsinfo at '%s': %s\n",
+             info.ns->fsinfo_path, strerror(errno));
+         errno = EIO;
+         return -1;
+      }
+      space_used = st.st_size;
+      names_used = -1;
+   }
+   if (space_used < 0)          // e.g. deletes not yet counted by a scan
+      space_used = 0;
+   if (names_used < 0)
+      names_used = 0;
+
+   if (space_limit < 0)
+      space_limit = space_used + MARFS_STATFS_FREE_SPACE;
+   if (names_limit < 0)
+      names_limit = names_used + MARFS_STATFS_FREE_NAMES;
+
+   const int64_t blocks      = space_limit / MARFS_STATFS_BSIZE;
+   const int64_t blocks_used = ((space_used + MARFS_STATFS_BSIZE -1)
+                                / MARFS_STATFS_BSIZE);
+
+   memset(statbuf, 0, sizeof(struct statvfs));
+   statbuf->f_bsize   = MARFS_STATFS_BSIZE;
+   statbuf->f_frsize  = MARFS_STATFS_BSIZE;
+   statbuf->f_blocks  = blocks;
+   statbuf->f_bfree   = ((blocks > blocks_used) ? blocks - blocks_used : 0);
+   statbuf->f_bavail  = statbuf->f_bfree;
+   statbuf->f_files   = names_limit;
+   statbuf->f_ffree   = ((names_limit > names_used) ? names_limit - names_used : 0);
+   statbuf->f_favail  = statbuf->f_ffree;
+   statbuf->f_namemax = NAME_MAX;
 
    EXIT();
    return 0;
@@ -1825,12 +2493,13 @@ int marfs_statfs (const char*      path,
 int marfs_symlink (const char* target,
                    const char* linkname) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_SYMLINK);
 
    // <linkname> is given to us as a path under the fuse-mount,
    // in the usual way for fuse-functions.
    LOG(LOG_INFO, "linkname: %s\n", linkname);
    PathInfo lnk_info;
-   memset((char*)&lnk_info, 0, sizeof(PathInfo));
+   init_path_info(&lnk_info);
    EXPAND_PATH_INFO(&lnk_info, linkname);   // (okay if this file doesn't exist)
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -1855,6 +2524,7 @@ int marfs_symlink (const char* target,
 int marfs_truncate (const char* path,
                     off_t       size) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_TRUNCATE);
 
    // Check/act on truncate-to-zero only.
    if (size) {
@@ -1863,7 +2533,7 @@ int marfs_truncate (const char* path,
    }
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWMRDWD
@@ -1888,7 +2558,12 @@ int marfs_truncate (const char* path,
    }
 
    // copy metadata to trash, resets original file zero len and no xattr
+   // (trash_truncate() resets <info>, so check the size first)
+   int   counted  = has_all_xattrs(&info, MARFS_MD_XATTRS);
+   off_t old_size = info.st.st_size;
    TRASH_TRUNCATE(&info, path);
+   if (counted)
+      ledger_delta(info.ns, -(int64_t)old_size, 0);
 
    // (see marfs_mknod() -- empty non-DIRECT file needs *some* marfs xattr,
    // so marfs_open() won't assume it is a DIRECT file.)
@@ -1908,9 +2583,10 @@ int marfs_truncate (const char* path,
 
 int marfs_unlink (const char* path) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_UNLINK);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWMRDWD
@@ -1951,8 +2627,17 @@ int marfs_unlink (const char* path) {
    if (call_access)
       ACCESS(info.post.md_path, (W_OK));
 
+   // only marfs files count toward quotas (same as the quota scan).
+   // Check before the unlink, which may reset <info>.
+   STAT_XATTRS(&info);
+   int   counted = (S_ISREG(info.st.st_mode)
+                    && has_all_xattrs(&info, MARFS_MD_XATTRS));
+   off_t size    = info.st.st_size;
+
    // rename file with all xattrs into trashdir, preserving objects and paths 
    TRASH_UNLINK(&info, path);
+   if (counted)
+      ledger_delta(info.ns, -(int64_t)size, -1);
 
    EXIT();
    return 0;
@@ -1976,7 +2661,7 @@ int marfs_utime(const char*     path,
    ENTRY();
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -2005,9 +2690,10 @@ int marfs_utime(const char*     path,
 int marfs_utimens(const char*           path,
                   const struct timespec tv[2]) {   
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_UTIMENS);
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWM
@@ -2036,6 +2722,7 @@ int marfs_write(const char*        path,
                 off_t              offset,
                 MarFS_FileHandle*  fh) {
    ENTRY();
+   LATENCY_SCOPE(LAT_OP_WRITE);
 
    LOG(LOG_INFO, "%s\n", path);
    LOG(LOG_INFO, "offset: (%ld)+%ld, size: %ld\n", fh->open_offset, offset, size);
@@ -2065,6 +2752,45 @@ int marfs_write(const char*        path,
       return rc_ssize;
    }
 
+   // Small files are buffered, to be kept inline in the MD file, until
+   // they grow too big.  (see inline_spill())
+   if (fh->flags & FH_INLINE) {
+      WriteStatus* ws = &fh->write_status;
+
+      if (offset != ws->inline_len) {
+         LOG(LOG_ERR, "non-contig inline write: offset %ld, after %ld\n",
+             offset, ws->inline_len);
+         errno = EINVAL;
+         return -1;
+      }
+
+      size_t max = buffer_max(fh);
+      if (ws->inline_len + size <= max) {
+         if (ws->inline_len + size > ws->inline_alloc) {
+            size_t alloc = (ws->inline_alloc ? ws->inline_alloc : MARFS_INLINE_ALLOC);
+            while (alloc < ws->inline_len + size)
+               alloc *= 2;
+            if (alloc > max)
+               alloc = max;
+
+            char* new_buf = (char*)realloc(ws->inline_buf, alloc);
+            if (! new_buf) {
+               LOG(LOG_ERR, "couldn't grow inline buffer to %ld\n", alloc);
+               errno = ENOMEM;
+               return -1;
+            }
+            ws->inline_buf   = new_buf;
+            ws->inline_alloc = alloc;
+         }
+         memcpy(ws->inline_buf + ws->inline_len, buf, size);
+         ws->inline_len += size;
+         return size;
+      }
+
+      // too big to buffer.  Treat it as a large file.
+      TRY0(inline_spill, fh, (size_t)-1);
+   }
+
    // If first write, check/act on quota bytes
    // TBD ...
 
@@ -2174,17 +2900,16 @@ int marfs_write(const char*        path,
       }
 
 
-      TRY_GE0(stream_put, os, buf_ptr, fill);
+      TRY_PUT(fh, fill, stream_put, os, buf_ptr, fill);
       buf_ptr    += fill;
       log_offset += fill;
 
-      TRY_GE0(write_recoveryinfo, os, info);
+      TRY_PUT(fh, recovery, write_recoveryinfo, os, info);
       fh->write_status.sys_writes += rc_ssize; // track non-user-data written
 
       // close the object
       LOG(LOG_INFO, "closing chunk: %ld\n", info->pre.chunk_no);
-      TRY0(stream_sync, os);
-      TRY0(stream_close, os);
+      TRY0(close_put, fh);
 
       // if we haven't already opened the MD file, do it now.
       if (! fh->md_fd) {
@@ -2239,7 +2964,7 @@ int marfs_write(const char*        path,
    // write more data into object. This amount doesn't finish out any
    // object, so don't write chunk-info to MD file.
    if (write_size)
-      TRY_GE0(stream_put, os, buf_ptr, write_size);
+      TRY_PUT(fh, write_size, stream_put, os, buf_ptr, write_size);
 
 
    EXIT();
@@ -2287,7 +3012,7 @@ int marfs_create(const char*        path,
    ENTRY();
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure
@@ -2342,7 +3067,7 @@ int marfs_fallocate(const char*        path,
    ENTRY();
 
    PathInfo info;
-   memset((char*)&info, 0, sizeof(PathInfo));
+   init_path_info(&info);
    EXPAND_PATH_INFO(&info, path);
 
    // Check/act on iperms from expanded_path_info_structure, this op requires RMWMRDWD
@@ -99,6 +99,28 @@ typedef int (*marfs_fill_dir_t) (void *buf, const char *name,
 #include <sys/statvfs.h>
 
 
+// Commands for marfs_ioctl().  These can be issued on any open file or
+// directory in a marfs fuse mount, e.g. from python:
+//
+//    fd  = os.open("/marfs/some/file", os.O_RDONLY)
+//    buf = fcntl.ioctl(fd, MARFS_IOC_LATENCY, bytes(MARFS_IOC_TEXT_MAX))
+//
+// Fuse only supports "restricted" ioctls, where the size of the data is
+// encoded in the command, so text reports come back in a fixed-size,
+// NUL-terminated buffer.
+#include <sys/ioctl.h>
+
+#define MARFS_IOC_TEXT_MAX        (16 * 1024 -1) /* biggest size an ioctl cmd can encode */
+
+#define MARFS_IOC_LATENCY         _IOR('M', 1, char[MARFS_IOC_TEXT_MAX]) /* latency.h */
+#define MARFS_IOC_LATENCY_RESET   _IO('M',  2) /* root only */
+#define MARFS_IOC_IO_STATS        _IOR('M', 3, char[MARFS_IOC_TEXT_MAX]) /* io_stats.h */
+#define MARFS_IOC_IO_STATS_JSON   _IOR('M', 4, char[MARFS_IOC_TEXT_MAX])
+#define MARFS_IOC_PURGE           _IO('M',  5) /* purge.h (issue on a dir) */
+#define MARFS_IOC_PURGE_STATUS    _IOR('M', 6, char[MARFS_IOC_TEXT_MAX]) /* details: owner or root */
+#define MARFS_IOC_PURGE_CANCEL    _IO('M',  7) /* owner or root */
+
+
 
 #  ifdef __cplusplus
 extern "C" {
@@ -84,17 +84,263 @@ OF SUCH DAMAGE.
 
 #include "common.h"
 #include "object_stream.h"
+#include "latency.h"
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 
 void stream_reset(ObjectStream* os, uint8_t preserve_os_written);
 
 
+// add to the repo and host counters for this stream (see io_stats.h)
+static void stream_count(ObjectStream* os, IoCounter counter, int64_t n) {
+   io_stats_add(os->stats_repo, counter, n);
+   io_stats_add(os->stats_host, counter, n);
+}
+
+
+
+
+// ---------------------------------------------------------------------------
+// FILES  (SEMI_DIRECT repos)
+//
+// A SEMI_DIRECT repo keeps each object as a file, in a scatter-tree on
+// some separate (e.g. parallel, or local NVMe) file-system.  update_url()
+// then puts the file-path into os->url, and sets os->is_file.  The
+// stream_xxx() functions hand such streams to these, which just
+// pread()/pwrite() the file, in the caller's thread.  There is no curl, no
+// op-thread, and no HTTP framing.
+//
+// If the environment variable MARFS_O_DIRECT is set, files are opened
+// with O_DIRECT.  All I/O then goes through an aligned buffer, so callers
+// can still use any offsets and sizes.  The tail of a file is written
+// padded to the alignment, then truncated back.  (If the file-system
+// rejects O_DIRECT, we quietly fall back to buffered I/O.)
+//
+// The scatter-tree directories are not writable by users, so files are
+// opened with the daemon's own credentials.  Permissions were already
+// checked against the MD file.
+// ---------------------------------------------------------------------------
+
+#define FILE_DIO_ALIGN      4096
+#define FILE_DIO_BUF_SIZE   (1024 * 1024)  /* multiple of FILE_DIO_ALIGN */
+
+static int file_o_direct() {
+   static int o_direct = -1;
+   if (o_direct < 0)
+      o_direct = (getenv("MARFS_O_DIRECT") ? 1 : 0);
+   return o_direct;
+}
+
+static int file_open(ObjectStream* os, IsPut put) {
+
+   int flags = (put ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY);
+
+   uid_t saved_euid;
+   gid_t saved_egid;
+   if (push_user(&saved_euid, &saved_egid, getuid(), getgid()))
+      return -1;
+
+   int fd = -1;
+   os->file_direct = 0;
+   if (file_o_direct()) {
+      fd = open(os->url, (flags | O_DIRECT), (S_IRUSR | S_IWUSR));
+      if (fd >= 0)
+         os->file_direct = 1;
+      else if (errno == EINVAL)
+         LOG(LOG_INFO, "O_DIRECT not supported for %s\n", os->url);
+   }
+   if (fd < 0)
+      fd = open(os->url, flags, (S_IRUSR | S_IWUSR));
+   int errno_save = errno;
+
+   pop_user(&saved_euid, &saved_egid);
+   if (fd < 0) {
+      LOG(LOG_ERR, "open(%s) failed: %s\n", os->url, strerror(errno_save));
+      errno = errno_save;
+      return -1;
+   }
+
+   if (os->file_direct) {
+      if (posix_memalign((void**)&os->dio_buf, FILE_DIO_ALIGN, FILE_DIO_BUF_SIZE)) {
+         LOG(LOG_ERR, "couldn't allocate O_DIRECT buffer\n");
+         close(fd);
+         errno = ENOMEM;
+         return -1;
+      }
+      os->dio_len = 0;
+   }
+
+   os->file_fd  = fd;
+   os->file_pos = (put ? 0 : os->range_offset);
+   stream_count(os, (put ? IOS_PUTS : IOS_GETS), 1);
+   LOG(LOG_INFO, "opened %s (fd %d%s)\n",
+       os->url, fd, (os->file_direct ? ", O_DIRECT" : ""));
+   return 0;
+}
+
+// write all of <buf> at <offset>
+static int file_pwrite(ObjectStream* os, const char* buf, size_t size, off_t offset) {
+   while (size) {
+      ssize_t n = pwrite(os->file_fd, buf, size, offset);
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+         LOG(LOG_ERR, "pwrite(%s) failed: %s\n", os->url, strerror(errno));
+         return -1;
+      }
+      buf    += n;
+      size   -= n;
+      offset += n;
+   }
+   return 0;
+}
+
+static int file_put(ObjectStream* os, const char* buf, size_t size) {
+   size_t remain = size;
+
+   if (! os->file_direct) {
+      if (file_pwrite(os, buf, size, os->file_pos))
+         return -1;
+      os->file_pos += size;
+   }
+   else {
+      // fill the aligned buffer.  <file_pos> is where it starts.
+      while (remain) {
+         size_t room = FILE_DIO_BUF_SIZE - os->dio_len;
+         size_t move = ((remain < room) ? remain : room);
+         memcpy(os->dio_buf + os->dio_len, buf, move);
+         os->dio_len += move;
+         buf         += move;
+         remain      -= move;
+
+         if (os->dio_len == FILE_DIO_BUF_SIZE) {
+            if (file_pwrite(os, os->dio_buf, FILE_DIO_BUF_SIZE, os->file_pos))
+               return -1;
+            os->file_pos += FILE_DIO_BUF_SIZE;
+            os->dio_len   = 0;
+         }
+      }
+   }
+
+   os->written += size;
+   stream_count(os, IOS_BYTES_OUT, size);
+   return size;
+}
+
+static ssize_t file_get(ObjectStream* os, char* buf, size_t size) {
+   ssize_t n;
+
+   if (! os->file_direct) {
+      do {
+         n = pread(os->file_fd, buf, size, os->file_pos);
+      } while ((n < 0) && (errno == EINTR));
+      if (n < 0) {
+         LOG(LOG_ERR, "pread(%s) failed: %s\n", os->url, strerror(errno));
+         return -1;
+      }
+   }
+   else {
+      // read aligned blocks covering [file_pos, file_pos + size)
+      n = 0;
+      while ((size_t)n < size) {
+         off_t   pos     = os->file_pos + n;
+         off_t   aligned = pos & ~((off_t)FILE_DIO_ALIGN -1);
+         size_t  skip    = pos - aligned;
+         size_t  want    = skip + (size - n);
+         want = ((want + FILE_DIO_ALIGN -1) & ~((size_t)FILE_DIO_ALIGN -1));
+         if (want > FILE_DIO_BUF_SIZE)
+            want = FILE_DIO_BUF_SIZE;
+
+         ssize_t got;
+         do {
+            got = pread(os->file_fd, os->dio_buf, want, aligned);
+         } while ((got < 0) && (errno == EINTR));
+         if (got < 0) {
+            LOG(LOG_ERR, "pread(%s) failed: %s\n", os->url, strerror(errno));
+            return -1;
+         }
+         if ((size_t)got <= skip)
+            break;              // EOF
+
+         size_t avail = got - skip;
+         size_t move  = ((avail < (size - n)) ? avail : (size - n));
+         memcpy(buf + n, os->dio_buf + skip, move);
+         n += move;
+         if ((size_t)got < want)
+            break;              // EOF
+      }
+   }
+
+   os->file_pos += n;
+   os->written  += n;
+   stream_count(os, IOS_BYTES_IN, n);
+   return n;
+}
+
+// write out the tail of an O_DIRECT file
+static int file_sync(ObjectStream* os) {
+   if (os->file_direct && (os->flags & OSF_WRITING) && os->dio_len) {
+      size_t padded = ((os->dio_len + FILE_DIO_ALIGN -1)
+                       & ~((size_t)FILE_DIO_ALIGN -1));
+      memset(os->dio_buf + os->dio_len, 0, padded - os->dio_len);
+      if (file_pwrite(os, os->dio_buf, padded, os->file_pos)
+          || ftruncate(os->file_fd, os->file_pos + os->dio_len)) {
+         LOG(LOG_ERR, "couldn't write tail of %s\n", os->url);
+         os->op_rc = -1;
+      }
+      os->file_pos += os->dio_len;
+      os->dio_len   = 0;
+   }
+   os->flags |= OSF_JOINED;
+   errno = (os->op_rc ? EIO : 0);
+   return os->op_rc;
+}
+
+// don't leave a partial object behind
+static int file_abort(ObjectStream* os) {
+   os->flags |= (OSF_ABORT | OSF_JOINED);
+   os->dio_len = 0;
+
+   uid_t saved_euid;
+   gid_t saved_egid;
+   if (push_user(&saved_euid, &saved_egid, getuid(), getgid()))
+      return -1;
+   int rc = unlink(os->url);
+   pop_user(&saved_euid, &saved_egid);
+
+   if (rc && (errno != ENOENT)) {
+      LOG(LOG_ERR, "unlink(%s) failed: %s\n", os->url, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+static int file_close(ObjectStream* os) {
+   int rc = close(os->file_fd);
+   os->file_fd = 0;
+
+   free(os->dio_buf);
+   os->dio_buf = NULL;
+
+   os->flags &= ~(OSF_OPEN);
+   os->flags |= OSF_CLOSED;     /* so stream_open() can identify re-opens */
+
+   if (rc) {
+      LOG(LOG_ERR, "close(%s) failed: %s\n", os->url, strerror(errno));
+      return -1;
+   }
+   errno = (os->op_rc ? EIO : 0);
+   return os->op_rc;
+}
+
+
 
 
 // ---------------------------------------------------------------------------
@@ -126,6 +372,7 @@ void stream_reset(ObjectStream* os, uint8_t preserve_os_written);
       if (PSL_wait_with_timeout((SEM_PTR), (TIMEOUT_SEC))) {            \
          LOG(LOG_ERR, "PSL_wait_with_timeout failed. (%s)\n", strerror(errno)); \
          (OS_PTR)->flags |= OSF_TIMEOUT;                                \
+         stream_count((OS_PTR), IOS_TIMEOUTS, 1);                       \
          return -1;                                                     \
       }                                                                 \
    } while (0)
@@ -135,6 +382,7 @@ void stream_reset(ObjectStream* os, uint8_t preserve_os_written);
       if (PSL_wait_with_timeout((SEM_PTR), (TIMEOUT_SEC))) {            \
          LOG(LOG_ERR, "PSL_wait_with_timeout failed. (%s)  Killing thread.\n", strerror(errno)); \
          (OS_PTR)->flags |= OSF_TIMEOUT_K;                              \
+         stream_count((OS_PTR), IOS_TIMEOUTS_KILLED, 1);                \
          /* pthread_kill((OS_PTR)->op, SIGKILL); */                     \
          pthread_cancel((OS_PTR)->op);                                  \
                                                                         \
@@ -190,6 +438,7 @@ int timed_sem_wait(sem_t* sem, size_t timeout_sec) {
       if (timed_sem_wait((SEM_PTR), (TIMEOUT_SEC))) {                   \
          LOG(LOG_ERR, "timed_sem_wait failed. (%s)\n", strerror(errno)); \
          (OS_PTR)->flags |= OSF_TIMEOUT;                                \
+         stream_count((OS_PTR), IOS_TIMEOUTS, 1);                       \
          return -1;                                                     \
       }                                                                 \
    } while (0)
@@ -199,6 +448,7 @@ int timed_sem_wait(sem_t* sem, size_t timeout_sec) {
       if (timed_sem_wait((SEM_PTR), (TIMEOUT_SEC))) {                   \
          LOG(LOG_ERR, "timed_sem_wait failed. (%s)  Killing thread.\n", strerror(errno)); \
          (OS_PTR)->flags |= OSF_TIMEOUT_K;                              \
+         stream_count((OS_PTR), IOS_TIMEOUTS_KILLED, 1);                \
          /* pthread_kill((OS_PTR)->op, SIGKILL); */                     \
          pthread_cancel((OS_PTR)->op);                                  \
                                                                         \
@@ -219,6 +469,74 @@ int timed_sem_wait(sem_t* sem, size_t timeout_sec) {
 #endif
 
 
+// ...........................................................................
+// GET responses
+//
+// marfs_read() waits (with a deadline) for the first response to a GET,
+// to decide whether to hedge it.  The op-threads mark the response with
+// stream_responded(), which wakes any such waiters.  Waiters are rare, so
+// the op-threads only take the lock when someone is waiting.
+// ...........................................................................
+
+static pthread_mutex_t responded_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  responded_cond;
+static pthread_once_t  responded_once = PTHREAD_ONCE_INIT;
+static volatile int    responded_waiters = 0;
+
+// deadlines come from latency_now(), which is CLOCK_MONOTONIC
+static void responded_init() {
+   pthread_condattr_t attr;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&responded_cond, &attr);
+   pthread_condattr_destroy(&attr);
+}
+
+// <flag> is one of the OSF_RESPONDED flags.  Only the first one matters.
+static void stream_responded(ObjectStream* os, OSFlags_t flag) {
+   int first = !(os->flags & OSF_RESPONDED);
+   os->flags |= flag;
+   if (! first)
+      return;
+
+   // pairs with the increment in stream_wait_responded()
+   __sync_synchronize();
+   if (responded_waiters) {
+      pthread_mutex_lock(&responded_lock);
+      pthread_cond_broadcast(&responded_cond);
+      pthread_mutex_unlock(&responded_lock);
+   }
+}
+
+ObjectStream* stream_wait_responded(ObjectStream* os1,
+                                    ObjectStream* os2,
+                                    uint64_t      deadline_ns) {
+   struct timespec deadline = { (time_t)(deadline_ns / 1000000000ULL),
+                                (long)(deadline_ns % 1000000000ULL) };
+   ObjectStream*   winner = NULL;
+
+   pthread_once(&responded_once, responded_init);
+   pthread_mutex_lock(&responded_lock);
+   __sync_add_and_fetch(&responded_waiters, 1);
+   while (1) {
+      if (os1->flags & OSF_RESPONDED) {
+         winner = os1;
+         break;
+      }
+      if (os2 && (os2->flags & OSF_RESPONDED)) {
+         winner = os2;
+         break;
+      }
+      if (latency_now() >= deadline_ns)
+         break;
+      pthread_cond_timedwait(&responded_cond, &responded_lock, &deadline);
+   }
+   __sync_sub_and_fetch(&responded_waiters, 1);
+   pthread_mutex_unlock(&responded_lock);
+   return winner;
+}
+
+
 
 
 // ---------------------------------------------------------------------------
@@ -348,7 +666,7 @@ int s3_op_internal(ObjectStream* os) {
    if (is_get && (b->code == 206)) {
       // should we do something with os->iob_full?  set os->flags & EOF?
       LOG(LOG_INFO, "GET complete\n");
-      os->flags |= OSF_EOF;
+      stream_responded(os, OSF_EOF);
       POST(&os->iob_full);
       return 0;
    }
@@ -360,18 +678,50 @@ int s3_op_internal(ObjectStream* os) {
    return -1;
 }
 
+// Runs when s3_op() finishes, or is cancelled by SAFE_WAIT_KILL().
+static void s3_op_done(void* arg) {
+   ObjectStream* os = (ObjectStream*)arg;
+
+   stream_count(os, ((os->flags & OSF_READING) ? IOS_BYTES_IN : IOS_BYTES_OUT),
+                os->op_bytes);
+   os->op_bytes = 0;
+   stream_count(os, IOS_ACTIVE, -1);
+}
+
 // this runs as a separate thread, so that stream_open() can return
 // NOTE: If you compile w/ logging disabled, then 'b' is unused 
 void* s3_op(void* arg) {
    ObjectStream* os = (ObjectStream*)arg;
    __attribute__ ((unused)) IOBuf* b  = &os->iob;
 
+   stream_count(os, ((os->flags & OSF_READING) ? IOS_GETS : IOS_PUTS), 1);
+   stream_count(os, IOS_ACTIVE, 1);
+   pthread_cleanup_push(s3_op_done, os);
+
    if ((os->op_rc = s3_op_internal(os)))
       LOG(LOG_ERR,  "failed (%s) %d (%s) '%s'\n",
           os->url, os->op_rc, curl_easy_strerror(os->op_rc), b->result);
    else
       LOG(LOG_INFO, "done (%s)\n", os->url);
 
+   // A failed GET won't call streaming_writefunc() again, so don't leave
+   // stream_get() waiting until it times out.  (marfs_read() can then
+   // resume the GET promptly.)
+   if (os->op_rc && (os->flags & OSF_READING)) {
+      stream_responded(os, OSF_GET_FAILED);
+      POST(&os->iob_full);
+   }
+   // Likewise, a failed PUT won't call streaming_readfunc() again.
+   // (marfs_write() can then re-send the chunk promptly.)
+   else if (os->op_rc && (os->flags & OSF_WRITING)) {
+      os->flags |= OSF_PUT_FAILED;
+      POST(&os->iob_empty);
+   }
+
+   io_stats_http(os->stats_repo, b->code);
+   io_stats_http(os->stats_host, b->code);
+
+   pthread_cleanup_pop(1);
    return os;
 }
 
@@ -426,7 +776,8 @@ size_t streaming_readfunc(void* ptr, size_t size, size_t nmemb, void* stream) {
    size_t moved    = aws_iobuf_get_raw(b, (char*)ptr, move_req);
 
    // track total size
-   os->written += moved;
+   os->written  += moved;
+   os->op_bytes += moved;
    LOG(LOG_INFO, "(%08lx) moved %ld  (total: %ld)\n", (size_t)os, moved, os->written);
 
    if (b->avail) {
@@ -441,6 +792,76 @@ size_t streaming_readfunc(void* ptr, size_t size, size_t nmemb, void* stream) {
    return moved;
 }
 
+// Bytes allocated to retry-buffers, across all streams, and the limit on
+// that (see MARFS_WRITE_RETRY_BUDGET).
+static volatile size_t retry_total      = 0;
+static size_t          retry_budget_env = (size_t)-1; // -1 = not yet read
+
+static size_t retry_budget() {
+   if (retry_budget_env == (size_t)-1) {
+      const char* env = getenv("MARFS_WRITE_RETRY_BUDGET");
+      retry_budget_env = (env ? strtoull(env, NULL, 10) : MARFS_WRITE_RETRY_BUDGET);
+   }
+   return retry_budget_env;
+}
+
+static void retry_free(ObjectStream* os) {
+   if (os->retry_alloc)
+      __sync_sub_and_fetch(&retry_total, os->retry_alloc);
+   free(os->retry_buf);
+   os->retry_buf   = NULL;
+   os->retry_alloc = 0;
+}
+
+// Append a copy of <buf> to os->retry_buf, growing it as needed, up to
+// os->retry_max, and within the daemon-wide budget.  If the object
+// outgrows either, we give up on keeping a copy (and free it, for other
+// streams), and stream_put_retry() will fail.
+static void retry_save(ObjectStream* os, const char* buf, size_t size) {
+
+   size_t needed = os->retry_len + size;
+   if (needed > os->retry_max) {
+      LOG(LOG_INFO, "(%08lx) object exceeds retry-buffer max %ld\n",
+          (size_t)os, os->retry_max);
+      os->flags |= OSF_NO_RETRY;
+      retry_free(os);
+      return;
+   }
+
+   if (needed > os->retry_alloc) {
+      size_t alloc = (os->retry_alloc ? os->retry_alloc : (64 * 1024));
+      while (alloc < needed)
+         alloc *= 2;
+      if (alloc > os->retry_max)
+         alloc = os->retry_max;
+
+      size_t grow = alloc - os->retry_alloc;
+      if (__sync_add_and_fetch(&retry_total, grow) > retry_budget()) {
+         __sync_sub_and_fetch(&retry_total, grow);
+         LOG(LOG_INFO, "(%08lx) retry-buffers are at the budget (%ld)\n",
+             (size_t)os, retry_budget());
+         os->flags |= OSF_NO_RETRY;
+         retry_free(os);
+         return;
+      }
+
+      char* new_buf = (char*)realloc(os->retry_buf, alloc);
+      if (! new_buf) {
+         LOG(LOG_ERR, "(%08lx) couldn't grow retry-buffer to %ld\n",
+             (size_t)os, alloc);
+         __sync_sub_and_fetch(&retry_total, grow);
+         os->flags |= OSF_NO_RETRY;
+         retry_free(os);
+         return;
+      }
+      os->retry_buf   = new_buf;
+      os->retry_alloc = alloc;
+   }
+
+   memcpy(os->retry_buf + os->retry_len, buf, size);
+   os->retry_len = needed;
+}
+
 // Hand <buf> over to the streaming_readfunc(), so it can be added into
 // the ongoing streaming PUT.  You must call stream_open() first.
 //
@@ -469,6 +890,17 @@ int stream_put(ObjectStream* os,
    }
    IOBuf* b = &os->iob;         // shorthand
 
+   // keep a copy, for stream_put_retry().  (Not the EOF or ABORT signals
+   // from stream_sync() and stream_abort().)  file_put() doesn't need one.
+   if (os->retry_max
+       && size
+       && ! os->is_file
+       && !(os->flags & (OSF_NO_RETRY | OSF_ABORT)))
+      retry_save(os, buf, size);
+
+   if (os->is_file)
+      return file_put(os, buf, size);
+
 #if 0
    // QUESTION: Does it improve performance to copy the caller's buffer,
    //    so we can return immediately?
@@ -515,6 +947,15 @@ int stream_put(ObjectStream* os,
 
 #endif
 
+   // op-thread may have quit without consuming our buffer
+   if ((os->flags & OSF_PUT_FAILED)
+       && size
+       && !(os->flags & OSF_ABORT)) {
+      LOG(LOG_ERR, "(%08lx) PUT failed (%s)\n", (size_t)os, os->url);
+      errno = EIO;
+      return -1;
+   }
+
    LOG(LOG_INFO, "(%08lx) buffer done\n", (size_t)os); // readfunc done with IOBuf?
    return size;
 }
@@ -590,7 +1031,7 @@ size_t streaming_writeheaderfunc(void* ptr, size_t size, size_t nitems, void* st
       ObjectStream* os    = (ObjectStream*)b->user_data;
       if (!b->contentLen) {
          LOG(LOG_INFO, "detected EOF\n"); // readfunc done with IOBuf?
-         os->flags |= OSF_EOF;                            // (or error)
+         stream_responded(os, OSF_EOF);                   // (or error)
          POST(&os->iob_full);
       }
       else
@@ -607,6 +1048,19 @@ size_t streaming_writefunc(void* ptr, size_t size, size_t nmemb, void* stream) {
    size_t        total = (size * nmemb);
    LOG(LOG_INFO, "curl-buff %ld\n", total);
 
+   if (os->open_ns) {
+      latency_record(LAT_STREAM_FIRST_BYTE, latency_now() - os->open_ns);
+      os->open_ns = 0;
+   }
+
+   // The body of an error response (e.g. 503) is not object data.  Don't
+   // copy it into caller's buffer.  Returning 0 makes curl fail the GET.
+   if (b->code >= 300) {
+      LOG(LOG_ERR, "GET returned %d '%s'\n", b->code, (b->result ? b->result : ""));
+      return 0;
+   }
+   stream_responded(os, OSF_FIRST_BYTE);
+
    // wait for user-buffer, supplied to stream_get()
    WAIT(&os->iob_empty);
    LOG(LOG_INFO, "user-buff %ld\n", (b->len - b->write_count));
@@ -621,7 +1075,7 @@ size_t streaming_writefunc(void* ptr, size_t size, size_t nmemb, void* stream) {
 
    // check for EOF on the object
    if (! total) {
-      os->flags |= OSF_EOF;
+      stream_responded(os, OSF_EOF);
       POST(&os->iob_full);
       LOG(LOG_INFO, "EOF done\n");
       return 0;
@@ -663,6 +1117,7 @@ size_t streaming_writefunc(void* ptr, size_t size, size_t nmemb, void* stream) {
    }
 
    // curl-buffer is exhausted.
+   os->op_bytes += total;
    LOG(LOG_INFO, "copied all of curl-buff (writable=%ld)\n", writable);
    if (writable)
       POST(&os->iob_empty); // next curl-callback is pre-approved
@@ -706,6 +1161,16 @@ ssize_t stream_get(ObjectStream* os,
       LOG(LOG_INFO, "already at EOF\n");
       return 0; // b->write_count;
    }
+   if (os->flags & OSF_GET_FAILED) {
+      LOG(LOG_INFO, "GET already failed\n");
+      if (! buf)
+         return 0;              // stream_sync(): nothing to tell to quit
+      errno = EIO;
+      return -1;
+   }
+   if (os->is_file)
+      return file_get(os, buf, size);
+
    os->flags &= ~(OSF_EOB);
 
    aws_iobuf_reset(b);          // doesn't affect <user_data>
@@ -727,6 +1192,11 @@ ssize_t stream_get(ObjectStream* os,
    if (os->flags & OSF_EOB) {
       LOG(LOG_INFO, "EOB is asserted\n");
    }
+   if ((os->flags & OSF_GET_FAILED) && ! b->write_count) {
+      LOG(LOG_INFO, "GET failed\n");
+      errno = EIO;
+      return -1;
+   }
 
    os->written += b->write_count;
    LOG(LOG_INFO, "returning %ld (total=%ld)\n", b->write_count, os->written);
@@ -764,10 +1234,17 @@ ssize_t stream_get(ObjectStream* os,
 //       
 // ---------------------------------------------------------------------------
 
+void stream_range(ObjectStream* os, size_t offset, ssize_t length) {
+   os->range_offset = offset;
+   if (! os->is_file)
+      s3_set_byte_range_r(offset, length, os->iob.context);
+}
+
 int stream_open(ObjectStream* os,
                 IsPut         put,
                 curl_off_t    content_length,
                 uint8_t       preserve_os_written) {
+   LATENCY_SCOPE(LAT_STREAM_OPEN);
    LOG(LOG_INFO, "%s\n", ((put) ? "PUT" : "GET"));
 
    if (os->flags & OSF_OPEN) {
@@ -796,6 +1273,19 @@ int stream_open(ObjectStream* os,
    if (! preserve_os_written)
       os->written = 0;          // total read/written through OS
 
+   // start a new copy of the object, for stream_put_retry()
+   os->retry_len  = 0;
+   os->retry_base = os->written;
+
+   os->content_len = content_length;
+   if (os->is_file) {
+      if (file_open(os, put)) {
+         os->flags = OSF_CLOSED; // stream_open() can try again
+         return -1;
+      }
+      return 0;
+   }
+
    // caller's open-flags, in case we need to close/repoen
    // (e.g. for Multi, or marfs_ftruncate())
    //
@@ -816,7 +1306,6 @@ int stream_open(ObjectStream* os,
 
    AWSContext* ctx = b->context;
 
-   os->content_len = content_length;
    if (content_length) {
       s3_set_content_length_r(content_length, ctx);
       // os->flags |= OSF_LENGTH;
@@ -837,6 +1326,9 @@ int stream_open(ObjectStream* os,
       aws_iobuf_writefunc(b, &streaming_writefunc);
    }
 
+   // streaming_writefunc() records time-to-first-byte for GETs
+   os->open_ns = (put ? 0 : latency_now());
+
    // thread runs the GET/PUT, with the iobuf in <os>
    LOG(LOG_INFO, "starting thread\n");
    if (pthread_create(&os->op, NULL, &s3_op, os)) {
@@ -894,6 +1386,7 @@ int stream_open(ObjectStream* os,
 
 // wait for the S3 GET/PUT to complete
 int stream_sync(ObjectStream* os) {
+   LATENCY_SCOPE(LAT_STREAM_SYNC);
 
    ///   // TBD: this should be a per-repo config-option
    ///   static const time_t timeout_sec = 5;
@@ -906,6 +1399,8 @@ int stream_sync(ObjectStream* os) {
       errno = EINVAL;            /* ?? */
       return -1;
    }
+   if (os->is_file)
+      return file_sync(os);
 
    // See NOTE, above, regarding the difference between reads and writes.
    if (! pthread_tryjoin_np(os->op, &retval)) {
@@ -1063,6 +1558,8 @@ int stream_abort(ObjectStream* os) {
       errno = ENOSYS;
       return -1;
    }
+   if (os->is_file)
+      return file_abort(os);
 
    // See NOTE, above, regarding the difference between reads and writes.
    void* retval;
@@ -1124,6 +1621,7 @@ int stream_abort(ObjectStream* os) {
 // ---------------------------------------------------------------------------
 
 int stream_close(ObjectStream* os) {
+   LATENCY_SCOPE(LAT_STREAM_CLOSE);
 
    LOG(LOG_INFO, "entry\n");
    if (! (os->flags & OSF_OPEN)) {
@@ -1131,6 +1629,8 @@ int stream_close(ObjectStream* os) {
       errno = EINVAL;            /* ?? */
       return -1;
    }
+   if (os->is_file)
+      return file_close(os);
 
    SEM_DESTROY(&os->iob_empty);
    SEM_DESTROY(&os->iob_full);
@@ -1172,6 +1672,83 @@ int stream_close(ObjectStream* os) {
 
 
 
+// ---------------------------------------------------------------------------
+// RETRY
+//
+// Objects are written in a single streaming PUT, so a failure part-way
+// through (e.g. server resets the connection, or returns a 5xx) loses the
+// whole object.  If stream_retry_buf() was called before stream_open(),
+// stream_put() keeps a copy of the data, and stream_put_retry() can PUT
+// it all again, to the same URL.  The caller can then continue with
+// stream_put(), etc, as though nothing happened.
+//
+// The caller is responsible for waiting between attempts, and may change
+// the host in os->iob.context, before calling.
+// ---------------------------------------------------------------------------
+
+int stream_retry_buf(ObjectStream* os, size_t max) {
+   if (os->is_file || ! retry_budget())
+      max = 0;
+   if (! max || (os->retry_alloc > max))
+      retry_free(os);
+   os->retry_max = max;
+   return 0;
+}
+
+int stream_put_retry(ObjectStream* os) {
+
+   if (! os->retry_max
+       || (os->flags & OSF_NO_RETRY)
+       || ! (os->flags & OSF_WRITING)) {
+      LOG(LOG_ERR, "%s can't be re-sent (flags=0x%04x)\n", os->url, os->flags);
+      errno = EIO;
+      return -1;
+   }
+
+   // We already know the PUT failed, so we don't care what these return.
+   // We only need the op-thread to be gone, before we can re-open.
+   if (os->flags & OSF_OPEN) {
+      if (! (os->flags & (OSF_JOINED | OSF_TIMEOUT_K)))
+         stream_sync(os);
+      if (! (os->flags & (OSF_JOINED | OSF_TIMEOUT_K))) {
+         LOG(LOG_ERR, "couldn't stop failed PUT (%s)\n", os->url);
+         errno = EIO;
+         return -1;
+      }
+      stream_close(os);
+   }
+
+   // stream_open() resets these
+   size_t     retry_len   = os->retry_len;
+   curl_off_t content_len = os->content_len;
+
+   os->written = os->retry_base;
+   if (stream_open(os, OS_PUT, content_len, 1)) {
+      LOG(LOG_ERR, "couldn't re-open PUT (%s)\n", os->url);
+      return -1;
+   }
+
+   // stream_put() shouldn't copy the retry-buffer onto itself
+   LOG(LOG_INFO, "re-sending %ld bytes (%s)\n", retry_len, os->url);
+   if (retry_len) {
+      char* retry_buf = os->retry_buf;
+      os->retry_buf   = NULL;
+      size_t retry_max = os->retry_max;
+      os->retry_max   = 0;
+
+      int rc = stream_put(os, retry_buf, retry_len);
+
+      os->retry_buf   = retry_buf;
+      os->retry_max   = retry_max;
+      os->retry_len   = retry_len;
+      if (rc < 0)
+         return -1;
+   }
+   return 0;
+}
+
+
+
 
 // Reset everything except URL.  Also, use aws_iob_reset() to reset
 // os->iob.
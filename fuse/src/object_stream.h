@@ -116,6 +116,7 @@ OF SUCH DAMAGE.
 #define _MARFS_OBJECTS_H
 
 #include "common.h"             // only for MARFS_MAX_URL_SIZE
+#include "io_stats.h"
 #include <aws4c.h>
 #include <pthread.h>
 
@@ -147,6 +148,10 @@ typedef enum {
    OSF_ABORT      = 0x0100,       // stream_abort(), or stream_sync()
    OSF_JOINED     = 0x0200,
    OSF_CLOSED     = 0x0400,
+   OSF_GET_FAILED = 0x0800,     // GET op-thread failed.  stream_get() won't wait
+   OSF_PUT_FAILED = 0x1000,     // PUT op-thread failed.  stream_put() won't wait
+   OSF_NO_RETRY   = 0x2000,     // retry-buffer overflowed.  (see stream_put_retry())
+   OSF_FIRST_BYTE = 0x4000,     // GET has received some data
 } OSFlags;
 typedef uint16_t OSFlags_t;
 
@@ -154,6 +159,10 @@ typedef uint16_t OSFlags_t;
 // stream, so stream_sync() should take note
 #define OSF_ERRORS (OSF_TIMEOUT | OSF_TIMEOUT_K)
 
+// A GET with any of these has heard back from the server (with data, EOF,
+// or failure).  Until then, marfs_read() may hedge it.
+#define OSF_RESPONDED (OSF_FIRST_BYTE | OSF_EOF | OSF_GET_FAILED)
+
 
 // flags for call to stream_open()
 typedef enum {
@@ -190,6 +199,29 @@ typedef struct {
    size_t              written;   // bytes written-to/read-from stream
    size_t              content_len;
    volatile OSFlags_t  flags;
+   uint64_t            open_ns;   // GET start, until first byte (see latency.h)
+   IoStats*            stats_repo; // counters (see io_stats.h).  May be NULL
+   IoStats*            stats_host;
+   size_t              op_bytes;  // moved by the op-thread, not yet counted
+
+   // copy of everything stream_put() into the current object, so a failed
+   // PUT can be re-sent.  (see stream_retry_buf())
+   char*               retry_buf;
+   size_t              retry_alloc; // allocated size of <retry_buf>
+   size_t              retry_max;   // 0 = disabled
+   size_t              retry_len;
+   size_t              retry_base;  // <written>, as of stream_open()
+
+   // SEMI_DIRECT repos keep objects as files.  Then <url> is the path,
+   // and there's no op-thread.  (see update_url(), and "FILES" in
+   // object_stream.c)
+   uint8_t             is_file;
+   uint8_t             file_direct; // opened with O_DIRECT
+   int                 file_fd;     // 0 = not open
+   size_t              file_pos;    // offset of next pread()/pwrite()
+   char*               dio_buf;     // aligned buffer, for O_DIRECT
+   size_t              dio_len;     // data waiting in <dio_buf> (writes)
+   size_t              range_offset; // see stream_range()
 
    // OSOpenFlags       open_flags; // caller's open flags, for when we need to close/repoen
 } ObjectStream;
@@ -201,6 +233,10 @@ typedef enum {
 } IsPut;
 
 
+// Set the byte-range for the next GET, before calling stream_open().
+// <length> -1 means "to the end".
+void    stream_range(ObjectStream* os, size_t offset, ssize_t length);
+
 // Initialize os.url, before calling.  Use <preserve_os_written> to prevent
 // resetting the count of data written, in os->written
 int     stream_open(ObjectStream* os, IsPut put, curl_off_t content_length, uint8_t preserve_os_written);
@@ -213,6 +249,25 @@ int     stream_abort(ObjectStream* os);
 
 int     stream_close(ObjectStream* os);
 
+// Allow stream_put() to keep a copy of up to <max> bytes of the object
+// being PUT, so that stream_put_retry() can re-send it, if the PUT fails.
+// The buffer grows as needed, within a budget shared by all streams (see
+// MARFS_WRITE_RETRY_BUDGET).  <max>=0 frees it.  Ignored for semi-direct
+// (file) streams.
+int     stream_retry_buf(ObjectStream* os, size_t max);
+
+// After a failed PUT, stop the op-thread, then re-open the stream and
+// re-send everything that was PUT since stream_open().  Fails if there
+// was no retry-buffer, or the object outgrew it.
+int     stream_put_retry(ObjectStream* os);
+
+// Wait until <os1> (or <os2>, if non-NULL) has OSF_RESPONDED, or until
+// <deadline_ns> (see latency_now()).  Returns the first one that
+// responded, or NULL.  (see hedge_get(), in marfs_ops.c)
+ObjectStream* stream_wait_responded(ObjectStream* os1,
+                                    ObjectStream* os2,
+                                    uint64_t      deadline_ns);
+
 
 
 
@@ -0,0 +1,482 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// _GNU_SOURCE exposes dirent.d_type, under -std=c99
+#define _GNU_SOURCE
+
+#include "logging.h"
+#include "common.h"
+#include "marfs_ops.h"
+#include "stat_cache.h"
+#include "purge.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+
+typedef enum {
+   PS_IDLE = 0,
+   PS_RUNNING,
+   PS_CANCELLING,
+   PS_DONE,
+   PS_CANCELLED,
+} PurgeState;
+
+static const char* purge_state_names[] = {
+   "idle", "running", "cancelling", "done", "cancelled"
+};
+
+
+// Everything about the current (or last) purge.  <lock> protects the
+// queue and <state>.  Counters are only added to (with __sync), and read
+// without the lock.
+typedef struct {
+   pthread_mutex_t   lock;
+   pthread_cond_t    not_empty;
+   pthread_cond_t    not_full;
+
+   volatile PurgeState state;
+   uid_t             uid;
+   gid_t             gid;
+   char              path[MARFS_MAX_MD_PATH];     // marfs path of top dir
+   char              md_path[MARFS_MAX_MD_PATH];  // MDFS path of top dir
+   time_t            start;
+   time_t            end;
+
+   // files waiting for a worker (marfs paths)
+   char            (*queue)[MARFS_MAX_MD_PATH];
+   size_t            head;
+   size_t            count;
+   int               walk_done;
+
+   // subdirs seen by the walk, in the order found (parents first)
+   char**            dirs;
+   size_t            dir_count;
+   size_t            dir_alloc;
+
+   volatile size_t   files;
+   volatile size_t   failed;
+   volatile size_t   dirs_seen;
+   volatile size_t   dirs_removed;
+} Purge;
+
+static Purge purge = {
+   .lock      = PTHREAD_MUTEX_INITIALIZER,
+   .not_empty = PTHREAD_COND_INITIALIZER,
+   .not_full  = PTHREAD_COND_INITIALIZER,
+   .state     = PS_IDLE,
+};
+
+
+static int purge_cancelled() {
+   return (purge.state == PS_CANCELLING);
+}
+
+
+// Called by the walker.  Waits for room in the queue.
+static void queue_push(const char* path) {
+   pthread_mutex_lock(&purge.lock);
+   while (purge.count == PURGE_QUEUE_SIZE)
+      pthread_cond_wait(&purge.not_full, &purge.lock);
+
+   size_t tail = (purge.head + purge.count) % PURGE_QUEUE_SIZE;
+   strcpy(purge.queue[tail], path);
+   purge.count += 1;
+
+   pthread_cond_signal(&purge.not_empty);
+   pthread_mutex_unlock(&purge.lock);
+}
+
+// Called by workers.  Copies the next path into <path>.  Returns 0 when
+// the queue is empty and the walk is finished.
+static int queue_pop(char* path) {
+   int found = 0;
+
+   pthread_mutex_lock(&purge.lock);
+   while (! purge.count && ! purge.walk_done)
+      pthread_cond_wait(&purge.not_empty, &purge.lock);
+
+   if (purge.count) {
+      strcpy(path, purge.queue[purge.head]);
+      purge.head   = (purge.head + 1) % PURGE_QUEUE_SIZE;
+      purge.count -= 1;
+      found = 1;
+      pthread_cond_signal(&purge.not_full);
+   }
+   pthread_mutex_unlock(&purge.lock);
+
+   return found;
+}
+
+// Only the walker touches the dir-list, until the workers are done.
+static int dir_list_add(const char* path) {
+   if (purge.dir_count == purge.dir_alloc) {
+      size_t alloc = (purge.dir_alloc ? purge.dir_alloc * 2 : 1024);
+      char** dirs  = (char**)realloc(purge.dirs, alloc * sizeof(char*));
+      if (! dirs)
+         return -1;
+      purge.dirs      = dirs;
+      purge.dir_alloc = alloc;
+   }
+   if (! (purge.dirs[purge.dir_count] = strdup(path)))
+      return -1;
+   purge.dir_count += 1;
+   return 0;
+}
+
+static void dir_list_free() {
+   size_t i;
+   for (i=0; i<purge.dir_count; ++i)
+      free(purge.dirs[i]);
+   free(purge.dirs);
+   purge.dirs      = NULL;
+   purge.dir_count = 0;
+   purge.dir_alloc = 0;
+}
+
+
+
+// Walk the MDFS directory <md_path> (which is <path>, in marfs), queueing
+// the files for the workers, and recording subdirs, which are walked in
+// turn.  Failures are counted, and we carry on with the rest of the tree.
+static void purge_walk(const char* path, const char* md_path) {
+   DIR* dirp = opendir(md_path);
+   if (! dirp) {
+      LOG(LOG_ERR, "opendir(%s) failed: %s\n", md_path, strerror(errno));
+      __sync_fetch_and_add(&purge.failed, 1);
+      return;
+   }
+
+   char           child[MARFS_MAX_MD_PATH];
+   char           md_child[MARFS_MAX_MD_PATH];
+   struct dirent* dent;
+
+   while (! purge_cancelled()
+          && (dent = readdir(dirp))) {
+
+      if (! strcmp(dent->d_name, ".")
+          || ! strcmp(dent->d_name, ".."))
+         continue;
+
+      if ((snprintf(child, MARFS_MAX_MD_PATH, "%s/%s", path, dent->d_name)
+           >= MARFS_MAX_MD_PATH)
+          || (snprintf(md_child, MARFS_MAX_MD_PATH, "%s/%s", md_path, dent->d_name)
+              >= MARFS_MAX_MD_PATH)) {
+         LOG(LOG_ERR, "path too long, under %s\n", path);
+         __sync_fetch_and_add(&purge.failed, 1);
+         continue;
+      }
+
+      int is_dir = (dent->d_type == DT_DIR);
+      if (dent->d_type == DT_UNKNOWN) {
+         struct stat st;
+         if (lstat(md_child, &st)) {
+            LOG(LOG_ERR, "lstat(%s) failed: %s\n", md_child, strerror(errno));
+            __sync_fetch_and_add(&purge.failed, 1);
+            continue;
+         }
+         is_dir = S_ISDIR(st.st_mode);
+      }
+
+      if (is_dir) {
+         __sync_fetch_and_add(&purge.dirs_seen, 1);
+         if (dir_list_add(child)) {
+            LOG(LOG_ERR, "couldn't record dir %s\n", child);
+            __sync_fetch_and_add(&purge.failed, 1);
+         }
+         purge_walk(child, md_child);
+      }
+      else
+         queue_push(child);
+   }
+
+   closedir(dirp);
+}
+
+
+static void* purge_worker(void* arg) {
+   uid_t saved_euid = -1;
+   gid_t saved_egid = -1;
+   if (push_user(&saved_euid, &saved_egid, purge.uid, purge.gid)) {
+      LOG(LOG_ERR, "push_user(%d, %d) failed\n", purge.uid, purge.gid);
+      return NULL;
+   }
+
+   char path[MARFS_MAX_MD_PATH];
+   while (queue_pop(path)) {
+      int rc = marfs_unlink(path);
+      stat_cache_invalidate(path, SCI_PARENT);
+      if (rc) {
+         LOG(LOG_ERR, "unlink(%s) failed: %s\n", path, strerror(errno));
+         __sync_fetch_and_add(&purge.failed, 1);
+      }
+      else
+         __sync_fetch_and_add(&purge.files, 1);
+   }
+
+   pop_user(&saved_euid, &saved_egid);
+   return NULL;
+}
+
+
+// Runs the walk, waits for the workers, then removes the subdirs.
+static void* purge_main(void* arg) {
+   pthread_t worker[PURGE_THREADS];
+   int       n_workers = 0;
+   int       i;
+
+   uid_t saved_euid = -1;
+   gid_t saved_egid = -1;
+   if (push_user(&saved_euid, &saved_egid, purge.uid, purge.gid)) {
+      LOG(LOG_ERR, "push_user(%d, %d) failed\n", purge.uid, purge.gid);
+      __sync_fetch_and_add(&purge.failed, 1);
+   }
+   else {
+      for (i=0; i<PURGE_THREADS; ++i) {
+         if (pthread_create(&worker[n_workers], NULL, purge_worker, NULL))
+            LOG(LOG_ERR, "couldn't start worker %d\n", i);
+         else
+            ++ n_workers;
+      }
+
+      if (n_workers)
+         purge_walk(purge.path, purge.md_path);
+      else
+         __sync_fetch_and_add(&purge.failed, 1);
+   }
+
+   pthread_mutex_lock(&purge.lock);
+   purge.walk_done = 1;
+   pthread_cond_broadcast(&purge.not_empty);
+   pthread_mutex_unlock(&purge.lock);
+
+   for (i=0; i<n_workers; ++i)
+      pthread_join(worker[i], NULL);
+
+   // children were recorded after their parents, so go backwards
+   size_t d;
+   for (d=purge.dir_count; d && ! purge_cancelled(); --d) {
+      const char* dir = purge.dirs[d -1];
+      int rc = marfs_rmdir(dir);
+      stat_cache_invalidate(dir, SCI_PARENT);
+      if (rc) {
+         LOG(LOG_ERR, "rmdir(%s) failed: %s\n", dir, strerror(errno));
+         __sync_fetch_and_add(&purge.failed, 1);
+      }
+      else
+         __sync_fetch_and_add(&purge.dirs_removed, 1);
+   }
+   dir_list_free();
+
+   if (n_workers)
+      pop_user(&saved_euid, &saved_egid);
+
+   pthread_mutex_lock(&purge.lock);
+   free(purge.queue);
+   purge.queue = NULL;
+   purge.end   = time(NULL);
+   purge.state = ((purge.state == PS_CANCELLING) ? PS_CANCELLED : PS_DONE);
+   pthread_mutex_unlock(&purge.lock);
+
+   LOG(LOG_INFO, "purge %s: %s files=%ld failed=%ld dirs_removed=%ld\n",
+       purge.path, purge_state_names[purge.state],
+       purge.files, purge.failed, purge.dirs_removed);
+   return NULL;
+}
+
+
+
+int purge_start(const char* path, uid_t uid, gid_t gid) {
+   TRY_DECLS();
+
+   PathInfo info;
+   init_path_info(&info);
+   __TRY0(expand_path_info, &info, path);
+   __TRY0(stat_regular, &info);
+   if (! S_ISDIR(info.st.st_mode)) {
+      errno = ENOTDIR;
+      return -1;
+   }
+   if ((strlen(path) >= MARFS_MAX_MD_PATH)
+       || (strlen(info.post.md_path) >= MARFS_MAX_MD_PATH)) {
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+
+   pthread_mutex_lock(&purge.lock);
+   if ((purge.state == PS_RUNNING)
+       || (purge.state == PS_CANCELLING)) {
+      pthread_mutex_unlock(&purge.lock);
+      errno = EBUSY;
+      return -1;
+   }
+
+   purge.queue = malloc(PURGE_QUEUE_SIZE * sizeof(*purge.queue));
+   if (! purge.queue) {
+      pthread_mutex_unlock(&purge.lock);
+      errno = ENOMEM;
+      return -1;
+   }
+   purge.head      = 0;
+   purge.count     = 0;
+   purge.walk_done = 0;
+
+   strcpy(purge.path,    path);
+   strcpy(purge.md_path, info.post.md_path);
+   purge.uid          = uid;
+   purge.gid          = gid;
+   purge.start        = time(NULL);
+   purge.end          = 0;
+   purge.files        = 0;
+   purge.failed       = 0;
+   purge.dirs_seen    = 0;
+   purge.dirs_removed = 0;
+
+   pthread_t      thr;
+   pthread_attr_t attr;
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   rc = pthread_create(&thr, &attr, purge_main, NULL);
+   pthread_attr_destroy(&attr);
+   if (rc) {
+      free(purge.queue);
+      purge.queue = NULL;
+      pthread_mutex_unlock(&purge.lock);
+      errno = rc;
+      return -1;
+   }
+
+   purge.state = PS_RUNNING;
+   pthread_mutex_unlock(&purge.lock);
+
+   LOG(LOG_INFO, "purging %s (%s) as %d/%d\n", path, purge.md_path, uid, gid);
+   return 0;
+}
+
+
+int purge_cancel(uid_t uid) {
+   pthread_mutex_lock(&purge.lock);
+   if (purge.state == PS_RUNNING) {
+      if (uid && (uid != purge.uid)) {
+         pthread_mutex_unlock(&purge.lock);
+         LOG(LOG_ERR, "%d can't cancel purge of %s by %d\n",
+             uid, purge.path, purge.uid);
+         errno = EPERM;
+         return -1;
+      }
+      purge.state = PS_CANCELLING;
+   }
+   pthread_mutex_unlock(&purge.lock);
+   return 0;
+}
+
+
+int purge_report(char* buf, size_t size, uid_t uid) {
+   int n;
+
+   pthread_mutex_lock(&purge.lock);
+   if (uid && (uid != purge.uid)) {
+      n = snprintf(buf, size, "purge %s\n", purge_state_names[purge.state]);
+      pthread_mutex_unlock(&purge.lock);
+      if (n >= (int)size) {
+         errno = ENOSPC;
+         return -1;
+      }
+      return n;
+   }
+
+   time_t end = ((purge.state == PS_IDLE)
+                 ? purge.start
+                 : (purge.end ? purge.end : time(NULL)));
+   n = snprintf(buf, size,
+                    "purge %s path=%s files=%ld failed=%ld dirs=%ld dirs_removed=%ld secs=%ld\n",
+                    purge_state_names[purge.state],
+                    purge.path,
+                    purge.files,
+                    purge.failed,
+                    purge.dirs_seen,
+                    purge.dirs_removed,
+                    (long)(end - purge.start));
+   pthread_mutex_unlock(&purge.lock);
+
+   if (n >= (int)size) {
+      errno = ENOSPC;
+      return -1;
+   }
+   return n;
+}
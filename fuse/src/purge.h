@@ -0,0 +1,142 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// ---------------------------------------------------------------------------
+// Bulk delete ("purge")
+//
+// 'rm -rf' of a big tree goes through fuse one file at a time, and each
+// unlink() is a synchronous expand_path_info / stat_xattrs / trash /
+// unlink sequence, on the caller's thread.  Purge does the same work (via
+// marfs_unlink() and marfs_rmdir()) for a whole subtree, in the daemon,
+// with a pool of worker threads.  One thread walks the MDFS directories
+// directly, and queues the files it finds.  The workers move them to the
+// trash.  When the files are gone, the emptied subdirectories are removed,
+// deepest first.  The top directory itself is left in place.
+//
+// The walk and the workers run with the credentials of the user who
+// started the purge, so they can't delete anything the user couldn't.
+//
+// Only one purge runs at a time.  purge_start() returns as soon as the
+// threads are running.  Progress can be polled with purge_report().
+//
+// Fuse: see MARFS_IOC_PURGE, MARFS_IOC_PURGE_STATUS, and
+// MARFS_IOC_PURGE_CANCEL, in marfs_ops.h.
+// ---------------------------------------------------------------------------
+
+#ifndef _MARFS_PURGE_H
+#define _MARFS_PURGE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif
+
+
+// may be overridden at compile-time
+#ifndef PURGE_THREADS
+#  define PURGE_THREADS      16
+#endif
+
+#define PURGE_QUEUE_SIZE     1024   /* files waiting for a worker */
+
+
+// Start purging the tree under <path> (a marfs path, e.g. "/ns/dir"), as
+// user <uid>/<gid>.  Returns -1 (EBUSY) if a purge is already running.
+extern int  purge_start(const char* path, uid_t uid, gid_t gid);
+
+// Ask a running purge to stop, on behalf of user <uid>.  Only the user
+// who started it (or root) may cancel it; others get -1 (EPERM).  Files
+// already queued are still deleted.
+extern int  purge_cancel(uid_t uid);
+
+// One line, for user <uid>:
+//
+//    purge <state> path=<path> files=<n> failed=<n> dirs=<n> dirs_removed=<n> secs=<n>
+//
+// where <state> is one of idle, running, cancelling, done, cancelled.
+// Users other than root, and the user who started the purge, only get
+// "purge <state>".
+//
+// Always NUL-terminated.  Returns the length, or -1 (ENOSPC) if it had
+// to be truncated.
+extern int  purge_report(char* buf, size_t size, uid_t uid);
+
+
+#  ifdef __cplusplus
+}
+#  endif
+
+
+#endif // _MARFS_PURGE_H
@@ -0,0 +1,272 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+#define _XOPEN_SOURCE 700       /* POSIX 2008: clock_gettime(), strdup() */
+
+#include "logging.h"
+#include "stat_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+
+typedef struct {
+   char*         path;          // NULL means empty
+   uid_t         uid;
+   gid_t         gid;
+   uint32_t      seq;           // bumped by every invalidation of this slot
+   uint32_t      gen;           // value of sc_gen when inserted
+   double        expires;
+   struct stat   st;
+} StatCacheEntry;
+
+
+static StatCacheEntry*    sc_table = NULL; // NULL means cache is disabled
+static pthread_mutex_t    sc_lock[STAT_CACHE_LOCKS];
+static double             sc_ttl   = 0.0;
+
+// SCI_ALL just bumps this, which makes every existing entry stale
+static volatile uint32_t  sc_gen   = 0;
+
+
+
+static double sc_now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// FNV-1a
+static uint32_t sc_slot(const char* path) {
+   uint32_t hash = 2166136261u;
+   const unsigned char* ptr;
+   for (ptr=(const unsigned char*)path; *ptr; ++ptr) {
+      hash ^= *ptr;
+      hash *= 16777619u;
+   }
+   return hash & (STAT_CACHE_SLOTS -1);
+}
+
+
+
+int stat_cache_init(double ttl_secs) {
+   int i;
+
+   if (ttl_secs <= 0.0) {
+      LOG(LOG_INFO, "stat-cache disabled\n");
+      return 0;
+   }
+
+   sc_table = (StatCacheEntry*)calloc(STAT_CACHE_SLOTS, sizeof(StatCacheEntry));
+   if (! sc_table) {
+      LOG(LOG_ERR, "couldn't allocate %d stat-cache entries\n", STAT_CACHE_SLOTS);
+      errno = ENOMEM;
+      return -1;
+   }
+   for (i=0; i<STAT_CACHE_LOCKS; ++i)
+      pthread_mutex_init(&sc_lock[i], NULL);
+
+   sc_ttl = ttl_secs;
+   LOG(LOG_INFO, "stat-cache: %d slots, ttl %.3f sec\n", STAT_CACHE_SLOTS, sc_ttl);
+   return 0;
+}
+
+
+int stat_cache_get(const char*     path,
+                   uid_t           uid,
+                   gid_t           gid,
+                   struct stat*    st,
+                   StatCacheToken* tok) {
+
+   if (! sc_table)
+      return 0;
+
+   uint32_t         slot = sc_slot(path);
+   StatCacheEntry*  e    = &sc_table[slot];
+   pthread_mutex_t* lock = &sc_lock[slot % STAT_CACHE_LOCKS];
+   uint32_t         gen  = sc_gen;
+   double           now  = sc_now();
+   int              hit  = 0;
+
+   pthread_mutex_lock(lock);
+   if (e->path
+       && (e->gen == gen)
+       && (e->uid == uid)
+       && (e->gid == gid)
+       && (e->expires > now)
+       && (! strcmp(e->path, path))) {
+      *st = e->st;
+      hit = 1;
+   }
+   else {
+      tok->slot = slot;
+      tok->seq  = e->seq;
+      tok->gen  = gen;
+   }
+   pthread_mutex_unlock(lock);
+
+   return hit;
+}
+
+
+void stat_cache_put(const char*           path,
+                    uid_t                 uid,
+                    gid_t                 gid,
+                    const struct stat*    st,
+                    const StatCacheToken* tok) {
+
+   if (! sc_table)
+      return;
+
+   StatCacheEntry*  e    = &sc_table[tok->slot];
+   pthread_mutex_t* lock = &sc_lock[tok->slot % STAT_CACHE_LOCKS];
+
+   pthread_mutex_lock(lock);
+
+   // somebody invalidated this slot (or everything) since stat_cache_get()
+   if ((e->seq != tok->seq) || (sc_gen != tok->gen)) {
+      pthread_mutex_unlock(lock);
+      return;
+   }
+
+   if (! e->path || strcmp(e->path, path)) {
+      free(e->path);
+      e->path = strdup(path);
+   }
+   if (e->path) {
+      e->uid     = uid;
+      e->gid     = gid;
+      e->gen     = tok->gen;
+      e->expires = sc_now() + sc_ttl;
+      e->st      = *st;
+   }
+   pthread_mutex_unlock(lock);
+}
+
+
+// NOTE: The caller's stat was taken before we got the token, so an
+//       invalidation that lands in between won't be seen.  That window is
+//       tiny, and the entry still expires after <sc_ttl>.
+void stat_cache_prime(const char*        path,
+                      uid_t              uid,
+                      gid_t              gid,
+                      const struct stat* st) {
+   StatCacheToken tok;
+   struct stat    cached;
+
+   if (! stat_cache_get(path, uid, gid, &cached, &tok))
+      stat_cache_put(path, uid, gid, st, &tok);
+}
+
+
+void stat_cache_invalidate(const char* path, StatCacheInval how) {
+
+   if (! sc_table)
+      return;
+
+   if (how & SCI_ALL) {
+      __sync_add_and_fetch(&sc_gen, 1);
+      return;
+   }
+
+   uint32_t         slot = sc_slot(path);
+   StatCacheEntry*  e    = &sc_table[slot];
+   pthread_mutex_t* lock = &sc_lock[slot % STAT_CACHE_LOCKS];
+
+   pthread_mutex_lock(lock);
+   e->seq += 1;
+   if (e->path && ! strcmp(e->path, path)) {
+      free(e->path);
+      e->path = NULL;
+   }
+   pthread_mutex_unlock(lock);
+
+   // creating/removing an entry changes the parent's mtime, nlink, etc
+   if (how & SCI_PARENT) {
+      const char* slash = strrchr(path, '/');
+      if (slash && (slash != path)) {
+         size_t len    = slash - path;
+         char*  parent = (char*)malloc(len +1);
+         if (parent) {
+            memcpy(parent, path, len);
+            parent[len] = 0;
+            stat_cache_invalidate(parent, SCI_PATH);
+            free(parent);
+         }
+      }
+      else if (slash)
+         stat_cache_invalidate("/", SCI_PATH);
+   }
+}
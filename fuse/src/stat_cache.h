@@ -0,0 +1,163 @@
+/*
+This file is part of MarFS, which is released under the BSD license.
+
+
+Copyright (c) 2015, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+-----
+NOTE:
+-----
+MarFS uses libaws4c for Amazon S3 object communication. The original version
+is at https://aws.amazon.com/code/Amazon-S3/2601 and under the LGPL license.
+LANS, LLC added functionality to the original work. The original work plus
+LANS, LLC contributions is found at https://github.com/jti-lanl/aws4c.
+
+GNU licenses can be found at <http://www.gnu.org/licenses/>.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2015, Los Alamos National Security, LLC All rights reserved.
+Copyright 2015. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+// ---------------------------------------------------------------------------
+// Stat cache
+//
+// fuse_getattr() used to call marfs_getattr() every time, which does
+// expand_path_info() and lstat() on the MDFS.  'ls -l' of a big directory,
+// or a build-tool stat'ing the same handful of files over and over, turns
+// into a storm of GPFS stats.  The kernel's own attribute-cache (see
+// attr_timeout / entry_timeout) helps, but it's per-inode, and short.
+//
+// This is a small daemon-side cache of the results of marfs_getattr(),
+// keyed by the fuse path (plus the uid and gid of the caller, because
+// lstat() is done with the caller's credentials, so a stat may succeed for
+// one user or group and fail for another).  push_user() sets only the
+// effective uid and gid, so that's all of the credentials.  Entries expire after <stat_cache_ttl> seconds
+// (command-line option "-o stat_cache_ttl=SECS", 0 disables the cache).
+//
+// Our own mutating ops invalidate entries they may have changed, via
+// stat_cache_invalidate().  Changes made on other nodes (or directly in
+// the MDFS) are only noticed when an entry expires, which is the same
+// guarantee the kernel gives with attr_timeout.
+//
+// The table is direct-mapped (one entry per hash-slot, newest wins), so
+// memory use is fixed.  Slots are protected by a set of striped locks.
+// Every slot has a sequence-number that is bumped on invalidation, so that
+// a getattr that races with an invalidation can't re-insert stale info.
+// (See StatCacheToken.)
+// ---------------------------------------------------------------------------
+
+#ifndef _MARFS_STAT_CACHE_H
+#define _MARFS_STAT_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif
+
+
+// may be overridden at compile-time (should be a power of 2)
+#ifndef STAT_CACHE_SLOTS
+#  define STAT_CACHE_SLOTS       16384
+#endif
+
+#define STAT_CACHE_LOCKS         64
+#define STAT_CACHE_TTL_DEFAULT   1.0 /* seconds.  Same as fuse attr_timeout default */
+
+
+// what to throw away, in stat_cache_invalidate()
+typedef enum {
+   SCI_PATH     = 0x01,         // just <path>  (write, truncate, utime, ...)
+   SCI_PARENT   = 0x02,         // <path>, plus its parent dir (create, unlink, ...)
+   SCI_ALL      = 0x04,         // everything  (rename, chmod, chown)
+} StatCacheInval;
+
+
+// returned by stat_cache_get() on a miss, and handed back to
+// stat_cache_put(), so we can tell whether anyone invalidated the slot
+// while we were off doing the lstat().
+typedef struct {
+   uint32_t   slot;
+   uint32_t   seq;
+   uint32_t   gen;
+} StatCacheToken;
+
+
+extern int  stat_cache_init(double ttl_secs);
+
+// return 1 on a hit (and fill <st>), 0 on a miss (and fill <tok>)
+extern int  stat_cache_get(const char* path, uid_t uid, gid_t gid,
+                           struct stat* st, StatCacheToken* tok);
+
+extern void stat_cache_put(const char* path, uid_t uid, gid_t gid,
+                           const struct stat* st, const StatCacheToken* tok);
+
+extern void stat_cache_invalidate(const char* path, StatCacheInval how);
+
+// insert attributes obtained some other way than fuse_getattr() (e.g. by
+// readdir).  An entry that is already present and valid is left alone.
+extern void stat_cache_prime(const char* path, uid_t uid, gid_t gid,
+                             const struct stat* st);
+
+
+
+#  ifdef __cplusplus
+}
+#  endif
+
+#endif // _MARFS_STAT_CACHE_H
@@ -76,6 +76,9 @@ OF SUCH DAMAGE.
 #include <gpfs.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
 #include "marfs_gc.h"
 #include "aws4c.h"
 #include "marfs_configuration.h"
@@ -100,6 +103,8 @@ int main(int argc, char **argv) {
    char *outf = NULL;
    char *rdir = NULL;
    char *packed_log = NULL;
+   char *analytics_file = NULL;
+   FILE *analytics_fd = NULL;
    char packed_filename[MAX_PACKED_NAME_SIZE];
    //unsigned int uid = 0;
    int fileset_id = -1;
@@ -107,6 +112,8 @@ int main(int argc, char **argv) {
    unsigned int fileset_count = 1;
    extern char *optarg;
    unsigned int time_threshold_sec=0;
+   int delete_threads = GC_DELETE_THREADS;
+   int scan_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
  
    Fileset_Info *fileset_info_ptr;
    //char *fileset = NULL;
@@ -116,8 +123,9 @@ int main(int argc, char **argv) {
    else
       ProgName++;
 
-   while ((c=getopt(argc,argv,"d:t:p:ho:")) != EOF) {
+   while ((c=getopt(argc,argv,"a:d:t:p:n:s:ho:")) != EOF) {
       switch (c) {
+         case 'a': analytics_file = optarg; break;
          case 'd': rdir = optarg; break;
          case 'o': outf = optarg; break;
          case 't': time_threshold_sec=atoi(optarg) * DAY_SECONDS; break;
@@ -125,6 +133,8 @@ int main(int argc, char **argv) {
          case 'f': fileset = optarg; break; 
 *********/
          case 'p': packed_log = optarg; break;
+         case 'n': delete_threads = atoi(optarg); break;
+         case 's': scan_threads = atoi(optarg); break;
          case 'h': print_usage();
          default:
             exit(0);
@@ -166,19 +176,37 @@ int main(int argc, char **argv) {
    }
 
    file_status->outfd = fopen(outf,"w");
+
+   // histograms of the trash (see histo.h)
+   if (analytics_file != NULL) {
+      analytics_fd = fopen(analytics_file,"w");
+      if (analytics_fd == NULL) {
+         fprintf(stderr, "Error opening analytics file %s\n", analytics_file);
+         exit(1);
+      }
+   }
    file_status->packedfd = fopen(packed_log, "w");
    strcpy(file_status->packed_filename, packed_log);
    file_status->is_packed=0;
+   file_status->log = gc_log_new(file_status->outfd);
 
    // TEMP TEMP TEMP modify to root 
    aws_read_config("atorrez");
+   gc_delete_init(file_status, delete_threads);
 
    read_inodes(rdir,file_status,fileset_id,fileset_info_ptr,
-               fileset_count,time_threshold_sec);
-   if (file_status->is_packed) {
-      fclose(file_status->packedfd);
+               fileset_count,time_threshold_sec,scan_threads,analytics_fd);
+
+   fclose(file_status->packedfd);
+   gc_packed_finish(file_status);
+   if (file_status->is_packed)
       process_packed(file_status);
-   }
+
+   // wait for the queued object deletes
+   gc_log_flush(file_status->log);
+   gc_delete_finish();
+   gc_log_flush(file_status->log);
+   free(file_status->log);
    fclose(file_status->outfd);
 
    //TEMP TEMP TEMP FOR DEBUG
@@ -202,7 +230,9 @@ Name: print_usage
 void print_usage()
 {
    fprintf(stderr,"Usage: %s -d gpfs_path -o ouput_log_file \
-           [-p packed_tmp_file] [-t time_threshold-days] [-h] \n",ProgName);
+           [-p packed_tmp_file] [-t time_threshold-days] \
+           [-n delete_threads_per_host] [-s scan_threads] \
+           [-a analytics_file] [-h] \n",ProgName);
 }
 
 
@@ -352,6 +382,13 @@ UNI - single gpfs file and object are deleted
 MULTI = singe gpfs file and multiple objects are deleted 
 PACKED = scan makes a list (>file) that is post processed to determine if 
          all gpfs files exist for the packed object.  If so, delete all
+
+The inode space is split into ranges, and <scan_threads> threads each run
+their own inode scan, taking ranges in order (see scan_inodes()).
+
+If <analytics_fd> isn't NULL, each thread also fills its own histograms of
+the trash it sees (see analyze_trash()), and they are merged and written
+there at the end.
  
 
 *****************************************************************************/
@@ -360,15 +397,161 @@ int read_inodes(const char *fnameP,
                 int fileset_id,
                 Fileset_Info *fileset_info_ptr, 
                 size_t rec_count, 
-                unsigned int day_seconds) {
+                unsigned int day_seconds,
+                int scan_threads,
+                FILE *analytics_fd) {
+
+   int rc = 0;
+   int i;
+   gpfs_iscan_t *iscanP = NULL;
+   gpfs_fssnap_handle_t *fsP = NULL;
+   gpfs_ino_t max_inode = 0;
+   Inode_Ranges ranges;
+   GC_Scan *scans;
+   int early_exit =0;
+   Analytics analytics;
+   time_t now = time(0);
+
+   analytics_init(&analytics, now);
+
+   /*
+    *  Get the unique handle for the filesysteme
+   */
+   if ((fsP = gpfs_get_fssnaphandle_by_path(fnameP)) == NULL) {
+      rc = errno;
+      fprintf(stderr, "%s: line %d - gpfs_get_fshandle_by_path: %s\n", 
+              ProgName,__LINE__,strerror(rc));
+      early_exit = 1;
+      clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
+   }
+
+   /*
+    *  Open (and close) a scan just to get the highest inode number
+   */
+   if ((iscanP = gpfs_open_inodescan_with_xattrs(fsP, NULL, -1, NULL, 
+                                                 &max_inode)) == NULL) {
+      rc = errno;
+      fprintf(stderr, "%s: line %d - gpfs_open_inodescan: %s\n", 
+      ProgName,__LINE__,strerror(rc));
+      early_exit = 1;
+      clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
+   }
+   gpfs_close_inodescan(iscanP);
+   iscanP = NULL;
 
+   if (scan_threads < 1)
+      scan_threads = 1;
+   else if (scan_threads > GC_SCAN_THREADS_MAX)
+      scan_threads = GC_SCAN_THREADS_MAX;
+   init_ranges(&ranges, fsP, max_inode, scan_threads);
+
+   if ((scans = (GC_Scan *) calloc(scan_threads, sizeof(*scans))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      early_exit = 1;
+      clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
+   }
+
+   for (i=0; i < scan_threads; i++) {
+      scans[i].ranges       = &ranges;
+      scans[i].file_info    = *file_info_ptr;
+      scans[i].file_info.log = gc_log_new(file_info_ptr->outfd);
+      scans[i].fileset_info = *fileset_info_ptr;
+      scans[i].fileset_id   = fileset_id;
+      scans[i].day_seconds  = day_seconds;
+      scans[i].analyze      = (analytics_fd != NULL);
+      analytics_init(&scans[i].analytics, now);
+
+      // If we can't get a thread, scan from here.  The ranges that are
+      // left will be taken by whatever threads do start.
+      if (pthread_create(&scans[i].thread, NULL, scan_inodes, &scans[i]))
+         scan_inodes(&scans[i]);
+      else
+         scans[i].started = 1;
+   }
+
+   for (i=0; i < scan_threads; i++) {
+      if (scans[i].started)
+         pthread_join(scans[i].thread, NULL);
+      if (scans[i].rc)
+         rc = scans[i].rc;
+      file_info_ptr->is_packed |= scans[i].file_info.is_packed;
+      free(scans[i].file_info.log);
+      analytics_merge(&analytics, &scans[i].analytics);
+   }
+   free(scans);
+
+   if (analytics_fd != NULL) {
+      if (analytics_print(analytics_fd, &analytics))
+         fprintf(stderr, "Error writing analytics\n");
+      fclose(analytics_fd);
+   }
+   analytics_free(&analytics);
+
+   if (rc)
+      early_exit = 1;
+   clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
+   return(rc);
+}
+
+/***************************************************************************** 
+Name: init_ranges / next_range
+
+Cut the inode space (up to <max_inode>) into ranges, and hand them out to
+scan threads in order.  Returns 0 when there are no more ranges.  The
+range is [*start, *end).
+*****************************************************************************/
+void init_ranges(Inode_Ranges         *ranges, 
+                 gpfs_fssnap_handle_t *fsP, 
+                 gpfs_ino_t           max_inode, 
+                 int                  scan_threads) 
+{
+   if (max_inode == 0 || max_inode > GC_SCAN_INODE_MAX)
+      max_inode = GC_SCAN_INODE_MAX;
+
+   ranges->fsP = fsP;
+   ranges->max_inode = max_inode;
+   ranges->range_size = 
+      max_inode / (scan_threads * GC_SCAN_RANGES_PER_THREAD) + 1;
+   ranges->next = 0;
+}
+
+int next_range(Inode_Ranges *ranges, gpfs_ino_t *start, gpfs_ino_t *end)
+{
+   unsigned long long range = __sync_fetch_and_add(&ranges->next, 1);
+   unsigned long long first = range * ranges->range_size;
+   unsigned long long last  = first + ranges->range_size;
+
+   if (first > ranges->max_inode)
+      return(0);
+   if (last > (unsigned long long)ranges->max_inode +1)
+      last = (unsigned long long)ranges->max_inode +1;
+
+   *start = (gpfs_ino_t)first;
+   *end   = (gpfs_ino_t)last;
+   return(1);
+}
+
+/***************************************************************************** 
+Name: scan_inodes 
+
+One scan thread.  Opens its own inode scan, and processes inode ranges until
+there are none left.  Everything shared with other scan threads (the delete
+queues, the packed table, the packed tmp-file) has its own lock.
+*****************************************************************************/
+void *scan_inodes(void *arg) {
+   GC_Scan      *scan = (GC_Scan *) arg;
+   File_Info    *file_info_ptr = &scan->file_info;
+   Fileset_Info *fileset_info_ptr = &scan->fileset_info;
+   int          fileset_id = scan->fileset_id;
+   unsigned int day_seconds = scan->day_seconds;
+   gpfs_ino_t   start;
+   gpfs_ino_t   end;
 
    int rc = 0;
    const gpfs_iattr_t *iattrP;
    const char *xattrBP;
    unsigned int xattr_len; 
    register gpfs_iscan_t *iscanP = NULL;
-   gpfs_fssnap_handle_t *fsP = NULL;
    struct marfs_xattr mar_xattrs[MAX_MARFS_XATTR];
    struct marfs_xattr *xattr_ptr = mar_xattrs;
    int xattr_count;
@@ -390,314 +573,319 @@ int read_inodes(const char *fnameP,
 
    MarFS_XattrPost post;
   
-   int early_exit =0;
    int xattr_index;
    char *md_path_ptr;
    const struct stat* st = NULL;
    char repo_name[MARFS_MAX_REPO_NAME];
 
 
-   /*
-    *  Get the unique handle for the filesysteme
-   */
-   if ((fsP = gpfs_get_fssnaphandle_by_path(fnameP)) == NULL) {
-      rc = errno;
-      fprintf(stderr, "%s: line %d - gpfs_get_fshandle_by_path: %s\n", 
-              ProgName,__LINE__,strerror(rc));
-      early_exit = 1;
-      clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
-   }
-
-   /*
-    *  Open the inode file for an inode scan with xattrs
-   */
-  //if ((iscanP = gpfs_open_inodescan(fsP, NULL, NULL)) == NULL) {
-   if ((iscanP = gpfs_open_inodescan_with_xattrs(fsP, NULL, -1, NULL, NULL)) 
-           == NULL) {
-      rc = errno;
+   if ((iscanP = gpfs_open_inodescan_with_xattrs(scan->ranges->fsP, NULL, 
+                                                 -1, NULL, NULL)) == NULL) {
+      scan->rc = errno;
       fprintf(stderr, "%s: line %d - gpfs_open_inodescan: %s\n", 
-      ProgName,__LINE__,strerror(rc));
-      early_exit = 1;
-      clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
+      ProgName,__LINE__,strerror(scan->rc));
+      return(NULL);
    }
 
-
-   while (1) {
-      rc = gpfs_next_inode_with_xattrs(iscanP,
-                                       0x7FFFFFFF,
-                                       &iattrP, 
-                                       &xattrBP,
-                                       &xattr_len);
-      //rc = gpfs_next_inode(iscanP, 0x7FFFFFFF, &iattrP);
-      if (rc != 0) {
-         rc = errno;
-         fprintf(stderr, "gpfs_next_inode: %s\n", strerror(rc));
-         early_exit = 1;
-         clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
-      }
-      // Are we done?
-      if ((iattrP == NULL) || (iattrP->ia_inode > 0x7FFFFFFF))
+   while (next_range(scan->ranges, &start, &end)) {
+      if (gpfs_seek_inode(iscanP, start)) {
+         scan->rc = errno;
+         fprintf(stderr, "gpfs_seek_inode %u: %s\n", start, strerror(scan->rc));
          break;
+      }
 
-      // Determine if invalid inode error 
-      if (iattrP->ia_flags & GPFS_IAFLAG_ERROR) {
-         fprintf(stderr,"%s: invalid inode %9d (GPFS_IAFLAG_ERROR)\n", 
-                 ProgName,iattrP->ia_inode);
-         continue;
-      } 
+      while (1) {
+         rc = gpfs_next_inode_with_xattrs(iscanP,
+                                          end,
+                                          &iattrP, 
+                                          &xattrBP,
+                                          &xattr_len);
+         if (rc != 0) {
+            scan->rc = errno;
+            fprintf(stderr, "gpfs_next_inode: %s\n", strerror(scan->rc));
+            break;
+         }
+         // Are we done with this range?
+         if ((iattrP == NULL) || (iattrP->ia_inode >= end))
+            break;
+
+         // Determine if invalid inode error 
+         if (iattrP->ia_flags & GPFS_IAFLAG_ERROR) {
+            fprintf(stderr,"%s: invalid inode %9d (GPFS_IAFLAG_ERROR)\n", 
+                    ProgName,iattrP->ia_inode);
+            continue;
+         } 
 
-      // If fileset_id is specified then only look for those inodes and xattrs
-      if (fileset_id >= 0) {
-         if (fileset_id != iattrP->ia_filesetid){
-            continue; 
+         // If fileset_id is specified then only look for those inodes and xattrs
+         if (fileset_id >= 0) {
+            if (fileset_id != iattrP->ia_filesetid){
+               continue; 
+            }
          }
-      }
 
-      // Print out inode values to output file
-      // This is handy for debug at the moment
-      if (iattrP->ia_inode != 3) {	/* skip the root inode */
+         // Print out inode values to output file
+         // This is handy for debug at the moment
+         if (iattrP->ia_inode != 3) {	/* skip the root inode */
  
-         // This log commented out due to amount of inodes dumped
-         //LOG(LOG_INFO,"%u|%lld|%lld|%d|%d|%u|%u|%u|%u|%u|%lld|%d\n",
-         //   iattrP->ia_inode, iattrP->ia_size,iattrP->ia_blocks,
-         //   iattrP->ia_nlink,iattrP->ia_filesetid,
-         //   iattrP->ia_uid, iattrP->ia_gid, iattrP->ia_mode,
-         //   iattrP->ia_atime.tv_sec,iattrP->ia_mtime.tv_sec, 
-         //   iattrP->ia_blocks, iattrP->ia_xperm );
+            // This log commented out due to amount of inodes dumped
+            //LOG(LOG_INFO,"%u|%lld|%lld|%d|%d|%u|%u|%u|%u|%u|%lld|%d\n",
+            //   iattrP->ia_inode, iattrP->ia_size,iattrP->ia_blocks,
+            //   iattrP->ia_nlink,iattrP->ia_filesetid,
+            //   iattrP->ia_uid, iattrP->ia_gid, iattrP->ia_mode,
+            //   iattrP->ia_atime.tv_sec,iattrP->ia_mtime.tv_sec, 
+            //   iattrP->ia_blocks, iattrP->ia_xperm );
 
 /**********
  * Removing this for now - no need to verify that this is the trash fileset 
-         gpfs_igetfilesetname(iscanP, 
-                              iattrP->ia_filesetid, 
-                              &fileset_name_buffer, 
-                              MARFS_MAX_NAMESPACE_NAME); 
-         //if (!strcmp(fileset_name_buffer,fileset_info_ptr[0].fileset_name)) {
-         if (!strcmp(fileset_name_buffer,fileset_info_ptr->fileset_name)) {
+            gpfs_igetfilesetname(iscanP, 
+                                 iattrP->ia_filesetid, 
+                                 &fileset_name_buffer, 
+                                 MARFS_MAX_NAMESPACE_NAME); 
+            //if (!strcmp(fileset_name_buffer,fileset_info_ptr[0].fileset_name)) {
+            if (!strcmp(fileset_name_buffer,fileset_info_ptr->fileset_name)) {
 ************/
 
 
 
-         // Do we have extended attributes?
-         // This will be modified as time goes on - what xattrs do we care about
-         if (iattrP->ia_xperm == 2 && xattr_len >0 ) {
-            xattr_ptr = &mar_xattrs[0];
-            // Got ahead and get xattrs then deterimine if it is an 
-            // an actual xattr we are looking for.  If so,
-            // check if it specifies the file is trash.
-            if ((xattr_count = get_xattrs(iscanP, xattrBP, xattr_len, 
-                                          marfs_xattrs, marfs_xattr_cnt, 
-                                          xattr_ptr, 
-                                          file_info_ptr->outfd)) > 0) {
-               //marfs_xattrs has a list of xattrs found
+            // Do we have extended attributes?
+            // This will be modified as time goes on - what xattrs do we care about
+            if (iattrP->ia_xperm == 2 && xattr_len >0 ) {
                xattr_ptr = &mar_xattrs[0];
-               if ((xattr_index=get_xattr_value(xattr_ptr, 
-                    marfs_xattrs[post_index], xattr_count)) != -1 ) { 
-                    xattr_ptr = &mar_xattrs[xattr_index];
-                  LOG(LOG_INFO,"post xattr name = %s value = %s \
-                      count = %d index=%d\n", xattr_ptr->xattr_name, \
-                      xattr_ptr->xattr_value, xattr_count,xattr_index);
-                  if ((parse_post_xattr(&post, xattr_ptr))) {
-                      fprintf(stderr,"Error parsing  post xattr for inode %d\n",
-                      iattrP->ia_inode);
-                      continue;
+               // Got ahead and get xattrs then deterimine if it is an 
+               // an actual xattr we are looking for.  If so,
+               // check if it specifies the file is trash.
+               if ((xattr_count = get_xattrs(iscanP, xattrBP, xattr_len, 
+                                             marfs_xattrs, marfs_xattr_cnt, 
+                                             xattr_ptr, 
+                                             file_info_ptr->outfd)) > 0) {
+                  //marfs_xattrs has a list of xattrs found
+                  xattr_ptr = &mar_xattrs[0];
+                  if ((xattr_index=get_xattr_value(xattr_ptr, 
+                       marfs_xattrs[post_index], xattr_count)) != -1 ) { 
+                       xattr_ptr = &mar_xattrs[xattr_index];
+                     LOG(LOG_INFO,"post xattr name = %s value = %s \
+                         count = %d index=%d\n", xattr_ptr->xattr_name, \
+                         xattr_ptr->xattr_value, xattr_count,xattr_index);
+                     if ((parse_post_xattr(&post, xattr_ptr))) {
+                         fprintf(stderr,"Error parsing  post xattr for inode %d\n",
+                         iattrP->ia_inode);
+                         continue;
+                     }
                   }
-               }
-               else {
-                  fprintf(stderr,"Error:  Not finding post xattr for inode %d\n", 
-                          iattrP->ia_inode);
-               }
-
-               LOG(LOG_INFO, "found post chunk info bytes %zu\n", 
-                   post.chunk_info_bytes);
-
-               // Is this trash?
-               if (post.flags & POST_TRASH){
-                  time_t now = time(0);
+                  else {
+                     fprintf(stderr,"Error:  Not finding post xattr for inode %d\n", 
+                             iattrP->ia_inode);
+                  }
+
+                  LOG(LOG_INFO, "found post chunk info bytes %zu\n", 
+                      post.chunk_info_bytes);
+
+                  // Is this trash?
+                  if (post.flags & POST_TRASH){
+                     time_t now = time(0);
+
+                     // all the trash, not just what's old enough to go
+                     if (scan->analyze)
+                        analyze_trash(&scan->analytics, iattrP, &post,
+                                      &mar_xattrs[0], xattr_count);
                    
-                  // Check if older than X days (specified by user arg)
-                  if (now-day_seconds > iattrP->ia_atime.tv_sec) {
-                     LOG(LOG_INFO, "Found trash\n");
-                     md_path_ptr = &post.md_path[0];
-
-                     xattr_ptr = &mar_xattrs[0];
-
-                     // Get objid xattr
-                     if ((xattr_index=get_xattr_value(xattr_ptr, 
-                          marfs_xattrs[objid_index], xattr_count)) != -1) { 
-                          xattr_ptr = &mar_xattrs[xattr_index];
-                        LOG(LOG_INFO, "objid xattr name = %s xattr_value =%s\n",
-                            xattr_ptr->xattr_name, xattr_ptr->xattr_value);
-                        LOG(LOG_INFO, "remove file: %s  remove object:  %s\n",
-                            md_path_ptr, xattr_ptr->xattr_value); 
-
-                        // Going to get the repo name now from the objid xattr
-                        // To do this, must call marfs str_2_pre to parse out
-                        // the bucket name which include repo name
-                        //fprintf(stderr,"going to call str_2_pre %s\n",xattr_ptr->xattr_value);
-                        str_2_pre(pre, xattr_ptr->xattr_value, st);
-
-                        sscanf(pre->bucket, MARFS_BUCKET_RD_FORMAT, repo_name);
-
-                        strcpy(fileset_info_ptr->repo_name,repo_name);
+                     // Check if older than X days (specified by user arg)
+                     if (now-day_seconds > iattrP->ia_atime.tv_sec) {
+                        LOG(LOG_INFO, "Found trash\n");
+                        md_path_ptr = &post.md_path[0];
+
+                        xattr_ptr = &mar_xattrs[0];
+
+                        // Get objid xattr
+                        if ((xattr_index=get_xattr_value(xattr_ptr, 
+                             marfs_xattrs[objid_index], xattr_count)) != -1) { 
+                             xattr_ptr = &mar_xattrs[xattr_index];
+                           LOG(LOG_INFO, "objid xattr name = %s xattr_value =%s\n",
+                               xattr_ptr->xattr_name, xattr_ptr->xattr_value);
+                           LOG(LOG_INFO, "remove file: %s  remove object:  %s\n",
+                               md_path_ptr, xattr_ptr->xattr_value); 
+
+                           // Going to get the repo name now from the objid xattr
+                           // To do this, must call marfs str_2_pre to parse out
+                           // the bucket name which include repo name
+                           //fprintf(stderr,"going to call str_2_pre %s\n",xattr_ptr->xattr_value);
+                           str_2_pre(pre, xattr_ptr->xattr_value, st);
+
+                           sscanf(pre->bucket, MARFS_BUCKET_RD_FORMAT, repo_name);
+
+                           strcpy(fileset_info_ptr->repo_name,repo_name);
         
-                        // Now call read config so that the hostname for 
-                        // the oject can be obtained (so that aws knows who
-                        // to talk to
-                        if (!read_config_gc(fileset_info_ptr)) {
-                            s3_set_host (fileset_info_ptr->host);
-
-                           // Deterimine if object type is packed.  If so we 
-                           // must complete scan to determine if all files 
-                           // exist for the object
-                           if (post.obj_type == OBJ_PACKED) {
-                              fprintf(file_info_ptr->packedfd,"%s %s %zu\n", 
-                                      xattr_ptr->xattr_value, md_path_ptr, post.chunks);
-                                      file_info_ptr->is_packed = 1;
-                           }
-
-                           // MANUAL SET
-                           //s3_set_host (hostname);
-                           //s3_set_host ("10.140.0.17:9020");
-                           // FOR SPROXYD
-                           ////s3_set_host ("10.135.0.22:81");
-                           // FOR SPROXYD
-                           // MANUAL SET
-
-                           // Not checking return because log has error message
-                           // and want to keep running even if errors exists on 
-                           // certain objects or files
-                           else {
-                              trash_status = dump_trash(xattr_ptr, md_path_ptr, 
-                                                        file_info_ptr, 
-                                                        &post);
-                           } // endif dump trash
-                        } // endif read config 
-                     } // endif objid xattr 
-                  } // endif days old check
-               } // endif post xattr specifies trash
-            } // endif get xattrs
-         } // endif extended attributes
+                           // Now call read config so that the hostname for 
+                           // the oject can be obtained (so that aws knows who
+                           // to talk to
+                           if (!read_config_gc(fileset_info_ptr)) {
+
+                              // Deterimine if object type is packed.  If so we 
+                              // must complete scan to determine if all files 
+                              // exist for the object
+                              if (post.obj_type == OBJ_PACKED) {
+                                 gc_packed_add(file_info_ptr, 
+                                               xattr_ptr->xattr_value, 
+                                               md_path_ptr, post.chunks,
+                                               fileset_info_ptr->host, 1);
+                              }
+
+                              // MANUAL SET
+                              //s3_set_host (hostname);
+                              //s3_set_host ("10.140.0.17:9020");
+                              // FOR SPROXYD
+                              ////s3_set_host ("10.135.0.22:81");
+                              // FOR SPROXYD
+                              // MANUAL SET
+
+                              // Not checking return because log has error message
+                              // and want to keep running even if errors exists on 
+                              // certain objects or files
+                              else {
+                                 trash_status = dump_trash(xattr_ptr, md_path_ptr, 
+                                                           file_info_ptr, 
+                                                           &post,
+                                                           fileset_info_ptr->host);
+                              } // endif dump trash
+                           } // endif read config 
+                        } // endif objid xattr 
+                     } // endif days old check
+                  } // endif post xattr specifies trash
+               } // endif get xattrs
+            } // endif extended attributes
 /******
  * Removing this because no need for checking if trash fileset
-         }
+            }
 ******/
-      }
-   } // endwhile
-   clean_exit(file_info_ptr->outfd, iscanP, fsP, early_exit);
-   return(rc);
+         }
+      } // endwhile
+      if (scan->rc)
+         break;
+   } // endwhile ranges
+
+   gpfs_close_inodescan(iscanP);
+   gc_log_flush(file_info_ptr->log);
+   return(NULL);
 }
 
 /***************************************************************************** 
-Name: parse_post_xattr 
-
- parse an xattr-value string into a MarFS_XattrPost
+Name: analyze_trash 
 
+Add a trash file to the histograms for the repo holding its object (from
+the objid xattr).  The atime age is how long it has been in the trash.  A
+packed object is counted once, by the file at offset zero.
 *****************************************************************************/
-int parse_post_xattr(MarFS_XattrPost* post, struct marfs_xattr * post_str) {
-
-   uint16_t   major;
-   uint16_t   minor;
-
-   char  obj_type_code;
-   LOG(LOG_INFO, "Post xattr:  %s\n", post_str->xattr_value);
-   // --- extract bucket, and some top-level fields
-   int scanf_size = sscanf(post_str->xattr_value, MARFS_POST_FORMAT,
-                           &major, &minor,
-                           &obj_type_code,
-                           &post->obj_offset,
-                           &post->chunks,
-                           &post->chunk_info_bytes,
-                           &post->correct_info,
-                           &post->encrypt_info,
-                           &post->flags,
-                           (char*)&post->md_path);
-   if (scanf_size == EOF || scanf_size < 9)
-      return -1;   
-   post->obj_type = decode_obj_type(obj_type_code);
-   return 0;
+void analyze_trash(Analytics          *an, 
+                   const gpfs_iattr_t *iattrP, 
+                   MarFS_XattrPost    *post, 
+                   struct marfs_xattr *xattr_ptr, 
+                   int                xattr_count)
+{
+   Analytics_Entry *entry;
+   char repo_name[MARFS_MAX_REPO_NAME];
+   int objid_index;
+
+   objid_index = get_xattr_value(xattr_ptr, "user.marfs_objid", xattr_count);
+   if (objid_index == -1 ||
+       analytics_repo_name(xattr_ptr[objid_index].xattr_value, 
+                           repo_name, MARFS_MAX_REPO_NAME))
+      return;
+   if ((entry = analytics_entry(an, AN_SCOPE_REPO, repo_name)) == NULL)
+      return;
+
+   analytics_add_file(an, entry, iattrP->ia_size, 
+                      iattrP->ia_atime.tv_sec, iattrP->ia_mtime.tv_sec);
+   if (post->obj_type == OBJ_PACKED) {
+      if (post->obj_offset == 0)
+         analytics_add(entry, AN_PACKED_FILES, post->chunks);
+   }
+   else if (!(post->flags & POST_INLINE))
+      analytics_add(entry, AN_CHUNKS, post->chunks);
 }
 
-
 /***************************************************************************** 
 Name: dump_trash 
 
- This function deletes the object file as well as gpfs metadata files
+ Queue the objects of a trashed file for deletion (see gc_delete_queue()).
+ The trash file and its companion are deleted once all its objects are
+ gone.
 *****************************************************************************/
 int dump_trash(struct marfs_xattr *xattr_ptr, char *md_path_ptr, 
-               File_Info *file_info_ptr, MarFS_XattrPost *post_xattr)
+               File_Info *file_info_ptr, MarFS_XattrPost *post_xattr,
+               const char *host)
 {
-   int return_value =0;
-
    char object_name[MARFS_MAX_OBJID_SIZE];
    char *obj_name_ptr;
    int i;
-   int delete_obj_status;
+   int obj_count;
+   GC_Trash *trash;
+
+   // Inline files keep their data in the MD file.  There is no object.
+   if (post_xattr->flags & POST_INLINE) {
+      gc_log(file_info_ptr->log, "inline file, no object %s\n", 
+             xattr_ptr->xattr_value);
+      return(delete_file(md_path_ptr, file_info_ptr->log));
+   }
 
    //If multi type file then delete all objects associated with file
-   if (post_xattr->obj_type == OBJ_MULTI) {
-      for (i=0; i < post_xattr->chunks; i++ ) {
-         obj_name_ptr = strrchr(xattr_ptr->xattr_value, '.');
-         obj_name_ptr++;
-         *obj_name_ptr='\0'; 
-         sprintf(object_name, "%s%d",xattr_ptr->xattr_value,i);
-         if ((delete_obj_status=delete_object(object_name,file_info_ptr)) != 0) {
-            fprintf(file_info_ptr->outfd, "s3_delete error (HTTP Code: \
-                    %d) on object %s\n", delete_obj_status, \
-                    xattr_ptr->xattr_value);
-            return_value = -1;
-         }
-         else {
-            fprintf(file_info_ptr->outfd, "deleted object %s\n", object_name);
-         }
-      } 
-   }
+   else if (post_xattr->obj_type == OBJ_MULTI) 
+      obj_count = post_xattr->chunks;
 
    // else UNI BUT NEED to implemented other formats as developed 
-   else if (post_xattr->obj_type == OBJ_UNI) {
-      strncpy(object_name, xattr_ptr->xattr_value, 
-              strlen(xattr_ptr->xattr_value));
-      if ((delete_obj_status=delete_object(object_name, file_info_ptr)) != 0 ) {
-         fprintf(file_info_ptr->outfd, "s3_delete error (HTTP Code:  %d) \
-                 on object %s\n", delete_obj_status,xattr_ptr->xattr_value);
-         return_value = -1;
-      }
-      else {
-         fprintf(file_info_ptr->outfd, "deleted object %s\n", object_name);
-      }
-   }
+   else if (post_xattr->obj_type == OBJ_UNI) 
+      obj_count = 1;
+
    // Need to implement semi-direct here.  In this case the obj_type will not
    // have that information.  I will have to rely on the config parser to 
    // determine the protocol from the RepoAccessProto structure.  I would 
    // not delete objects anymore, I would delete files so hopefully I could
    // use delete file as is.  
+   else 
+      return(delete_file(md_path_ptr, file_info_ptr->log));
 
-   // Delete trash files
-   // Only delete if no error deleting object
-   if (!return_value) {
-      delete_file(md_path_ptr, file_info_ptr); 
-   }
-   return(return_value);
-}
-
-/***************************************************************************** 
-Name: delete_object 
-
- This function deletes the object and returns -1 if error, 0 if successful
-*****************************************************************************/
-int delete_object(char * object, File_Info *file_info_ptr)
-{
-   //
-   int return_val;
-   CURLcode s3_return;
-   IOBuf * obj_buffer = aws_iobuf_new();
-
-   print_current_time(file_info_ptr);
+   if (obj_count <= 0)
+      return(delete_file(md_path_ptr, file_info_ptr->log));
 
-   s3_return = s3_delete( obj_buffer, object );
-   return_val=check_S3_error(s3_return, obj_buffer, S3_DELETE);
-   
-   return(return_val);
+   if ((trash = (GC_Trash *) malloc(sizeof(*trash))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      return(-1);
+   }
+   // Must be set before anything is queued, or the first thread to
+   // finish might think it was the last
+   trash->remaining = obj_count;
+   trash->failed = 0;
+   trash->packed = NULL;
+   strncpy(trash->md_path, md_path_ptr, MARFS_MAX_MD_PATH);
+   trash->md_path[MARFS_MAX_MD_PATH -1] = '\0';
+
+   for (i=0; i < obj_count; i++ ) {
+      int name_len;
+      if (post_xattr->obj_type == OBJ_MULTI) {
+         obj_name_ptr = strrchr(xattr_ptr->xattr_value, '.');
+         obj_name_ptr++;
+         *obj_name_ptr='\0'; 
+         name_len = snprintf(object_name, MARFS_MAX_OBJID_SIZE, "%s%d",
+                             xattr_ptr->xattr_value, i);
+      }
+      else 
+         name_len = snprintf(object_name, MARFS_MAX_OBJID_SIZE, "%s",
+                             xattr_ptr->xattr_value);
+
+      // A truncated name would DELETE the wrong object.  Count it as a
+      // failure, so the trash file is left for the next run.
+      if ((name_len < 0) || (name_len >= MARFS_MAX_OBJID_SIZE))
+         gc_log(file_info_ptr->log, "object name too long for %s\n",
+                trash->md_path);
+      else if (gc_delete_queue(host, object_name, trash))
+         gc_log(file_info_ptr->log, "couldn't queue object %s\n", object_name);
+      else
+         continue;
 
+      __sync_fetch_and_add(&trash->failed, 1);
+      if (! __sync_sub_and_fetch(&trash->remaining, 1))
+         free(trash);
+   } 
+   return(0);
 }
 
 /***************************************************************************** 
@@ -705,159 +893,508 @@ Name: delete_file
 
 this function deletes the gpfs files assoiated with an object
 *****************************************************************************/
-int delete_file(char *filename, File_Info *file_info_ptr)
+int delete_file(char *filename, GC_Log *log)
 {
    int return_value = 0;
    char path_file[MARFS_MAX_MD_PATH];
-   sprintf(path_file,"%s.path",filename);
-   print_current_time(file_info_ptr);
+   snprintf(path_file, MARFS_MAX_MD_PATH, "%s.path", filename);
 
    if ((unlink(filename) == -1)) {
-      fprintf(file_info_ptr->outfd,"Error removing file %s\n",filename);
+      gc_log(log, "Error removing file %s\n", filename);
       return_value = -1;
    }
    else {
-      fprintf(file_info_ptr->outfd,"deleted file %s\n",filename);
+      gc_log(log, "deleted file %s\n", filename);
    }
-   print_current_time(file_info_ptr);
    if ((unlink(path_file) == -1)) {
-      fprintf(file_info_ptr->outfd,"Error removing file %s\n",path_file);
+      gc_log(log, "Error removing file %s\n", path_file);
       return_value = -1;
    }
    else {
-      fprintf(file_info_ptr->outfd,"deleted file %s\n",path_file);
+      gc_log(log, "deleted file %s\n", path_file);
    }
    return(return_value);
 }
 
 /***************************************************************************** 
-Name: print_current_file 
+Name: gc_log 
 
-This function prints current time to the log entry
+Log lines are collected in a per-thread buffer, and written to the output
+log a buffer at a time.  Each line starts with the current time.  The
+time-stamp is only re-formatted when the second changes.
 *****************************************************************************/
+GC_Log *gc_log_new(FILE *outfd)
+{
+   GC_Log *log = (GC_Log *) malloc(sizeof(*log));
+   if (log == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(1);
+   }
+   log->outfd = outfd;
+   log->last_time = 0;
+   log->time_stamp[0] = '\0';
+   log->len = 0;
+   return(log);
+}
 
-void print_current_time(File_Info *file_info_ptr)
+void gc_log(GC_Log *log, const char *format, ...)
 {
-   char time_string[20];
-   struct tm *time_info;
-   
+   va_list ap;
+   int n;
+   int max;
    time_t now = time(0);
-   time_info = localtime(&now);
-   strftime(time_string, sizeof(time_string), "%Y-%m-%d %H:%M:%S", time_info);
-   fprintf(file_info_ptr->outfd, "%s ", time_string);
+
+   if (now != log->last_time) {
+      struct tm time_info;
+      localtime_r(&now, &time_info);
+      strftime(log->time_stamp, GC_TIME_STAMP_LEN, "%Y-%m-%d %H:%M:%S", 
+               &time_info);
+      log->last_time = now;
+   }
+
+   if (log->len + GC_LOG_LINE_MAX > GC_LOG_BUF_SIZE)
+      gc_log_flush(log);
+
+   n = snprintf(log->buf + log->len, GC_LOG_LINE_MAX, "%s ", log->time_stamp);
+   max = GC_LOG_LINE_MAX - n;
+
+   va_start(ap, format);
+   int m = vsnprintf(log->buf + log->len + n, max, format, ap);
+   va_end(ap);
+
+   // keep a truncated line (snprintf left it NUL-terminated)
+   if (m >= max)
+      m = max - 1;
+   if (m > 0)
+      log->len += n + m;
+}
+
+void gc_log_flush(GC_Log *log)
+{
+   if (log->len) {
+      fwrite(log->buf, 1, log->len, log->outfd);
+      log->len = 0;
+   }
 }
 
 
+/***************************************************************************** 
+Name: gc_delete
+
+Object deletion engine.  Each object-host gets its own queue, and a pool of
+threads that each keep one IOBuf (and AWSContext) for all their DELETEs.
+So there are up to <thread_count> DELETEs in flight per host, and the inode
+scan carries on while they run.  When the last object of a trashed file is
+deleted, that thread also deletes the trash files (unless some object
+couldn't be deleted, in which case the next GC run will try again).
+*****************************************************************************/
+static GC_Host       *gc_hosts[GC_MAX_HOSTS];
+static int           gc_host_count = 0;
+static pthread_mutex_t gc_hosts_lock = PTHREAD_MUTEX_INITIALIZER;
+static int           gc_thread_count = GC_DELETE_THREADS;
+static FILE          *gc_outfd = NULL;
+static volatile long gc_deleted = 0;
+static volatile long gc_delete_errors = 0;
+
+int gc_delete_init(File_Info *file_info_ptr, int thread_count)
+{
+   if (thread_count < 1)
+      thread_count = 1;
+   else if (thread_count > GC_DELETE_THREADS_MAX)
+      thread_count = GC_DELETE_THREADS_MAX;
+
+   gc_thread_count = thread_count;
+   gc_outfd = file_info_ptr->outfd;
+   return(0);
+}
+
+// Workers wait here for the next object.  Returns 0 when the queue is
+// empty, and gc_delete_finish() has said there will be no more.
+static int gc_delete_pop(GC_Host *h, GC_Delete *job)
+{
+   int found = 0;
+
+   pthread_mutex_lock(&h->lock);
+   while (! h->count && ! h->done)
+      pthread_cond_wait(&h->not_empty, &h->lock);
+
+   if (h->count) {
+      *job = h->queue[h->head];
+      h->head = (h->head + 1) % GC_DELETE_QUEUE;
+      h->count--;
+      found = 1;
+      pthread_cond_signal(&h->not_full);
+   }
+   pthread_mutex_unlock(&h->lock);
+   return(found);
+}
+
+static void *gc_delete_thread(void *arg)
+{
+   GC_Host *h = (GC_Host *) arg;
+   GC_Log *log = gc_log_new(gc_outfd);
+   GC_Delete job;
+   CURLcode s3_return;
+   int rc;
+
+   IOBuf *obj_buffer = aws_iobuf_new();
+   AWSContext *ctx = aws_context_clone();
+   s3_set_host_r(h->host, ctx);
+   aws_iobuf_context(obj_buffer, ctx);
+
+   while (gc_delete_pop(h, &job)) {
+      aws_iobuf_reset(obj_buffer);       // keeps the context
+      s3_return = s3_delete(obj_buffer, job.object);
+
+      if ((rc = check_S3_error(s3_return, obj_buffer, S3_DELETE)) != 0) {
+         gc_log(log, "s3_delete error (HTTP Code:  %d) on object %s\n", 
+                rc, job.object);
+         __sync_fetch_and_add(&job.trash->failed, 1);
+         __sync_fetch_and_add(&gc_delete_errors, 1);
+      }
+      else {
+         gc_log(log, "deleted object %s\n", job.object);
+         __sync_fetch_and_add(&gc_deleted, 1);
+      }
+
+      // last object of this file?
+      if (! __sync_sub_and_fetch(&job.trash->remaining, 1)) {
+         if (job.trash->packed)
+            gc_packed_free(job.trash->packed, log, ! job.trash->failed);
+         else if (! job.trash->failed)
+            delete_file(job.trash->md_path, log);
+         free(job.trash);
+      }
+   }
+
+   gc_log_flush(log);
+   free(log);
+   aws_iobuf_reset_hard(obj_buffer);
+   aws_iobuf_free(obj_buffer);
+   return(NULL);
+}
+
+// Caller holds gc_hosts_lock
+static GC_Host *gc_host_find(const char *host)
+{
+   int i;
+   GC_Host *h;
+
+   for (i=0; i < gc_host_count; i++) {
+      if (!strcmp(gc_hosts[i]->host, host))
+         return(gc_hosts[i]);
+   }
+   if (gc_host_count == GC_MAX_HOSTS) {
+      fprintf(stderr, "too many object hosts (max %d)\n", GC_MAX_HOSTS);
+      return(NULL);
+   }
+
+   if ((h = (GC_Host *) calloc(1, sizeof(*h))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      return(NULL);
+   }
+   strncpy(h->host, host, sizeof(h->host) -1);
+   pthread_mutex_init(&h->lock, NULL);
+   pthread_cond_init(&h->not_empty, NULL);
+   pthread_cond_init(&h->not_full, NULL);
+
+   for (i=0; i < gc_thread_count; i++) {
+      if (pthread_create(&h->threads[h->thread_count], NULL, 
+                         gc_delete_thread, h)) 
+         fprintf(stderr, "couldn't start delete thread %d for %s\n", i, host);
+      else
+         h->thread_count++;
+   }
+   if (! h->thread_count) {
+      free(h);
+      return(NULL);
+   }
+
+   gc_hosts[gc_host_count++] = h;
+   return(h);
+}
+
+int gc_delete_queue(const char *host, const char *object, GC_Trash *trash)
+{
+   GC_Host *h;
+   size_t tail;
+
+   pthread_mutex_lock(&gc_hosts_lock);
+   h = gc_host_find(host);
+   pthread_mutex_unlock(&gc_hosts_lock);
+   if (h == NULL)
+      return(-1);
+
+   pthread_mutex_lock(&h->lock);
+   while (h->count == GC_DELETE_QUEUE)
+      pthread_cond_wait(&h->not_full, &h->lock);
+
+   tail = (h->head + h->count) % GC_DELETE_QUEUE;
+   strncpy(h->queue[tail].object, object, MARFS_MAX_OBJID_SIZE);
+   h->queue[tail].object[MARFS_MAX_OBJID_SIZE -1] = '\0';
+   h->queue[tail].trash = trash;
+   h->count++;
+
+   pthread_cond_signal(&h->not_empty);
+   pthread_mutex_unlock(&h->lock);
+   return(0);
+}
+
+// Wait for all queued deletes to finish.  Returns the number of objects
+// that couldn't be deleted.
+int gc_delete_finish()
+{
+   int i, j;
+
+   for (i=0; i < gc_host_count; i++) {
+      GC_Host *h = gc_hosts[i];
+
+      pthread_mutex_lock(&h->lock);
+      h->done = 1;
+      pthread_cond_broadcast(&h->not_empty);
+      pthread_mutex_unlock(&h->lock);
+
+      for (j=0; j < h->thread_count; j++)
+         pthread_join(h->threads[j], NULL);
+
+      pthread_mutex_destroy(&h->lock);
+      pthread_cond_destroy(&h->not_empty);
+      pthread_cond_destroy(&h->not_full);
+      free(h);
+   }
+   gc_host_count = 0;
+
+   fprintf(gc_outfd, "deleted %ld objects, %ld errors\n", 
+           gc_deleted, gc_delete_errors);
+   return((int)gc_delete_errors);
+}
+
+
+/***************************************************************************** 
+Name: gc_packed
+
+Packed implies multiple files packed into an object, so the object and files
+cannot be deleted unless all the files of the object are in the trash.
+Trashed files of packed objects are collected in a hash-table keyed by objid.
+When the count of files for an object reaches the chunk count, the object is
+removed from the table and queued for deletion, and the files are deleted 
+after the object (see gc_delete_thread()).  Objects that are never completed
+are left in place, and a repack utility will be run on the trash directory.
+
+The table is limited to GC_PACKED_MEM_MAX.  Above that, files of objects
+that aren't already in the table go to the packed tmp-file, which is sorted
+and processed after the scan (see process_packed()).
+*****************************************************************************/
+static GC_Packed *gc_packed[GC_PACKED_BUCKETS];
+static size_t    gc_packed_mem = 0;       // only changed with __sync
+static int       gc_packed_spill = 0;     // spilling has started
+static pthread_mutex_t gc_packed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int gc_packed_hash(const char *objid)
+{
+   unsigned int hash = 5381;
+   while (*objid)
+      hash = (hash * 33) ^ (unsigned char)*objid++;
+   return(hash % GC_PACKED_BUCKETS);
+}
+
+// <may_spill> is zero when reading back the tmp-file, which has already
+// been spilled.  Caller holds gc_packed_lock.
+static int gc_packed_insert(File_Info *file_info_ptr, const char *objid, 
+                            const char *md_path, size_t chunks, 
+                            const char *host, int may_spill)
+{
+   unsigned int bucket = gc_packed_hash(objid);
+   GC_Packed **prev = &gc_packed[bucket];
+   GC_Packed *packed;
+   GC_Member *member;
+   size_t    path_len = strlen(md_path) +1;
+   GC_Trash  *trash;
+
+   for (packed = *prev; packed; prev = &packed->next, packed = packed->next) {
+      if (!strcmp(packed->objid, objid))
+         break;
+   }
+
+   if (! packed) {
+      size_t objid_len = strlen(objid) +1;
+
+      // Once spilling starts, all new objects spill, so that an object's
+      // files are either all in the table or all in the tmp-file.
+      if (may_spill
+          && (gc_packed_spill
+              || (gc_packed_mem + sizeof(*packed) + objid_len 
+                  > GC_PACKED_MEM_MAX))) {
+         fprintf(file_info_ptr->packedfd, "%s %s %zu %s\n", 
+                 objid, md_path, chunks, host);
+         file_info_ptr->is_packed = 1;
+         gc_packed_spill = 1;
+         return(0);
+      }
+      if ((packed = (GC_Packed *) malloc(sizeof(*packed) + objid_len)) == NULL) {
+         fprintf(stderr, "Memory allocation failed\n");
+         return(-1);
+      }
+      packed->members = NULL;
+      packed->chunks = chunks;
+      packed->count = 0;
+      packed->mem = sizeof(*packed) + objid_len;
+      strncpy(packed->host, host, sizeof(packed->host) -1);
+      packed->host[sizeof(packed->host) -1] = '\0';
+      memcpy(packed->objid, objid, objid_len);
+      __sync_fetch_and_add(&gc_packed_mem, packed->mem);
+
+      packed->next = gc_packed[bucket];
+      gc_packed[bucket] = packed;
+      prev = &gc_packed[bucket];
+   }
+
+   if ((member = (GC_Member *) malloc(sizeof(*member) + path_len)) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      return(-1);
+   }
+   memcpy(member->path, md_path, path_len);
+   member->next = packed->members;
+   packed->members = member;
+   packed->count++;
+   packed->mem += sizeof(*member) + path_len;
+   __sync_fetch_and_add(&gc_packed_mem, sizeof(*member) + path_len);
+
+   if (packed->count < packed->chunks)
+      return(0);
+
+   // All files are in the trash.  Take the object out of the table, and
+   // delete it.
+   *prev = packed->next;
+
+   if ((trash = (GC_Trash *) malloc(sizeof(*trash))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      gc_packed_free(packed, file_info_ptr->log, 0);
+      return(-1);
+   }
+   trash->remaining = 1;
+   trash->failed = 0;
+   trash->packed = packed;
+   trash->md_path[0] = '\0';
+
+   if (gc_delete_queue(packed->host, packed->objid, trash)) {
+      gc_log(file_info_ptr->log, "couldn't queue object %s\n", packed->objid);
+      gc_packed_free(packed, file_info_ptr->log, 0);
+      free(trash);
+      return(-1);
+   }
+   return(0);
+}
+
+// Called from the scan threads
+int gc_packed_add(File_Info *file_info_ptr, const char *objid, 
+                  const char *md_path, size_t chunks, const char *host,
+                  int may_spill)
+{
+   int rc;
+
+   pthread_mutex_lock(&gc_packed_lock);
+   rc = gc_packed_insert(file_info_ptr, objid, md_path, chunks, host, 
+                         may_spill);
+   pthread_mutex_unlock(&gc_packed_lock);
+   return(rc);
+}
+
+// Release a packed object, deleting its trash files if <delete_files>
+void gc_packed_free(GC_Packed *packed, GC_Log *log, int delete_files)
+{
+   GC_Member *member;
+
+   while ((member = packed->members)) {
+      if (delete_files)
+         delete_file(member->path, log);
+      packed->members = member->next;
+      free(member);
+   }
+   __sync_fetch_and_sub(&gc_packed_mem, packed->mem);
+   free(packed);
+}
+
+// Whatever is left in the table doesn't have all its files in the trash
+void gc_packed_finish(File_Info *file_info_ptr)
+{
+   int i;
+   GC_Packed *packed;
+
+   for (i=0; i < GC_PACKED_BUCKETS; i++) {
+      while ((packed = gc_packed[i])) {
+         gc_log(file_info_ptr->log, 
+                "packed object %s incomplete (%zu of %zu files)\n",
+                packed->objid, packed->count, packed->chunks);
+         gc_packed[i] = packed->next;
+         gc_packed_free(packed, file_info_ptr->log, 0);
+      }
+   }
+}
+
 /***************************************************************************** 
 Name: process_packed
 
-This function determines which objects and files should be deleted when
-the object type is PACKED.  Packed implies multiple files packed into an 
-object so objects and files cannot be deleted if all the files do not
-exist for a particular object.  The function is passed in a filename that
-contains a list of all PACKED entries found in the scan.
-The format of the files is:
+This function handles the packed objects that didn't fit in the table
+during the scan (see gc_packed_add()).  The packed tmp-file contains one
+line per trashed file:
 
-object_name file_name total_file_count
+object_name file_name total_file_count host
 
-This function sorts by object name then proceeds to count how many files
-exists for that object_name.  If the files counted equal the total file_count,
-the object and files are deleted.  Ohterwise they are left in place and a 
-repack utility will be run on the trash directory.
+The file is sorted by object name, so all the files of an object are
+together.  Each object's files are added to the table, and anything left
+over when the object name changes is incomplete, so only one object is in
+memory at a time.
 *****************************************************************************/
 
 int process_packed(File_Info *file_info_ptr)
 {
-   FILE *pipe_cat = NULL;
-   FILE *pipe_grep = NULL;
+   FILE *pipe_sort = NULL;
 
-   char obj_buf[MARFS_MAX_MD_PATH+MARFS_MAX_OBJID_SIZE+64];
-   char file_buf[MARFS_MAX_MD_PATH];
+   char obj_buf[MARFS_MAX_MD_PATH+MARFS_MAX_OBJID_SIZE+64+32];
    char objid[MARFS_MAX_OBJID_SIZE];
    char last_objid[MARFS_MAX_OBJID_SIZE];
-   char grep_command[MARFS_MAX_MD_PATH+MAX_PACKED_NAME_SIZE+64];
-   char cat_command[MAX_PACKED_NAME_SIZE];
-   int obj_return;
-   int df_return;
-
-   int chunk_count;
+   char sort_command[MAX_PACKED_NAME_SIZE+64];
    char filename[MARFS_MAX_MD_PATH];
-   int count = 0;
+   char host[32];
+   size_t chunk_count;
+   int return_value = 0;
    
-   // create command to cat and sort the list of objects that are packed
-   sprintf(cat_command, "cat %s | sort", file_info_ptr->packed_filename);
+   // sort(1) spills to disk itself, for big files
+   snprintf(sort_command, sizeof(sort_command), "sort %s", 
+            file_info_ptr->packed_filename);
    
-   // open STREAM for cat
-   if (( pipe_cat = popen(cat_command, "r")) == NULL) {
+   if (( pipe_sort = popen(sort_command, "r")) == NULL) {
       fprintf(stderr, "Error with popen\n");
       return(-1); 
    }
-   // Get the first line and sscanf into object_name, filenames, and chunk cnt
-   fgets(obj_buf, MARFS_MAX_MD_PATH+MARFS_MAX_OBJID_SIZE+64, pipe_cat);
-   sscanf(obj_buf,"%s %s %d", objid, filename, &chunk_count);
-
-   // Keep track of of when objid name changes 
-   // count is used to see how many files have been counted
-   // so that a check of whether all files are accounted for in the packed
-   // object
-   strcpy(last_objid, objid);
-   count++;
-
-   //In a loop get all lines from the file
-   while(fgets(obj_buf, MARFS_MAX_MD_PATH+MARFS_MAX_OBJID_SIZE+64, pipe_cat)) {
-      sscanf(obj_buf,"%s %s %d", objid, filename, &chunk_count);
-      // if objid the same - keep counting files
-      if (!strcmp(last_objid,objid)) {
-         count++;
-         // If file count == chuck count - all files accounted for
-         // delete objec
-         if (chunk_count == count) {
-
-            if ((obj_return=delete_object(objid, file_info_ptr)) != 0) 
-               fprintf(file_info_ptr->outfd, "s3_delete error (HTTP Code: \
-                       %d) on object %s\n", obj_return, objid);
-            else 
-              fprintf(file_info_ptr->outfd, "deleted object %s\n", objid);
-
-            sprintf(grep_command,"grep %s %s | awk '{print $2}' ", 
-                    objid, file_info_ptr->packed_filename);
-            //Now open pipe to find all files associated with object 
-            if (( pipe_grep = popen(grep_command, "r")) == NULL) {
-               fprintf(stderr, "Error with popen\n");
-               return(-1); 
-            }
-            //Delete files
-            while(fgets(file_buf, MARFS_MAX_MD_PATH, pipe_grep)) {
-               sscanf(file_buf,"%s",filename);
-               df_return = delete_file(filename, file_info_ptr);
-            }
-         }
+
+   last_objid[0] = '\0';
+   while(fgets(obj_buf, sizeof(obj_buf), pipe_sort)) {
+      if (sscanf(obj_buf,"%1023s %1023s %zu %31s", 
+                 objid, filename, &chunk_count, host) != 4) {
+         fprintf(stderr, "bad line in %s: %s", 
+                 file_info_ptr->packed_filename, obj_buf);
+         return_value = -1;
+         continue;
       }
 
-      //current object did not match last one so on to next object and new count
-      else {
+      // previous object didn't have all its files
+      if (strcmp(last_objid, objid)) {
+         gc_packed_finish(file_info_ptr);
          strcpy(last_objid, objid);
-         count = 1;
       }
-
+      if (gc_packed_add(file_info_ptr, objid, filename, chunk_count, host, 0))
+         return_value = -1;
    }
-   if (df_return == -1 || obj_return == -1)
-      return(-1);
 
-   if (pclose(pipe_cat) == -1) {
-      fprintf(stderr, "Error closing cat pipe in process_packed\n");
+   gc_packed_finish(file_info_ptr);
+
+   if (pclose(pipe_sort) == -1) {
+      fprintf(stderr, "Error closing sort pipe in process_packed\n");
       return(-1);
    }
-   else if (pipe_grep != NULL) {
-      if (pclose(pipe_grep) == -1) {
-         fprintf(stderr, "Error closing grep pipe in process_packed\n");
-         return(-1);
-      }
-      else
-         return(0);
-   }
-   else 
-      return(0);
+   return(return_value);
 }
 
 
@@ -77,9 +77,11 @@ OF SUCH DAMAGE.
 #include <sys/types.h>          // ino_t
 #include <sys/stat.h>
 #include <math.h>               // floorf
+#include <pthread.h>
 #include <gpfs_fcntl.h>
 #include "marfs_base.h"
 #include "aws4c.h"
+#include "histo.h"
 
 
 // CHECK this and compare to Jeff's
@@ -99,6 +101,34 @@ enum{S3_CREATE, S3_STAT, S3_DELETE};
 
 #define TMP_LOCAL_FILE_LEN 1024 
 
+// Object deletion runs in a pool of threads per object-host, each with its
+// own IOBuf, so many DELETEs are in flight at once.  (see gc_delete_init())
+#define GC_DELETE_THREADS 16          // default concurrent DELETEs per host (-n)
+#define GC_DELETE_THREADS_MAX 256
+#define GC_DELETE_QUEUE 1024          // objects waiting, per host
+#define GC_MAX_HOSTS 64
+
+// Trashed files of packed objects are collected in a table keyed by objid,
+// during the scan.  When all the files of an object have been seen, the
+// object is queued for deletion, and its files are deleted after it.  Above
+// GC_PACKED_MEM_MAX, objects that aren't already in the table are written
+// to the packed tmp-file instead, for process_packed().
+#define GC_PACKED_BUCKETS (64 * 1024)
+#define GC_PACKED_MEM_MAX (512 * 1024 * 1024)
+
+// The inode space is cut into ranges, which the scan threads take in
+// order.  More ranges than threads, so one busy range doesn't leave the
+// other threads idle.  (see read_inodes())
+#define GC_SCAN_THREADS_MAX 64
+#define GC_SCAN_RANGES_PER_THREAD 16
+#define GC_SCAN_INODE_MAX 0x7FFFFFFF
+
+// Log lines are collected per thread, and written a buffer at a time.
+// The time-stamp is only re-formatted when the second changes.
+#define GC_LOG_BUF_SIZE (64 * 1024)
+#define GC_LOG_LINE_MAX 1024
+#define GC_TIME_STAMP_LEN 20
+
 struct marfs_xattr {
   char xattr_name[GPFS_FCNTL_XATTR_MAX_NAMELEN];
   char xattr_value[GPFS_FCNTL_XATTR_MAX_VALUELEN];
@@ -113,6 +143,58 @@ typedef struct Fileset_Info {
    char host[32];
 } Fileset_Info;
 
+typedef struct GC_Log {
+   FILE   *outfd;
+   time_t last_time;
+   char   time_stamp[GC_TIME_STAMP_LEN];
+   size_t len;
+   char   buf[GC_LOG_BUF_SIZE];
+} GC_Log;
+
+// One trashed file of a packed object
+typedef struct GC_Member {
+   struct GC_Member *next;
+   char             path[];
+} GC_Member;
+
+// A packed object, and the files of it that were found in the trash
+typedef struct GC_Packed {
+   struct GC_Packed *next;    // hash chain
+   GC_Member        *members;
+   size_t           chunks;   // files in the object
+   size_t           count;    // files found
+   size_t           mem;      // bytes held by this entry
+   char             host[32];
+   char             objid[];
+} GC_Packed;
+
+// One trashed file, whose objects are being deleted.  The thread that
+// finishes the last object deletes the trash files (if no errors).
+typedef struct GC_Trash {
+   volatile int remaining;    // objects not yet deleted
+   volatile int failed;       // objects that couldn't be deleted
+   GC_Packed    *packed;      // packed object (files are in here), or NULL
+   char         md_path[MARFS_MAX_MD_PATH];
+} GC_Trash;
+
+typedef struct GC_Delete {
+   char     object[MARFS_MAX_OBJID_SIZE];
+   GC_Trash *trash;
+} GC_Delete;
+
+typedef struct GC_Host {
+   char            host[32];
+   pthread_mutex_t lock;
+   pthread_cond_t  not_empty;
+   pthread_cond_t  not_full;
+   GC_Delete       queue[GC_DELETE_QUEUE];
+   size_t          head;
+   size_t          count;
+   int             done;
+   int             thread_count;
+   pthread_t       threads[GC_DELETE_THREADS_MAX];
+} GC_Host;
+
 typedef struct File_Info {
 //   char fileset_name[MAX_FILESET_NAME_LEN];
    char fileset_name[MARFS_MAX_NAMESPACE_NAME];
@@ -120,19 +202,54 @@ typedef struct File_Info {
    FILE *packedfd;
    char packed_filename[TMP_LOCAL_FILE_LEN];
    unsigned int is_packed;
+   GC_Log *log;               // for the main thread
 } File_Info;
 
+typedef struct Inode_Ranges {
+   gpfs_fssnap_handle_t  *fsP;
+   gpfs_ino_t            max_inode;
+   gpfs_ino_t            range_size;
+   volatile unsigned int next;         // next range to scan
+} Inode_Ranges;
+
+// One inode-scan thread.  Has its own copies of the per-scan structures.
+typedef struct GC_Scan {
+   Inode_Ranges *ranges;
+   File_Info    file_info;             // with this thread's log
+   Fileset_Info fileset_info;
+   int          fileset_id;
+   unsigned int day_seconds;
+   int          rc;                    // errno, if the scan failed
+   int          started;               // thread was created
+   pthread_t    thread;
+   int          analyze;               // fill <analytics> (-a)
+   Analytics    analytics;
+} GC_Scan;
+
 
 int read_inodes(const char   *fnameP, 
                 File_Info    *file_info_ptr, 
                 int          fileset_id, 
                 Fileset_Info *fileset_info_ptr, 
                 size_t       rec_count, 
-                unsigned int day_seconds);
+                unsigned int day_seconds,
+                int          scan_threads,
+                FILE         *analytics_fd);
+void init_ranges(Inode_Ranges         *ranges, 
+                 gpfs_fssnap_handle_t *fsP, 
+                 gpfs_ino_t           max_inode, 
+                 int                  scan_threads);
+int next_range(Inode_Ranges *ranges, gpfs_ino_t *start, gpfs_ino_t *end);
+void *scan_inodes(void *arg);
 int clean_exit(FILE                 *fd, 
                gpfs_iscan_t         *iscanP, 
                gpfs_fssnap_handle_t *fsP, 
                int                  terminate);
+void analyze_trash(Analytics          *an, 
+                   const gpfs_iattr_t *iattrP, 
+                   MarFS_XattrPost    *post, 
+                   struct marfs_xattr *xattr_ptr, 
+                   int                xattr_count);
 int get_xattr_value(struct     marfs_xattr *xattr_ptr, 
                     const char *desired_xattr, 
                     int        cnt);
@@ -150,11 +267,21 @@ int parse_post_xattr(MarFS_XattrPost* post, struct marfs_xattr* post_str);
 int dump_trash(struct marfs_xattr *xattr_ptr, 
                char               *md_path_ptr,  
                File_Info          *file_info_ptr, 
-               MarFS_XattrPost    *post_xattr);
-int delete_object(char * object, File_Info *file_info_ptr);
-int delete_file(char *filename, File_Info *file_info_ptr);
+               MarFS_XattrPost    *post_xattr,
+               const char         *host);
+int delete_file(char *filename, GC_Log *log);
 int process_packed(File_Info *file_info_ptr);
-void print_current_time(File_Info *file_info_ptr);
+int gc_packed_add(File_Info *file_info_ptr, const char *objid, 
+                  const char *md_path, size_t chunks, const char *host,
+                  int may_spill);
+void gc_packed_free(GC_Packed *packed, GC_Log *log, int delete_files);
+void gc_packed_finish(File_Info *file_info_ptr);
+GC_Log *gc_log_new(FILE *outfd);
+void gc_log(GC_Log *log, const char *format, ...);
+void gc_log_flush(GC_Log *log);
+int gc_delete_init(File_Info *file_info_ptr, int thread_count);
+int gc_delete_queue(const char *host, const char *object, GC_Trash *trash);
+int gc_delete_finish();
 int check_S3_error(CURLcode curl_return, IOBuf *s3_buf, int action);
 int read_config_gc(Fileset_Info *fileset_info_ptr);
 #endif
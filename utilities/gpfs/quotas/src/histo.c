@@ -200,7 +200,8 @@ void fill_histogram(size_t value, size_t increment, size_t max_bucket, int *coun
 
 
 // TEMP TEMP TEMP
-// Using as a tester
+// Using as a tester (build with -DHISTO_TEST)
+#ifdef HISTO_TEST
 int main()
 {
    int i;
@@ -267,4 +268,365 @@ int main()
    }
    ****************/
 }
+#endif
 
+
+/******************************************************************************
+Name:  histo_init / histo_add / histo_merge
+
+Log-linear histograms (see histo.h).  A value below HISTO_SUB_BUCKETS is its
+own bucket.  Otherwise, the top bit of the value picks the power of two, and
+the next HISTO_SUB_BITS bits pick the bucket within it.
+
+******************************************************************************/
+static int histo_index(uint64_t value)
+{
+   int exp;
+   int sub;
+
+   if (value < HISTO_SUB_BUCKETS)
+      return((int)value);
+
+   exp = 63 - __builtin_clzll(value);
+   if (exp >= HISTO_MAX_BITS)
+      return(HISTO_BUCKETS -1);
+
+   sub = (int)(value >> (exp - HISTO_SUB_BITS)) & (HISTO_SUB_BUCKETS -1);
+   return((exp - HISTO_SUB_BITS +1) * HISTO_SUB_BUCKETS + sub);
+}
+
+void histo_init(Histo *histo)
+{
+   memset(histo, 0, sizeof(*histo));
+   histo->min = UINT64_MAX;
+}
+
+void histo_add(Histo *histo, uint64_t value)
+{
+   histo->bucket[histo_index(value)] += 1;
+   histo->count += 1;
+   histo->sum += value;
+   if (value < histo->min)
+      histo->min = value;
+   if (value > histo->max)
+      histo->max = value;
+}
+
+void histo_merge(Histo *dest, const Histo *src)
+{
+   int i;
+
+   for (i = 0; i < HISTO_BUCKETS; i++)
+      dest->bucket[i] += src->bucket[i];
+   dest->count += src->count;
+   dest->sum += src->sum;
+   if (src->min < dest->min)
+      dest->min = src->min;
+   if (src->max > dest->max)
+      dest->max = src->max;
+}
+
+/******************************************************************************
+Name:  histo_bucket_low / histo_bucket_high
+
+Bounds of bucket <index>, [low, high).  The last bucket has no upper bound.
+
+******************************************************************************/
+uint64_t histo_bucket_low(int index)
+{
+   int exp;
+   int sub;
+
+   if (index < HISTO_SUB_BUCKETS)
+      return((uint64_t)index);
+
+   exp = index / HISTO_SUB_BUCKETS + HISTO_SUB_BITS -1;
+   sub = index % HISTO_SUB_BUCKETS;
+   return((uint64_t)(HISTO_SUB_BUCKETS + sub) << (exp - HISTO_SUB_BITS));
+}
+
+uint64_t histo_bucket_high(int index)
+{
+   if (index >= HISTO_BUCKETS -1)
+      return(UINT64_MAX);
+   return(histo_bucket_low(index +1));
+}
+
+/******************************************************************************
+Name:  histo_percentile
+
+Upper bound of the bucket holding the <pct>th percentile, clamped to the
+values actually seen.
+
+******************************************************************************/
+uint64_t histo_percentile(const Histo *histo, double pct)
+{
+   uint64_t target;
+   uint64_t seen = 0;
+   uint64_t value;
+   int i;
+
+   if (histo->count == 0)
+      return(0);
+
+   target = (uint64_t)ceil(histo->count * pct / 100.0);
+   if (target < 1)
+      target = 1;
+
+   for (i = 0; i < HISTO_BUCKETS -1; i++) {
+      seen += histo->bucket[i];
+      if (seen >= target)
+         break;
+   }
+   value = histo_bucket_high(i) -1;
+   if (value > histo->max)
+      value = histo->max;
+   if (value < histo->min)
+      value = histo->min;
+   return(value);
+}
+
+
+static const char *analytics_metric_name[AN_METRIC_COUNT] = {
+   "size",
+   "atime_age",
+   "mtime_age",
+   "chunks",
+   "packed_files"
+};
+
+/******************************************************************************
+Name:  analytics_init
+
+<now> is the time that ages are computed from (the start of the scan), so
+all the scan threads agree.
+
+******************************************************************************/
+void analytics_init(Analytics *an, time_t now)
+{
+   memset(an, 0, sizeof(*an));
+   an->now = now;
+}
+
+/******************************************************************************
+Name:  analytics_entry
+
+Find (or add) the histograms for <name> in <scope>.  Scans see long runs of
+inodes from the same fileset, so the last entry found is checked first.
+Returns NULL if memory allocation fails.
+
+******************************************************************************/
+Analytics_Entry *analytics_entry(Analytics *an, const char *scope, const char *name)
+{
+   Analytics_Entry *entry = an->last;
+
+   if (entry && !strcmp(entry->scope, scope) && !strcmp(entry->name, name))
+      return(entry);
+
+   for (entry = an->entries; entry; entry = entry->next) {
+      if (!strcmp(entry->scope, scope) && !strcmp(entry->name, name)) {
+         an->last = entry;
+         return(entry);
+      }
+   }
+
+   if ((entry = (Analytics_Entry *) calloc(1, sizeof(*entry))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      return(NULL);
+   }
+   entry->scope = scope;
+   strncpy(entry->name, name, AN_NAME_MAX);
+   entry->name[AN_NAME_MAX -1] = '\0';
+   entry->next = an->entries;
+   an->entries = entry;
+   an->count++;
+   an->last = entry;
+   return(entry);
+}
+
+/******************************************************************************
+Name:  analytics_add / analytics_add_file
+
+Add a value to one of an entry's histograms.  analytics_add_file() adds the
+size and ages of one file.
+
+******************************************************************************/
+int analytics_add(Analytics_Entry *entry, Analytics_Metric metric, uint64_t value)
+{
+   if (entry == NULL)
+      return(-1);
+
+   if (entry->histo[metric] == NULL) {
+      if ((entry->histo[metric] = (Histo *) malloc(sizeof(Histo))) == NULL) {
+         fprintf(stderr, "Memory allocation failed\n");
+         return(-1);
+      }
+      histo_init(entry->histo[metric]);
+   }
+   histo_add(entry->histo[metric], value);
+   return(0);
+}
+
+int analytics_add_file(Analytics       *an,
+                       Analytics_Entry *entry,
+                       uint64_t        size,
+                       time_t          atime,
+                       time_t          mtime)
+{
+   // clocks aren't always in sync, so a file can be from the future
+   uint64_t atime_age = (an->now > atime) ? (uint64_t)(an->now - atime) : 0;
+   uint64_t mtime_age = (an->now > mtime) ? (uint64_t)(an->now - mtime) : 0;
+
+   if (analytics_add(entry, AN_SIZE, size)
+       || analytics_add(entry, AN_ATIME_AGE, atime_age)
+       || analytics_add(entry, AN_MTIME_AGE, mtime_age))
+      return(-1);
+   return(0);
+}
+
+/******************************************************************************
+Name:  analytics_merge
+
+Add one scan thread's histograms into <dest>.  Histograms that <dest>
+doesn't have yet are moved, rather than copied.  <src> is freed.
+
+******************************************************************************/
+int analytics_merge(Analytics *dest, Analytics *src)
+{
+   Analytics_Entry *src_entry;
+   Analytics_Entry *dest_entry;
+   int rc = 0;
+   int i;
+
+   for (src_entry = src->entries; src_entry; src_entry = src_entry->next) {
+      if ((dest_entry = analytics_entry(dest, src_entry->scope, 
+                                        src_entry->name)) == NULL) {
+         rc = -1;
+         continue;
+      }
+      for (i = 0; i < AN_METRIC_COUNT; i++) {
+         if (src_entry->histo[i] == NULL)
+            continue;
+         if (dest_entry->histo[i] == NULL) {
+            dest_entry->histo[i] = src_entry->histo[i];
+            src_entry->histo[i] = NULL;
+         }
+         else
+            histo_merge(dest_entry->histo[i], src_entry->histo[i]);
+      }
+   }
+   analytics_free(src);
+   return(rc);
+}
+
+/******************************************************************************
+Name:  analytics_print
+
+Write all the histograms as CSV (format in histo.h), sorted by scope and
+name, so runs can be compared with diff.
+
+******************************************************************************/
+static int analytics_compare(const void *a, const void *b)
+{
+   const Analytics_Entry *entry_a = *(const Analytics_Entry **)a;
+   const Analytics_Entry *entry_b = *(const Analytics_Entry **)b;
+   int rc = strcmp(entry_a->scope, entry_b->scope);
+
+   return(rc ? rc : strcmp(entry_a->name, entry_b->name));
+}
+
+int analytics_print(FILE *fp, Analytics *an)
+{
+   Analytics_Entry **sorted;
+   Analytics_Entry *entry;
+   const Histo *histo;
+   size_t count = 0;
+   size_t i;
+   int metric;
+   int j;
+
+   if ((sorted = (Analytics_Entry **) malloc((an->count +1) * sizeof(*sorted))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      return(-1);
+   }
+   for (entry = an->entries; entry; entry = entry->next)
+      sorted[count++] = entry;
+   qsort(sorted, count, sizeof(*sorted), analytics_compare);
+
+   fprintf(fp, "# time,%lld\n", (long long)an->now);
+   fprintf(fp, "# summary,scope,name,metric,count,sum,min,max,p50,p90,p99\n");
+   fprintf(fp, "# bucket,scope,name,metric,low,high,count\n");
+
+   for (i = 0; i < count; i++) {
+      entry = sorted[i];
+      for (metric = 0; metric < AN_METRIC_COUNT; metric++) {
+         if ((histo = entry->histo[metric]) == NULL)
+            continue;
+
+         fprintf(fp, "summary,%s,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                 entry->scope, entry->name, analytics_metric_name[metric],
+                 (unsigned long long)histo->count,
+                 (unsigned long long)histo->sum,
+                 (unsigned long long)histo->min,
+                 (unsigned long long)histo->max,
+                 (unsigned long long)histo_percentile(histo, 50),
+                 (unsigned long long)histo_percentile(histo, 90),
+                 (unsigned long long)histo_percentile(histo, 99));
+
+         for (j = 0; j < HISTO_BUCKETS; j++) {
+            if (histo->bucket[j] == 0)
+               continue;
+            fprintf(fp, "bucket,%s,%s,%s,%llu,%llu,%llu\n",
+                    entry->scope, entry->name, analytics_metric_name[metric],
+                    (unsigned long long)histo_bucket_low(j),
+                    (unsigned long long)histo_bucket_high(j),
+                    (unsigned long long)histo->bucket[j]);
+         }
+      }
+   }
+   free(sorted);
+   return(ferror(fp) ? -1 : 0);
+}
+
+/******************************************************************************
+Name:  analytics_free
+
+******************************************************************************/
+void analytics_free(Analytics *an)
+{
+   Analytics_Entry *entry;
+   Analytics_Entry *next;
+   int i;
+
+   for (entry = an->entries; entry; entry = next) {
+      next = entry->next;
+      for (i = 0; i < AN_METRIC_COUNT; i++)
+         free(entry->histo[i]);
+      free(entry);
+   }
+   an->entries = NULL;
+   an->last = NULL;
+   an->count = 0;
+}
+
+/******************************************************************************
+Name:  analytics_repo_name
+
+The objid xattr starts with the bucket, which is the repo name (see
+MARFS_BUCKET_RD_FORMAT in marfs_base.h).  Copy it into <repo>.
+
+******************************************************************************/
+int analytics_repo_name(const char *objid, char *repo, size_t size)
+{
+   const char *slash = strchr(objid, '/');
+   size_t len;
+
+   if (slash == NULL || slash == objid)
+      return(-1);
+   len = slash - objid;
+   if (len >= size)
+      len = size -1;
+   memcpy(repo, objid, len);
+   repo[len] = '\0';
+   return(0);
+}
@@ -71,9 +71,97 @@
 #ifndef HISTO_H
 #define HISTO_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
 enum histo_type {BASE_2, NON_LOG};
 
 
 void print_histo(size_t increment, size_t max_bucket, int *count_value, enum histo_type type, FILE *file_fd);
 void fill_histogram(size_t value, size_t increment, size_t  max_bucket, int *count_value, enum histo_type type);
+
+
+/*
+ * Log-linear histograms
+ *
+ * Each power of two is split into HISTO_SUB_BUCKETS equal buckets, so a
+ * value's bucket is within 1/HISTO_SUB_BUCKETS of the value, whether it
+ * is a few bytes or a few TB.  Values below HISTO_SUB_BUCKETS get a bucket
+ * each.  Values of 2^HISTO_MAX_BITS or more all go in the last bucket.
+ * Histograms of the same shape can simply be added, so each scan thread
+ * keeps its own, and they are merged when the threads are done.
+ */
+#define HISTO_SUB_BITS     3
+#define HISTO_SUB_BUCKETS  (1 << HISTO_SUB_BITS)
+#define HISTO_MAX_BITS     48
+#define HISTO_BUCKETS      ((HISTO_MAX_BITS - HISTO_SUB_BITS + 1) * HISTO_SUB_BUCKETS)
+
+typedef struct Histo {
+   uint64_t count;
+   uint64_t sum;
+   uint64_t min;
+   uint64_t max;
+   uint64_t bucket[HISTO_BUCKETS];
+} Histo;
+
+void     histo_init(Histo *histo);
+void     histo_add(Histo *histo, uint64_t value);
+void     histo_merge(Histo *dest, const Histo *src);
+uint64_t histo_bucket_low(int index);
+uint64_t histo_bucket_high(int index);
+uint64_t histo_percentile(const Histo *histo, double pct);
+
+
+/*
+ * Analytics
+ *
+ * A set of histograms (one per metric) for each namespace and each repo
+ * seen by a scan.  Histograms are only allocated when something is added
+ * to them.  Ages are in seconds, relative to the start of the scan.
+ *
+ * analytics_print() writes CSV, for scripts that tune chunk_size,
+ * pack_size and repo ranges.  One line per histogram:
+ *
+ *   summary,<scope>,<name>,<metric>,<count>,<sum>,<min>,<max>,<p50>,<p90>,<p99>
+ *
+ * followed by one line per non-empty bucket, [low, high):
+ *
+ *   bucket,<scope>,<name>,<metric>,<low>,<high>,<count>
+ */
+typedef enum {
+   AN_SIZE = 0,                 // file size (bytes)
+   AN_ATIME_AGE,                // seconds since last access
+   AN_MTIME_AGE,                // seconds since last modification
+   AN_CHUNKS,                   // objects per uni/multi file
+   AN_PACKED_FILES,             // files per packed object
+   AN_METRIC_COUNT
+} Analytics_Metric;
+
+#define AN_SCOPE_NS    "ns"
+#define AN_SCOPE_REPO  "repo"
+#define AN_NAME_MAX    256
+
+typedef struct Analytics_Entry {
+   struct Analytics_Entry *next;
+   const char             *scope;      // AN_SCOPE_*
+   char                   name[AN_NAME_MAX];
+   Histo                  *histo[AN_METRIC_COUNT];
+} Analytics_Entry;
+
+typedef struct Analytics {
+   Analytics_Entry *entries;
+   Analytics_Entry *last;              // most recent lookup
+   size_t          count;
+   time_t          now;                // ages are relative to this
+} Analytics;
+
+void             analytics_init(Analytics *an, time_t now);
+Analytics_Entry *analytics_entry(Analytics *an, const char *scope, const char *name);
+int              analytics_add(Analytics_Entry *entry, Analytics_Metric metric, uint64_t value);
+int              analytics_add_file(Analytics *an, Analytics_Entry *entry, uint64_t size, time_t atime, time_t mtime);
+int              analytics_merge(Analytics *dest, Analytics *src);
+int              analytics_print(FILE *fp, Analytics *an);
+void             analytics_free(Analytics *an);
+int              analytics_repo_name(const char *objid, char *repo, size_t size);
 #endif
@@ -78,7 +78,9 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include "marfs_quota.h"
+#include "ledger.h"
 #include "marfs_configuration.h"
 
 
@@ -98,8 +100,10 @@ Name: main
 
 int main(int argc, char **argv) {
    FILE *outfd;
+   FILE *analytics_fd = NULL;
    int ec;
    char *outf = NULL;
+   char *analytics_file = NULL;
    char *rdir = NULL;
    //unsigned int uid = 0;
    int fileset_id = -1;
@@ -109,19 +113,25 @@ int main(int argc, char **argv) {
    Fileset_Stats *fileset_stat_ptr = NULL;
    int fileset_scan_count = -1;
    unsigned int fileset_scan_index = 0; 
+   int scan_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+   int apply_journals = 0;
+   unsigned int i;
 
    if ((ProgName = strrchr(argv[0],'/')) == NULL)
       ProgName = argv[0];
    else
       ProgName++;
 
-   while ((c=getopt(argc,argv,"c:d:f:hi:o:u:")) != EOF) {
+   while ((c=getopt(argc,argv,"a:c:d:f:hi:lo:s:u:")) != EOF) {
       switch (c) {
+         case 'a': analytics_file = optarg; break;
          case 'c': fileset_scan_count =  atoi(optarg); break;
          case 'd': rdir = optarg; break;
          case 'f': fileset_id = atoi(optarg); break;
          case 'i': fileset_scan_index = atoi(optarg); break;
+         case 'l': apply_journals = 1; break;
          case 'o': outf = optarg; break;
+         case 's': scan_threads = atoi(optarg); break;
          //case 'u': uid = atoi(optarg); break;
          case 'h': print_usage();
          default:
@@ -130,6 +140,18 @@ int main(int argc, char **argv) {
       }
    }
    
+   // Just fold the fuse journals into the ledgers (no scan)
+   if (apply_journals) {
+      fileset_stat_ptr = read_config(&fileset_count); 
+      if (fileset_stat_ptr == NULL ) {
+         fprintf(stderr,"Problem with reading of configuration file\n");
+         exit(1);
+      }
+      ec = apply_ledgers(fileset_stat_ptr, fileset_count);
+      free(fileset_stat_ptr);
+      return (ec ? 1 : 0);
+   }
+
    if (rdir == NULL || outf == NULL) {
       fprintf(stderr,"%s: no directory (-d) or output file name (-o) \
               specified\n",ProgName);
@@ -213,9 +235,24 @@ int main(int argc, char **argv) {
       exit(1);
    }
 
+   // histograms for tuning (see histo.h)
+   if (analytics_file != NULL) {
+      analytics_fd = fopen(analytics_file,"w");
+      if (analytics_fd == NULL) {
+         fprintf(stderr, "Error opening analytics file %s\n", analytics_file);
+         exit(1);
+      }
+   }
+
+   // Changes logged by fuse up to now will be counted by the scan
+   for (i=fileset_scan_index; i < fileset_scan_count+fileset_scan_index; i++)
+      if (strcmp(fileset_stat_ptr[i].fileset_name, "trash"))
+         drain_journal(&fileset_stat_ptr[i], 0);
+
    // Add filsets to structure so that inode scan can update fileset info
    ec = read_inodes(rdir, outfd, fileset_id, fileset_stat_ptr, 
-                    fileset_scan_count,fileset_scan_index);
+                    fileset_scan_count,fileset_scan_index,scan_threads,
+                    analytics_fd);
    //free(myNamespaceList);
    free(fileset_stat_ptr);
    return (0);   
@@ -254,9 +291,15 @@ Name: print_usage
 void print_usage()
 {
    fprintf(stderr,"Usage: %s -d gpfs_path -o ouput_log_file [-c fileset_count]\
-            [-i start_index] [-f fileset_id]\n",ProgName);
+            [-i start_index] [-f fileset_id] [-s scan_threads] \
+            [-a analytics_file]\n",ProgName);
+   fprintf(stderr,"       %s -l\n",ProgName);
    fprintf(stderr, "NOTE: -c and -i are optional.  Default behavior will be \
            to try to match all filesets defined in config\n");
+   fprintf(stderr, "NOTE: -a writes size, age and chunk histograms, per \
+           namespace and repo, as CSV\n");
+   fprintf(stderr, "NOTE: -l just applies the fuse journals to the ledgers, \
+           and updates fsinfo (no scan)\n");
    fprintf(stderr, "See README for information\n");
 }
 
@@ -280,6 +323,48 @@ static void fill_size_histo(const         gpfs_iattr_t *iattrP,
      fileset_buffer[index].large_count+= 1;
 }
 
+/***************************************************************************** 
+Name: analyze_file 
+
+This function adds a file to the histograms for its namespace, and for the
+repo holding its object (from the objid xattr).  A packed object is
+counted once, by the file at offset zero.
+*****************************************************************************/
+void analyze_file(Analytics          *an, 
+                  const gpfs_iattr_t *iattrP, 
+                  MarFS_XattrPost    *post, 
+                  Marfs_Xattr        *xattr_ptr, 
+                  int                xattr_count,
+                  const char         *fileset_name)
+{
+   Analytics_Entry *entry[2];
+   char repo_name[MARFS_MAX_REPO_NAME];
+   int objid_index;
+   int i;
+
+   entry[0] = analytics_entry(an, AN_SCOPE_NS, fileset_name);
+   entry[1] = NULL;
+   objid_index = get_xattr_value(xattr_ptr, "user.marfs_objid", 
+                                 xattr_count, NULL);
+   if (objid_index != -1 &&
+       !analytics_repo_name(xattr_ptr[objid_index].xattr_value, 
+                            repo_name, MARFS_MAX_REPO_NAME))
+      entry[1] = analytics_entry(an, AN_SCOPE_REPO, repo_name);
+
+   for (i = 0; i < 2; i++) {
+      if (entry[i] == NULL)
+         continue;
+      analytics_add_file(an, entry[i], iattrP->ia_size, 
+                         iattrP->ia_atime.tv_sec, iattrP->ia_mtime.tv_sec);
+      if (post->obj_type == OBJ_PACKED) {
+         if (post->obj_offset == 0)
+            analytics_add(entry[i], AN_PACKED_FILES, post->chunks);
+      }
+      else if (!(post->flags & POST_INLINE))
+         analytics_add(entry[i], AN_CHUNKS, post->chunks);
+   }
+}
+
 /***************************************************************************** 
 Name:  get_xattr_value
 
@@ -415,19 +500,211 @@ Name: read_inodes
 This function opens an inode scan in order to provide size/block information
 as well as file extended attribute information
 
+The inode space is split into ranges, and <scan_threads> threads each run
+their own inode scan, taking ranges in order (see scan_inodes()).  Each
+thread counts into its own copy of the fileset stats, and the copies are
+added up at the end.  The same goes for the histograms written to
+<analytics_fd>, if it isn't NULL.
 *****************************************************************************/
 int read_inodes(const char    *fnameP, 
                 FILE          *outfd, 
                 int           fileset_id, 
                 Fileset_Stats *fileset_stat_ptr, 
                 size_t        rec_count, 
-                size_t        offset_start) {
+                size_t        offset_start,
+                int           scan_threads,
+                FILE          *analytics_fd) {
+   int rc = 0;
+   int i;
+   gpfs_iscan_t *iscanP = NULL;
+   gpfs_fssnap_handle_t *fsP = NULL;
+   gpfs_ino_t max_inode = 0;
+   Inode_Ranges ranges;
+   Quota_Scan *scans;
+   size_t stat_count = rec_count + offset_start;
+   int early_exit =0;
+   Analytics analytics;
+   time_t now = time(0);
+
+   analytics_init(&analytics, now);
+
+   /*
+    *  Get the unique handle for the filesysteme
+   */
+   if ((fsP = gpfs_get_fssnaphandle_by_path(fnameP)) == NULL) {
+      rc = errno;
+      fprintf(stderr, "%s: line %d - gpfs_get_fshandle_by_path: %s\n", 
+              ProgName,__LINE__,strerror(rc));
+      early_exit = 1;
+      clean_exit(outfd, iscanP, fsP, early_exit);
+   }
+
+   /*
+    *  Open (and close) a scan just to get the highest inode number
+   */
+   if ((iscanP = gpfs_open_inodescan_with_xattrs(fsP, NULL, -1, NULL, 
+                                                 &max_inode)) == NULL) {
+      rc = errno;
+      fprintf(stderr, "%s: line %d - gpfs_open_inodescan: %s\n", 
+      ProgName,__LINE__,strerror(rc));
+      early_exit = 1;
+      clean_exit(outfd, iscanP, fsP, early_exit);
+   }
+   gpfs_close_inodescan(iscanP);
+   iscanP = NULL;
+
+   if (scan_threads < 1)
+      scan_threads = 1;
+   else if (scan_threads > SCAN_THREADS_MAX)
+      scan_threads = SCAN_THREADS_MAX;
+   init_ranges(&ranges, fsP, max_inode, scan_threads);
+
+   if ((scans = (Quota_Scan *) calloc(scan_threads, sizeof(*scans))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      early_exit = 1;
+      clean_exit(outfd, iscanP, fsP, early_exit);
+   }
+
+   for (i=0; i < scan_threads; i++) {
+      scans[i].ranges       = &ranges;
+      scans[i].outfd        = outfd;
+      scans[i].rec_count    = rec_count;
+      scans[i].offset_start = offset_start;
+      scans[i].fileset_id   = fileset_id;
+      scans[i].analyze      = (analytics_fd != NULL);
+      analytics_init(&scans[i].analytics, now);
+
+      // names and fsinfo paths are needed for lookups
+      scans[i].fileset_stat_ptr = 
+         (Fileset_Stats *) malloc(stat_count * sizeof(Fileset_Stats));
+      if (scans[i].fileset_stat_ptr == NULL) {
+         fprintf(stderr, "Memory allocation failed\n");
+         early_exit = 1;
+         clean_exit(outfd, iscanP, fsP, early_exit);
+      }
+      memcpy(scans[i].fileset_stat_ptr, fileset_stat_ptr, 
+             stat_count * sizeof(Fileset_Stats));
+      init_records(scans[i].fileset_stat_ptr, stat_count);
+
+      // If we can't get a thread, scan from here.  The ranges that are
+      // left will be taken by whatever threads do start.
+      if (pthread_create(&scans[i].thread, NULL, scan_inodes, &scans[i]))
+         scan_inodes(&scans[i]);
+      else
+         scans[i].started = 1;
+   }
+
+   for (i=0; i < scan_threads; i++) {
+      if (scans[i].started)
+         pthread_join(scans[i].thread, NULL);
+      if (scans[i].rc)
+         rc = scans[i].rc;
+      merge_stats(fileset_stat_ptr, scans[i].fileset_stat_ptr, stat_count);
+      free(scans[i].fileset_stat_ptr);
+      analytics_merge(&analytics, &scans[i].analytics);
+   }
+   free(scans);
+
+   if (rc) {
+      early_exit = 1;
+      clean_exit(outfd, iscanP, fsP, early_exit);
+   }
+   write_fsinfo(outfd, fileset_stat_ptr, rec_count, offset_start);
+   if (analytics_fd != NULL) {
+      if (analytics_print(analytics_fd, &analytics))
+         fprintf(stderr, "Error writing analytics\n");
+      fclose(analytics_fd);
+   }
+   analytics_free(&analytics);
+   clean_exit(outfd, iscanP, fsP, early_exit);
+   return(rc);
+}
+
+/***************************************************************************** 
+Name: init_ranges / next_range
+
+Cut the inode space (up to <max_inode>) into ranges, and hand them out to
+scan threads in order.  Returns 0 when there are no more ranges.  The
+range is [*start, *end).
+*****************************************************************************/
+void init_ranges(Inode_Ranges         *ranges, 
+                 gpfs_fssnap_handle_t *fsP, 
+                 gpfs_ino_t           max_inode, 
+                 int                  scan_threads) 
+{
+   if (max_inode == 0 || max_inode > SCAN_INODE_MAX)
+      max_inode = SCAN_INODE_MAX;
+
+   ranges->fsP = fsP;
+   ranges->max_inode = max_inode;
+   ranges->range_size = 
+      max_inode / (scan_threads * SCAN_RANGES_PER_THREAD) + 1;
+   ranges->next = 0;
+}
+
+int next_range(Inode_Ranges *ranges, gpfs_ino_t *start, gpfs_ino_t *end)
+{
+   unsigned long long range = __sync_fetch_and_add(&ranges->next, 1);
+   unsigned long long first = range * ranges->range_size;
+   unsigned long long last  = first + ranges->range_size;
+
+   if (first > ranges->max_inode)
+      return(0);
+   if (last > (unsigned long long)ranges->max_inode +1)
+      last = (unsigned long long)ranges->max_inode +1;
+
+   *start = (gpfs_ino_t)first;
+   *end   = (gpfs_ino_t)last;
+   return(1);
+}
+
+/***************************************************************************** 
+Name: merge_stats 
+
+Add the counts in one thread's stats into <dest>
+*****************************************************************************/
+void merge_stats(Fileset_Stats *dest, Fileset_Stats *src, size_t count)
+{
+   size_t i;
+
+   for (i=0; i < count; i++) {
+      dest[i].sum_size             += src[i].sum_size;
+      dest[i].sum_blocks           += src[i].sum_blocks;
+      dest[i].sum_filespace_used   += src[i].sum_filespace_used;
+      dest[i].sum_file_count       += src[i].sum_file_count;
+      dest[i].sum_trash            += src[i].sum_trash;
+      dest[i].sum_trash_file_count += src[i].sum_trash_file_count;
+      dest[i].adjusted_size        += src[i].adjusted_size;
+      dest[i].small_count          += src[i].small_count;
+      dest[i].medium_count         += src[i].medium_count;
+      dest[i].large_count          += src[i].large_count;
+      dest[i].obj_type.uni_count    += src[i].obj_type.uni_count;
+      dest[i].obj_type.multi_count  += src[i].obj_type.multi_count;
+      dest[i].obj_type.packed_count += src[i].obj_type.packed_count;
+   }
+}
+
+/***************************************************************************** 
+Name: scan_inodes 
+
+One scan thread.  Opens its own inode scan, and processes inode ranges until
+there are none left.
+*****************************************************************************/
+void *scan_inodes(void *arg) {
+   Quota_Scan    *scan = (Quota_Scan *) arg;
+   Fileset_Stats *fileset_stat_ptr = scan->fileset_stat_ptr;
+   FILE          *outfd = scan->outfd;
+   size_t        rec_count = scan->rec_count;
+   size_t        offset_start = scan->offset_start;
+   int           fileset_id = scan->fileset_id;
+   gpfs_ino_t    start;
+   gpfs_ino_t    end;
+
    int rc = 0;
    const gpfs_iattr_t *iattrP;
    const char *xattrBP;
    unsigned int xattr_len; 
    register gpfs_iscan_t *iscanP = NULL;
-   gpfs_fssnap_handle_t *fsP = NULL;
    Marfs_Xattr mar_xattrs[MAX_MARFS_XATTR];
    Marfs_Xattr *xattr_ptr = mar_xattrs;
    int xattr_count;
@@ -451,170 +728,162 @@ int read_inodes(const char    *fnameP,
 
    MarFS_XattrPost post;
   
-   int early_exit =0;
    int xattr_index;
    char *md_path_ptr;
 
-   //outfd = fopen(onameP,"w");
-
-   /*
-    *  Get the unique handle for the filesysteme
-   */
-   if ((fsP = gpfs_get_fssnaphandle_by_path(fnameP)) == NULL) {
-      rc = errno;
-      fprintf(stderr, "%s: line %d - gpfs_get_fshandle_by_path: %s\n", 
-              ProgName,__LINE__,strerror(rc));
-      early_exit = 1;
-      clean_exit(outfd, iscanP, fsP, early_exit);
-   }
-
-   /*
-    *  Open the inode file for an inode scan with xattrs
-   */
-  //if ((iscanP = gpfs_open_inodescan(fsP, NULL, NULL)) == NULL) {
-   if ((iscanP = gpfs_open_inodescan_with_xattrs(fsP, NULL, -1, NULL, NULL)) 
-        == NULL) {
-      rc = errno;
+   if ((iscanP = gpfs_open_inodescan_with_xattrs(scan->ranges->fsP, NULL, 
+                                                 -1, NULL, NULL)) == NULL) {
+      scan->rc = errno;
       fprintf(stderr, "%s: line %d - gpfs_open_inodescan: %s\n", 
-      ProgName,__LINE__,strerror(rc));
-      early_exit = 1;
-      clean_exit(outfd, iscanP, fsP, early_exit);
+      ProgName,__LINE__,strerror(scan->rc));
+      return(NULL);
    }
 
-
-   while (1) {
-      rc = gpfs_next_inode_with_xattrs(iscanP,0x7FFFFFFF,&iattrP,&xattrBP,
-                                       &xattr_len);
-      //rc = gpfs_next_inode(iscanP, 0x7FFFFFFF, &iattrP);
-      if (rc != 0) {
-         rc = errno;
-         fprintf(stderr, "gpfs_next_inode: %s\n", strerror(rc));
-         early_exit = 1;
-         clean_exit(outfd, iscanP, fsP, early_exit);
-      }
-      // Are we done?
-      if ((iattrP == NULL) || (iattrP->ia_inode > 0x7FFFFFFF))
+   while (next_range(scan->ranges, &start, &end)) {
+      if (gpfs_seek_inode(iscanP, start)) {
+         scan->rc = errno;
+         fprintf(stderr, "gpfs_seek_inode %u: %s\n", start, strerror(scan->rc));
          break;
+      }
 
-      // Determine if invalid inode error 
-      if (iattrP->ia_flags & GPFS_IAFLAG_ERROR) {
-         fprintf(stderr,"%s: invalid inode %9d (GPFS_IAFLAG_ERROR)\n", 
-                 ProgName,iattrP->ia_inode);
-         continue;
-      } 
+      while (1) {
+         rc = gpfs_next_inode_with_xattrs(iscanP,end,&iattrP,&xattrBP,
+                                          &xattr_len);
+         if (rc != 0) {
+            scan->rc = errno;
+            fprintf(stderr, "gpfs_next_inode: %s\n", strerror(scan->rc));
+            break;
+         }
+         // Are we done with this range?
+         if ((iattrP == NULL) || (iattrP->ia_inode >= end))
+            break;
+
+         // Determine if invalid inode error 
+         if (iattrP->ia_flags & GPFS_IAFLAG_ERROR) {
+            fprintf(stderr,"%s: invalid inode %9d (GPFS_IAFLAG_ERROR)\n", 
+                    ProgName,iattrP->ia_inode);
+            continue;
+         } 
 
-      // If fileset_id is specified then only look for those inodes and xattrs
-      if (fileset_id >= 0) {
-         if (fileset_id != iattrP->ia_filesetid){
-            continue; 
+         // If fileset_id is specified then only look for those inodes and xattrs
+         if (fileset_id >= 0) {
+            if (fileset_id != iattrP->ia_filesetid){
+               continue; 
+            }
          }
-      }
 
-      // This is handy for debug at the moment
-      if (iattrP->ia_inode != 3) {	/* skip the root inode */
-         //LOG(LOG_INFO, "%u|%lld|%lld|%d|%d|%u|%u|%u|%u|%u|%lld|%d\n",
-         //   iattrP->ia_inode, iattrP->ia_size,iattrP->ia_blocks,
-         //   iattrP->ia_nlink,iattrP->ia_filesetid, iattrP->ia_uid, 
-         //   iattrP->ia_gid, iattrP->ia_mode, iattrP->ia_atime.tv_sec,
-         //   iattrP->ia_mtime.tv_sec, iattrP->ia_blocks, iattrP->ia_xperm );
-
-         /*
-         At this point determine if the last inode fileset name matches this one.  if not,
-         call a function to determine which struct index contains that fileset
-         the function will return an index and this function will update appropriate 
-         fields.
-         */
-         if (last_fileset_id != iattrP->ia_filesetid) {
-            //gpfs_igetfilesetname(iscanP, iattrP->ia_filesetid, &fileset_name_buffer, 32); 
-            gpfs_igetfilesetname(iscanP, iattrP->ia_filesetid, 
-                                 &fileset_name_buffer, MARFS_MAX_NAMESPACE_NAME); 
-            struct_index = lookup_fileset(fileset_stat_ptr,rec_count,
-                                          offset_start,fileset_name_buffer);
+         // This is handy for debug at the moment
+         if (iattrP->ia_inode != 3) {	/* skip the root inode */
+            //LOG(LOG_INFO, "%u|%lld|%lld|%d|%d|%u|%u|%u|%u|%u|%lld|%d\n",
+            //   iattrP->ia_inode, iattrP->ia_size,iattrP->ia_blocks,
+            //   iattrP->ia_nlink,iattrP->ia_filesetid, iattrP->ia_uid, 
+            //   iattrP->ia_gid, iattrP->ia_mode, iattrP->ia_atime.tv_sec,
+            //   iattrP->ia_mtime.tv_sec, iattrP->ia_blocks, iattrP->ia_xperm );
+
+            /*
+            At this point determine if the last inode fileset name matches this one.  if not,
+            call a function to determine which struct index contains that fileset
+            the function will return an index and this function will update appropriate 
+            fields.
+            */
+            if (last_fileset_id != iattrP->ia_filesetid) {
+               //gpfs_igetfilesetname(iscanP, iattrP->ia_filesetid, &fileset_name_buffer, 32); 
+               gpfs_igetfilesetname(iscanP, iattrP->ia_filesetid, 
+                                    &fileset_name_buffer, MARFS_MAX_NAMESPACE_NAME); 
+               struct_index = lookup_fileset(fileset_stat_ptr,rec_count,
+                                             offset_start,fileset_name_buffer);
             
-             LOG(LOG_INFO, "scan fileset = %s\n", fileset_name_buffer);
-            if (struct_index == -1) 
-               continue;
-            last_struct_index = struct_index;
-            last_fileset_id = iattrP->ia_filesetid;
-         }
+                LOG(LOG_INFO, "scan fileset = %s\n", fileset_name_buffer);
+               if (struct_index == -1) 
+                  continue;
+               last_struct_index = struct_index;
+               last_fileset_id = iattrP->ia_filesetid;
+            }
 
-         // Do we have extended attributes?
-         // This will be modified as time goes on - what xattrs do we care about
-         if (iattrP->ia_xperm == 2 && xattr_len >0 ) {
-            xattr_ptr = &mar_xattrs[0];
-            // get marfs xattrs and associated values
-            if ((xattr_count = get_xattrs(iscanP, xattrBP, xattr_len, 
-                                          marfs_xattrs, marfs_xattr_cnt, 
-                                          xattr_ptr)) > 0) {
+            // Do we have extended attributes?
+            // This will be modified as time goes on - what xattrs do we care about
+            if (iattrP->ia_xperm == 2 && xattr_len >0 ) {
                xattr_ptr = &mar_xattrs[0];
+               // get marfs xattrs and associated values
+               if ((xattr_count = get_xattrs(iscanP, xattrBP, xattr_len, 
+                                             marfs_xattrs, marfs_xattr_cnt, 
+                                             xattr_ptr)) > 0) {
+                  xattr_ptr = &mar_xattrs[0];
 
-               // Get post xattr value
-               if ((xattr_index=get_xattr_value(xattr_ptr, 
-                                                marfs_xattrs[post_index],
-                                                xattr_count, outfd)) != -1 ) {
-                   xattr_ptr = &mar_xattrs[xattr_index];
+                  // Get post xattr value
+                  if ((xattr_index=get_xattr_value(xattr_ptr, 
+                                                   marfs_xattrs[post_index],
+                                                   xattr_count, outfd)) != -1 ) {
+                      xattr_ptr = &mar_xattrs[xattr_index];
 
-                   LOG(LOG_INFO, "post xattr name = %s value = %s count = %d\n",
-                   xattr_ptr->xattr_name, xattr_ptr->xattr_value, xattr_count);
-               }
+                      LOG(LOG_INFO, "post xattr name = %s value = %s count = %d\n",
+                      xattr_ptr->xattr_name, xattr_ptr->xattr_value, xattr_count);
+                  }
 
-               // scan into post xattr structure
-               // if error parsing this xattr, skip and continue
-               if (parse_post_xattr(&post, xattr_ptr) == -1) {
-                  continue;             
-               }
-               fileset_stat_ptr[last_struct_index].sum_size+=iattrP->ia_size;
-               fileset_stat_ptr[last_struct_index].sum_file_count+=1;
-               LOG(LOG_INFO, "struct index = %d size = %llu file size sum\
-                   = %zu\n", last_struct_index,
-               iattrP->ia_size,fileset_stat_ptr[last_struct_index].sum_size);
-               fill_size_histo(iattrP, fileset_stat_ptr, last_fileset_id); 
-
-               // Determine obj_type and update counts
-               update_type(&post, fileset_stat_ptr, last_struct_index);
-
-               LOG(LOG_INFO,"found post chunk info bytes %zu\n", post.chunk_info_bytes);
-               fileset_stat_ptr[last_struct_index].sum_filespace_used += \
-                                post.chunk_info_bytes;
-
-               /* Determine if file in trash directory
-               * if this is trash there are a few steps here
-               *
-               *  1)  Read post xattr to determine which fileset the trash came from
-               *  2)  Update the fileset structure with a trash size count
-               *  3)  First sum the trash in this fileset
-               *
-               */
-               if ( post.flags & POST_TRASH ) {
-                  xattr_ptr = &mar_xattrs[0];
-                  md_path_ptr = &post.md_path[0];
-                  fileset_trash_index = lookup_fileset_path(fileset_stat_ptr, 
-                                                    rec_count, &trash_index, 
-                                                    md_path_ptr);
-                  if (fileset_trash_index == -1) {
-                     fprintf(stderr, "Error finding .path file for %s", 
-                             fileset_stat_ptr->fileset_name);
-                     fprintf(stderr, "md_path =%s\n", 
-                             md_path_ptr);
-                     continue;
+                  // scan into post xattr structure
+                  // if error parsing this xattr, skip and continue
+                  if (parse_post_xattr(&post, xattr_ptr) == -1) {
+                     continue;             
                   }
-                  else {
-                     fileset_stat_ptr[fileset_trash_index].sum_trash += iattrP->ia_size;
-                     fileset_stat_ptr[fileset_trash_index].sum_trash_file_count += 1;
-                     if (trash_index != -1) {
-                        fileset_stat_ptr[trash_index].sum_size += iattrP->ia_size;
-                        fileset_stat_ptr[trash_index].sum_file_count += 1;
-
-                     } 
+                  fileset_stat_ptr[last_struct_index].sum_size+=iattrP->ia_size;
+                  fileset_stat_ptr[last_struct_index].sum_file_count+=1;
+                  LOG(LOG_INFO, "struct index = %d size = %llu file size sum\
+                      = %zu\n", last_struct_index,
+                  iattrP->ia_size,fileset_stat_ptr[last_struct_index].sum_size);
+                  fill_size_histo(iattrP, fileset_stat_ptr, last_struct_index); 
+
+                  // Determine obj_type and update counts
+                  update_type(&post, fileset_stat_ptr, last_struct_index);
+                  if (scan->analyze)
+                     analyze_file(&scan->analytics, iattrP, &post, 
+                                  &mar_xattrs[0], xattr_count,
+                                  fileset_stat_ptr[last_struct_index].fileset_name);
+
+                  LOG(LOG_INFO,"found post chunk info bytes %zu\n", post.chunk_info_bytes);
+                  fileset_stat_ptr[last_struct_index].sum_filespace_used += \
+                                   post.chunk_info_bytes;
+
+                  /* Determine if file in trash directory
+                  * if this is trash there are a few steps here
+                  *
+                  *  1)  Read post xattr to determine which fileset the trash came from
+                  *  2)  Update the fileset structure with a trash size count
+                  *  3)  First sum the trash in this fileset
+                  *
+                  */
+                  if ( post.flags & POST_TRASH ) {
+                     xattr_ptr = &mar_xattrs[0];
+                     md_path_ptr = &post.md_path[0];
+                     fileset_trash_index = lookup_fileset_path(fileset_stat_ptr, 
+                                                       rec_count, &trash_index, 
+                                                       md_path_ptr);
+                     if (fileset_trash_index == -1) {
+                        fprintf(stderr, "Error finding .path file for %s", 
+                                fileset_stat_ptr->fileset_name);
+                        fprintf(stderr, "md_path =%s\n", 
+                                md_path_ptr);
+                        continue;
+                     }
+                     else {
+                        fileset_stat_ptr[fileset_trash_index].sum_trash += iattrP->ia_size;
+                        fileset_stat_ptr[fileset_trash_index].sum_trash_file_count += 1;
+                        if (trash_index != -1) {
+                           fileset_stat_ptr[trash_index].sum_size += iattrP->ia_size;
+                           fileset_stat_ptr[trash_index].sum_file_count += 1;
+
+                        } 
+                     }
                   }
                }
             }
          }
-      }
-   } // endwhile
-   write_fsinfo(outfd, fileset_stat_ptr, rec_count, offset_start);
-   clean_exit(outfd, iscanP, fsP, early_exit);
-   return(rc);
+      } // endwhile
+      if (scan->rc)
+         break;
+   } // endwhile ranges
+
+   gpfs_close_inodescan(iscanP);
+   return(NULL);
 }
 
 /***************************************************************************** 
@@ -754,6 +1023,11 @@ int trunc_fsinfo(FILE*         outfd,
                 fileset_stat_ptr[i].fsinfo_path, 
                 fileset_stat_ptr[i].sum_size);
          }
+
+         // the scan replaces whatever the ledger had
+         write_ledger(fileset_stat_ptr[i].fsinfo_path, 
+                      fileset_stat_ptr[i].sum_size,
+                      fileset_stat_ptr[i].sum_file_count);
       }
    }
    return 0;
@@ -897,3 +1171,182 @@ Fileset_Stats *read_config(unsigned int *count)
    *count = i;
    return(&fileset_stat_ptr[0]);
 }
+
+/******************************************************************************
+ * Name: read_ledger / write_ledger
+ *
+ * The ledger (<fsinfo_path>.ledger) holds the namespace's total bytes and
+ * names, as of the last scan, plus the fuse journals applied since then.
+ * (See fuse/src/ledger.h.)  A missing ledger reads as zeros.  The ledger is
+ * written to a temporary file, and renamed into place.
+******************************************************************************/
+int read_ledger(const char *fsinfo_path, long long *bytes, long long *names)
+{
+   char path[MAX_PATH_LENGTH];
+   FILE *fd;
+
+   *bytes = 0;
+   *names = 0;
+   if (snprintf(path, MAX_PATH_LENGTH, "%s%s", fsinfo_path, LEDGER_SUFFIX)
+       >= MAX_PATH_LENGTH) {
+      fprintf(stderr, "Ledger path too long for %s\n", fsinfo_path);
+      return(-1);
+   }
+   if ((fd = fopen(path, "r")) == NULL) 
+      return((errno == ENOENT) ? 0 : -1);
+
+   if (fscanf(fd, LEDGER_FORMAT, bytes, names) != 2) {
+      fprintf(stderr, "Couldn't parse ledger %s\n", path);
+      fclose(fd);
+      return(-1);
+   }
+   fclose(fd);
+   return(0);
+}
+
+int write_ledger(const char *fsinfo_path, long long bytes, long long names)
+{
+   char path[MAX_PATH_LENGTH];
+   char tmp_path[MAX_PATH_LENGTH];
+   FILE *fd;
+
+   // a truncated name could overwrite the wrong file
+   if ((snprintf(path, MAX_PATH_LENGTH, "%s%s", fsinfo_path, LEDGER_SUFFIX)
+        >= MAX_PATH_LENGTH)
+       || (snprintf(tmp_path, MAX_PATH_LENGTH, "%s.tmp", path)
+           >= MAX_PATH_LENGTH)) {
+      fprintf(stderr, "Ledger path too long for %s\n", fsinfo_path);
+      return(-1);
+   }
+   if ((fd = fopen(tmp_path, "w")) == NULL) {
+      fprintf(stderr, "Unable to write ledger %s: %s\n", 
+              tmp_path, strerror(errno));
+      return(-1);
+   }
+   fprintf(fd, LEDGER_FORMAT, bytes, names);
+   if (fclose(fd) || rename(tmp_path, path)) {
+      fprintf(stderr, "Unable to write ledger %s: %s\n", 
+              path, strerror(errno));
+      unlink(tmp_path);
+      return(-1);
+   }
+   return(0);
+}
+
+/******************************************************************************
+ * Name: drain_journal
+ *
+ * Empty the fuse journal (<fsinfo_path>.delta) for a namespace.  If <apply>
+ * is non-zero, the journal's deltas are first added to the ledger, and the
+ * fsinfo file is truncated to the new total (for check_quotas()).
+ * Otherwise, they are discarded (a scan is about to count everything).
+ *
+ * The journal stays locked (the same fcntl() lock fuse takes to append to
+ * it) from the read until it is emptied, so no lines are lost.
+******************************************************************************/
+int drain_journal(Fileset_Stats *fileset_stat_ptr, int apply)
+{
+   char path[MAX_PATH_LENGTH];
+   char line[128];
+   FILE *jfd;
+   int fd;
+   long long bytes = 0;
+   long long names = 0;
+   long long delta_bytes;
+   long long delta_names;
+   long long ledger_bytes;
+   long long ledger_names;
+   int ret = 0;
+   struct flock lk;
+
+   if (snprintf(path, MAX_PATH_LENGTH, "%s%s", 
+                fileset_stat_ptr->fsinfo_path, LEDGER_JOURNAL_SUFFIX)
+       >= MAX_PATH_LENGTH) {
+      fprintf(stderr, "Journal path too long for %s\n",
+              fileset_stat_ptr->fsinfo_path);
+      return(-1);
+   }
+   if ((fd = open(path, O_RDWR)) < 0) 
+      return((errno == ENOENT) ? 0 : -1);
+
+   memset(&lk, 0, sizeof(lk));
+   lk.l_type = F_WRLCK;
+   lk.l_whence = SEEK_SET;
+   if (fcntl(fd, F_SETLKW, &lk)) {
+      fprintf(stderr, "Unable to lock %s: %s\n", path, strerror(errno));
+      close(fd);
+      return(-1);
+   }
+
+   if ((jfd = fdopen(fd, "r")) == NULL) {
+      close(fd);
+      return(-1);
+   }
+   while (fgets(line, sizeof(line), jfd)) {
+      if (sscanf(line, LEDGER_JOURNAL_FORMAT, &delta_bytes, &delta_names) == 2) {
+         bytes += delta_bytes;
+         names += delta_names;
+      }
+   }
+
+   if (apply) {
+      if (read_ledger(fileset_stat_ptr->fsinfo_path, 
+                      &ledger_bytes, &ledger_names))
+         ret = -1;
+      else {
+         ledger_bytes += bytes;
+         ledger_names += names;
+         if (ledger_bytes < 0)
+            ledger_bytes = 0;
+         if (ledger_names < 0)
+            ledger_names = 0;
+
+         if (write_ledger(fileset_stat_ptr->fsinfo_path, 
+                          ledger_bytes, ledger_names))
+            ret = -1;
+         else if (truncate(fileset_stat_ptr->fsinfo_path, ledger_bytes)) {
+            fprintf(stderr, "Unable to truncate %s to %lld in namespace %s\n",
+                    fileset_stat_ptr->fsinfo_path, ledger_bytes,
+                    fileset_stat_ptr->fileset_name); 
+            ret = -1;
+         }
+         else
+            LOG(LOG_INFO, "%s: %lld bytes %lld names (delta %lld %lld)\n",
+                fileset_stat_ptr->fileset_name, ledger_bytes, ledger_names,
+                bytes, names);
+      }
+   }
+
+   // Keep the journal if the ledger couldn't be updated
+   if (! ret && ftruncate(fd, 0)) {
+      fprintf(stderr, "Unable to empty %s: %s\n", path, strerror(errno));
+      ret = -1;
+   }
+
+   lk.l_type = F_UNLCK;
+   fcntl(fd, F_SETLK, &lk);
+   fclose(jfd);
+   return(ret);
+}
+
+/******************************************************************************
+ * Name: apply_ledgers
+ *
+ * (-l)  Apply the fuse journals of all namespaces to their ledgers.
+******************************************************************************/
+int apply_ledgers(Fileset_Stats *fileset_stat_ptr, size_t rec_count)
+{
+   size_t i;
+   int ret = 0;
+
+   for (i=0; i < rec_count; i++) {
+      if (!strcmp(fileset_stat_ptr[i].fileset_name, "trash"))
+         continue;
+      if (drain_journal(&fileset_stat_ptr[i], 1)) {
+         fprintf(stderr, "Unable to apply journal for namespace %s\n",
+                 fileset_stat_ptr[i].fileset_name);
+         ret = -1;
+      }
+   }
+   return(ret);
+}
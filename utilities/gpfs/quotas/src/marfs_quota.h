@@ -77,11 +77,13 @@
 #include <sys/types.h>          // ino_t
 #include <sys/stat.h>
 #include <math.h>               // floorf
+#include <pthread.h>
 #include <gpfs_fcntl.h>
 // TEMP for now to allow buidling of config and usable fuse mount
 #define NEW_CONFIG
 
 #include "marfs_base.h"
+#include "histo.h"
 
 //#define MAX_XATTR_VAL_LEN 64
 //#define MAX_XATTR_NAME_LEN 32
@@ -95,6 +97,13 @@
 
 #define MAX_PATH_LENGTH 4096
 
+// The inode space is cut into ranges, which the scan threads take in
+// order.  More ranges than threads, so one busy range doesn't leave the
+// other threads idle.  (see read_inodes())
+#define SCAN_THREADS_MAX 64
+#define SCAN_RANGES_PER_THREAD 16
+#define SCAN_INODE_MAX 0x7FFFFFFF
+
 // Xattr info
 #define MAX_MARFS_XATTR 3
 #define MARFS_QUOTA_XATTR_CNT 3
@@ -138,8 +147,35 @@ typedef struct Fileset_Stats {
       struct store_type obj_type;
 } Fileset_Stats;
 
-
-int read_inodes(const char *fnameP, FILE *outfd, int fileset_id, Fileset_Stats *fileset_stat_ptr, size_t rec_count, size_t offset_start);
+typedef struct Inode_Ranges {
+   gpfs_fssnap_handle_t  *fsP;
+   gpfs_ino_t            max_inode;
+   gpfs_ino_t            range_size;
+   volatile unsigned int next;         // next range to scan
+} Inode_Ranges;
+
+// One inode-scan thread.  Counts go into its own copy of the stats, which
+// are added up when all the threads are done.
+typedef struct Quota_Scan {
+   Inode_Ranges  *ranges;
+   FILE          *outfd;
+   Fileset_Stats *fileset_stat_ptr;
+   size_t        rec_count;
+   size_t        offset_start;
+   int           fileset_id;
+   int           rc;                   // errno, if the scan failed
+   int           started;              // thread was created
+   pthread_t     thread;
+   int           analyze;              // fill <analytics> (-a)
+   Analytics     analytics;
+} Quota_Scan;
+
+
+int read_inodes(const char *fnameP, FILE *outfd, int fileset_id, Fileset_Stats *fileset_stat_ptr, size_t rec_count, size_t offset_start, int scan_threads, FILE *analytics_fd);
+void init_ranges(Inode_Ranges *ranges, gpfs_fssnap_handle_t *fsP, gpfs_ino_t max_inode, int scan_threads);
+int next_range(Inode_Ranges *ranges, gpfs_ino_t *start, gpfs_ino_t *end);
+void *scan_inodes(void *arg);
+void merge_stats(Fileset_Stats *dest, Fileset_Stats *src, size_t count);
 int clean_exit(FILE *fd, gpfs_iscan_t *iscanP, gpfs_fssnap_handle_t *fsP, int terminate);
 int get_xattr_value(Marfs_Xattr *xattr_ptr, const char *desired_xattr, int cnt, FILE *outfd);
 int get_xattrs(gpfs_iscan_t *iscanP,
@@ -152,11 +188,16 @@ void print_usage();
 void init_records(Fileset_Stats *fileset_stat_buf, unsigned int record_count);
 int lookup_fileset(Fileset_Stats *fileset_stat_ptr, size_t rec_count, size_t offset_start, char *inode_fileset);
 static void fill_size_histo(const gpfs_iattr_t *iattrP, Fileset_Stats *fileset_buffer, int index);
+void analyze_file(Analytics *an, const gpfs_iattr_t *iattrP, MarFS_XattrPost *post, Marfs_Xattr *xattr_ptr, int xattr_count, const char *fileset_name);
 int parse_post_xattr(MarFS_XattrPost* post, Marfs_Xattr* post_str);
 void write_fsinfo(FILE* outfd, Fileset_Stats* fileset_stat_ptr, size_t rec_count, size_t index_start);
 void update_type(MarFS_XattrPost * xattr_post, Fileset_Stats *fileset_stat_ptr, int index);
 int lookup_fileset_path(Fileset_Stats *fileset_stat_ptr, size_t rec_count, int *trash_index, char *md_path_ptr);
 Fileset_Stats * read_config(unsigned int *count);
+int read_ledger(const char *fsinfo_path, long long *bytes, long long *names);
+int write_ledger(const char *fsinfo_path, long long bytes, long long names);
+int drain_journal(Fileset_Stats *fileset_stat_ptr, int apply);
+int apply_ledgers(Fileset_Stats *fileset_stat_ptr, size_t rec_count);
 int trunc_fsinfo(FILE* outfd, Fileset_Stats* fileset_stat_ptr, size_t rec_count, size_t index_start);
 #endif
 